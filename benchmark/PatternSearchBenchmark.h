@@ -21,11 +21,10 @@ std::ostream& operator<<(std::ostream& out, const std::set<T>& s) {
 }
 
 // This class intended for simplifying testing of Hyperscan with files
-template<template <typename> class PatternSearchT>
+template<template <typename...> class PatternSearchT>
 class PatternSearchBenchmark {
 public:
     PatternSearchBenchmark & ReadFile(std::string path = "resources/war_peace") {
-        std::ifstream file(path);
         int fd = open(path.c_str(), O_RDONLY);
         if (fd == -1) {
             std::cerr << "CAN'T FIND FILE: " << path << std::endl;
@@ -34,12 +33,19 @@ public:
 
         struct stat st;
         fstat(fd, &st);
-        char * text = (char*) malloc(st.st_size);
-        read(fd, text, st.st_size);
 
-        _text = std::string(text, st.st_size);
+        // read straight into _text, without an intermediate buffer
+        _text.resize(st.st_size);
+        for (size_t done = 0; done < _text.size(); ) {
+            ssize_t n = read(fd, &_text[done], _text.size() - done);
+            if (n <= 0) {
+                _text.resize(done);
+                break;
+            }
+            done += n;
+        }
 
-        free(text);
+        close(fd);
 
         return *this;
     }
@@ -1,8 +1,13 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <set>
 #include <Hyperscan.h>
 #include <iomanip>
+#include <chrono>
+#include <thread>
+#include <Numa.h>
+#include <Normalizer.h>
 #include <PatternSearchBenchmark.h>
 #include <LinearSearch.h>
 #include <BoostScan.h>
@@ -200,7 +205,317 @@ void BM_PACKETS_1_5k(
     std::cerr << "  BM_PACKETS_1_5k: " << x << "; time in sec: " << cnt_s << std::endl;
 }
 
-template<template <typename> class PatternSearchT>
+// Find throughput of threads pinned to every NUMA node, the database is built on node 0,
+// so without replicas the threads of the other nodes read it through the interconnect
+void BM_NUMA(const int CNT_SCANS = 20) {
+    const NumaTopology& numa = NumaTopology::Instance();
+
+    for (bool replicas : {false, true}) {
+        HyperscanWrapper<int> ps;
+        ps.SetNumaReplicas(replicas);
+
+        for (size_t i = 0; i < patternHandler.patterns.size(); ++i) {
+            ps.Insert(".*" + patternHandler.patterns[i] + ".*", i);
+        }
+
+        numa.RunOnNode(0, [&ps]() { ps.Build(); });
+
+        std::vector<double> seconds(numa.NodeCount());
+        std::vector<std::thread> threads;
+
+        for (size_t node = 0; node < numa.NodeCount(); ++node) {
+            for (size_t cpu = 0; cpu < numa.Cpus(node).size(); ++cpu) {
+                threads.emplace_back([&numa, &ps, &seconds, node, cpu, CNT_SCANS]() {
+                    numa.PinCurrentThread(node);
+
+                    auto start = std::chrono::steady_clock::now();
+                    for (int i = 0; i < CNT_SCANS; ++i) {
+                        ps.Find(g_for_rf.text);
+                    }
+                    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+
+                    if (cpu == 0) seconds[node] = d.count();
+                });
+            }
+        }
+
+        for (std::thread& t: threads) {
+            t.join();
+        }
+
+        for (size_t node = 0; node < numa.NodeCount(); ++node) {
+            if (numa.Cpus(node).empty()) continue;
+
+            double gb = double(g_for_rf.text.size()) * CNT_SCANS / (1 << 30);
+            cerr << "  BM_NUMA replicas: " << replicas << "; node " << node << ": "
+                 << gb / seconds[node] << " GB/s per thread" << endl;
+        }
+    }
+}
+
+// Build wall time when shards are compiled by as many threads, and what it costs Find,
+// which has to scan the text with every shard in turn
+void BM_PARALLEL_BUILD(const int CNT_SCANS = 5) {
+    std::vector<size_t> cntThreads = {1, 2, 4, 8};
+    size_t cores = std::thread::hardware_concurrency();
+    if (cores > cntThreads.back()) cntThreads.push_back(cores);
+
+    for (size_t threads : cntThreads) {
+        HyperscanWrapper<int> ps;
+        ps.SetShardCount(threads);
+        ps.SetBuildThreads(threads);
+
+        for (size_t i = 0; i < patternHandler.patterns.size(); ++i) {
+            ps.Insert(".*" + patternHandler.patterns[i] + ".*", i);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        ps.Build();
+        std::chrono::duration<double> build = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < CNT_SCANS; ++i) {
+            ps.Find(g_for_rf.text);
+        }
+        std::chrono::duration<double> find = std::chrono::steady_clock::now() - start;
+
+        double gb = double(g_for_rf.text.size()) * CNT_SCANS / (1 << 30);
+        cerr << "  BM_PARALLEL_BUILD threads: " << threads << "; build: " << build.count()
+             << " sec; find: " << gb / find.count() << " GB/s" << endl;
+    }
+}
+
+// startup of a service with a separate instance per tenant: one Build after another
+// against BuildAll on every hardware thread
+void BM_TENANT_STARTUP(const int CNT_TENANTS = 2000, const int CNT_PATTERNS = 50) {
+    for (bool parallel : {false, true}) {
+        std::vector<std::unique_ptr<HyperscanWrapper<int>>> tenants;
+        std::vector<HyperscanWrapper<int> *> wrappers;
+
+        for (int t = 0; t < CNT_TENANTS; ++t) {
+            tenants.emplace_back(new HyperscanWrapper<int>());
+            wrappers.push_back(tenants.back().get());
+
+            for (int i = 0; i < CNT_PATTERNS; ++i) {
+                const string& p = patternHandler.patterns[(t * CNT_PATTERNS + i) % patternHandler.patterns.size()];
+                tenants.back()->Insert(".*" + p + ".*", i);
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        if (parallel) {
+            HyperscanWrapper<int>::BuildAll(wrappers);
+        } else {
+            for (HyperscanWrapper<int> * w: wrappers) {
+                w->Build();
+            }
+        }
+
+        std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+        cerr << "  BM_TENANT_STARTUP tenants: " << CNT_TENANTS << "; parallel: " << parallel
+             << "; time in sec: " << d.count() << endl;
+    }
+}
+
+// Find with a heavy DataT deduplicated through std::set against FindIds into a reused MatchSet
+void BM_MATCH_SET(const int CNT_PACKETS = 1e4) {
+    HyperscanWrapper<string> ps;
+
+    for (size_t i = 0; i < patternHandler.patterns.size(); ++i) {
+        ps.Insert(patternHandler.patterns[i].substr(0, 3), "rule " + patternHandler.patterns[i]);
+    }
+
+    ps.Build();
+
+    const string& text = g_for_rf.text;
+    const size_t LEN_PACKET = 1500;
+
+    size_t cnt = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CNT_PACKETS; ++i) {
+        vector<string> res = ps.Find(text.data() + i * LEN_PACKET % (text.size() - LEN_PACKET), LEN_PACKET);
+        cnt += set<string>(res.begin(), res.end()).size();
+    }
+    std::chrono::duration<double> find = std::chrono::steady_clock::now() - start;
+
+    size_t cntIds = 0;
+    HyperscanWrapper<string>::MatchSet matches;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CNT_PACKETS; ++i) {
+        ps.FindIds(text.data() + i * LEN_PACKET % (text.size() - LEN_PACKET), LEN_PACKET, matches);
+        cntIds += matches.Count();
+    }
+    std::chrono::duration<double> findIds = std::chrono::steady_clock::now() - start;
+
+    cerr << "  BM_MATCH_SET cnt: " << cnt << "; Find + set: " << find.count()
+         << " sec; cnt: " << cntIds << "; FindIds: " << findIds.count() << " sec" << endl;
+}
+
+// per-rule hit counts over a corpus: Find and a map of counts against Count into per-thread histograms and Merge
+void BM_HISTOGRAM(const int CNT_PACKETS = 1e5) {
+    HyperscanWrapper<int> ps;
+
+    for (size_t i = 0; i < g_for_rf.words.size(); ++i) {
+        ps.Insert(g_for_rf.words[i], i);
+    }
+
+    ps.Build();
+
+    const string& text = g_for_rf.text;
+    const size_t LEN_PACKET = 1500;
+    size_t cntThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::map<int, size_t>> maps(cntThreads);
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < cntThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i = t; i < CNT_PACKETS; i += cntThreads) {
+                for (int data: ps.Find(text.data() + i * LEN_PACKET % (text.size() - LEN_PACKET), LEN_PACKET)) {
+                    ++maps[t][data];
+                }
+            }
+        });
+    }
+    for (std::thread& t: threads) t.join();
+
+    std::map<int, size_t> total;
+    for (auto& m: maps) {
+        for (auto& c: m) total[c.first] += c.second;
+    }
+    std::chrono::duration<double> find = std::chrono::steady_clock::now() - start;
+
+    std::vector<HyperscanWrapper<int>::MatchHistogram> histograms(cntThreads);
+    threads.clear();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < cntThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            HyperscanWrapper<int>::Scratch scratch;
+            for (int i = t; i < CNT_PACKETS; i += cntThreads) {
+                ps.Count(text.data() + i * LEN_PACKET % (text.size() - LEN_PACKET), LEN_PACKET, histograms[t], scratch);
+            }
+        });
+    }
+    for (std::thread& t: threads) t.join();
+
+    for (size_t t = 1; t < cntThreads; ++t) {
+        histograms[0].Merge(histograms[t]);
+    }
+    std::chrono::duration<double> count = std::chrono::steady_clock::now() - start;
+
+    cerr << "  BM_HISTOGRAM threads: " << cntThreads << "; rules hit: " << total.size()
+         << "; Find + map: " << find.count() << " sec; Count + Merge: " << count.count() << " sec" << endl;
+}
+
+// lowercase + percent-decode + whitespace folding as three scalar passes against one pass of Normalizer
+void BM_NORMALIZE(const int CNT_ROUNDS = 20) {
+    const string& text = g_for_rf.text;
+    const unsigned steps = Normalizer::LOWERCASE | Normalizer::PERCENT_DECODE | Normalizer::FOLD_WHITESPACE;
+
+    size_t scalarLen = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < CNT_ROUNDS; ++r) {
+        string lower(text);
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+
+        string decoded;
+        decoded.reserve(lower.size());
+        for (size_t i = 0; i < lower.size(); ++i) {
+            if (lower[i] == '%' && i + 2 < lower.size() && isxdigit(lower[i + 1]) && isxdigit(lower[i + 2])) {
+                decoded.push_back((char) std::stoi(lower.substr(i + 1, 2), nullptr, 16));
+                i += 2;
+            } else {
+                decoded.push_back(lower[i]);
+            }
+        }
+
+        string folded;
+        folded.reserve(decoded.size());
+        for (char c: decoded) {
+            if (isspace((unsigned char) c)) {
+                if (!folded.empty() && folded.back() == ' ') continue;
+                c = ' ';
+            }
+            folded.push_back(c);
+        }
+        scalarLen = folded.size();
+    }
+    std::chrono::duration<double> scalar = std::chrono::steady_clock::now() - start;
+
+    Normalizer normalizer;
+    size_t len = 0;
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < CNT_ROUNDS; ++r) {
+        len = normalizer.Normalize(text.data(), text.size(), steps).size();
+    }
+    std::chrono::duration<double> fused = std::chrono::steady_clock::now() - start;
+
+    double mb = double(text.size()) * CNT_ROUNDS / (1 << 20);
+    cerr << "  BM_NORMALIZE avx2: " << Normalizer::HasAvx2() << "; len: " << scalarLen << " / " << len
+         << "; scalar passes MB/s: " << mb / scalar.count() << "; Normalizer MB/s: " << mb / fused.count() << endl;
+}
+
+// Insert + Build of one pattern next to many patterns with heavy data: the shards and the data chunks
+// that did not change are shared with the previous snapshot
+void BM_REBUILD(const int CNT_PATTERNS = 1e5, const int CNT_REBUILDS = 20) {
+    HyperscanWrapper<string> ps;
+    ps.SetShardCount(64);
+
+    for (int i = 0; i < CNT_PATTERNS; ++i) {
+        const string& p = patternHandler.patterns[i % patternHandler.patterns.size()];
+        ps.Insert(p + std::to_string(i), string(200, 'a' + i % 26));
+    }
+
+    ps.Build();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CNT_REBUILDS; ++i) {
+        ps.Insert("rebuild" + std::to_string(i), string(200, 'z'));
+        ps.Build();
+    }
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+
+    cerr << "  BM_REBUILD patterns: " << CNT_PATTERNS << "; sec per rebuild: " << d.count() / CNT_REBUILDS << endl;
+}
+
+// small packets scanned by every hardware thread, where taking the snapshot is a visible part of Find
+template <typename SyncPolicy>
+void BM_SYNC_POLICY(const char * name, const int CNT_PACKETS = 1e5) {
+    HyperscanWrapper<int, SyncPolicy> ps;
+
+    for (size_t i = 0; i < g_for_rf.words.size(); ++i) {
+        ps.Insert(g_for_rf.words[i], i);
+    }
+
+    ps.Build();
+
+    const size_t LEN_PACKET = 64;
+    size_t cntThreads = std::is_same<SyncPolicy, NoSync>::value ? 1 : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < cntThreads; ++t) {
+        threads.emplace_back([&ps, t, CNT_PACKETS]() {
+            for (int i = 0; i < CNT_PACKETS; ++i) {
+                size_t offset = (t * CNT_PACKETS + i) * LEN_PACKET % (g_for_rf.text.size() - LEN_PACKET);
+                ps.Find(g_for_rf.text.data() + offset, LEN_PACKET);
+            }
+        });
+    }
+
+    for (std::thread& t: threads) {
+        t.join();
+    }
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+
+    cerr << "  BM_SYNC_POLICY " << name << " threads: " << cntThreads << "; Find per sec per thread: "
+         << CNT_PACKETS / d.count() << endl;
+}
+
+template<template <typename...> class PatternSearchT>
 void BMAll() {
     BM_INSERT<PatternSearchT<int>>();
     BM_DELETE<PatternSearchT<int>>();
@@ -236,6 +551,16 @@ void BMAll() {
 void startBM() {
 #ifdef BENCHMARK
     cerr << "Hyperscan" << endl;
+    BM_NUMA();
+    BM_PARALLEL_BUILD();
+    BM_TENANT_STARTUP();
+    BM_MATCH_SET();
+    BM_HISTOGRAM();
+    BM_NORMALIZE();
+    BM_REBUILD();
+    BM_SYNC_POLICY<NoSync>("NoSync");
+    BM_SYNC_POLICY<MutexSync>("MutexSync");
+    BM_SYNC_POLICY<RcuSync>("RcuSync");
     BMAll<HyperscanWrapper>();
     cerr << "BoostScan" << endl;
     BMAll<BoostScan>();
@@ -0,0 +1,386 @@
+#ifndef ASYNCSCANNER_H
+#define ASYNCSCANNER_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cassert>
+
+#include <Hyperscan.h>
+
+namespace Hyperscan {
+
+/**
+ * @brief ограниченная очередь без блокировок для многих писателей и многих читателей (очередь Вьюкова)
+ *
+ *   У каждой ячейки свой счетчик последовательности, писатель и читатель захватывают ячейку <br>
+ * через CAS своего индекса и не ждут друг друга. Используется AsyncScanner: в очередь рабочего <br>
+ * пишут потоки событий, читает сам рабочий и рабочие, которые крадут задачи.
+ *
+ * @tparam T тип элемента, перемещаемый и конструируемый по умолчанию
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    /**
+     * @param capacity округляется вверх до степени двойки
+     */
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+
+        _cells.reset(new Cell[size]);
+        _mask = size - 1;
+
+        for (size_t i = 0; i < size; ++i) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /**
+     * @return false, если очередь заполнена
+     */
+    bool TryPush(T&& value) {
+        size_t pos = _enqueue.load(std::memory_order_relaxed);
+
+        for (;;) {
+            Cell& cell = _cells[pos & _mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+            if (diff == 0) {
+                if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _enqueue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @return false, если очередь пуста
+     */
+    bool TryPop(T& value) {
+        size_t pos = _dequeue.load(std::memory_order_relaxed);
+
+        for (;;) {
+            Cell& cell = _cells[pos & _mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+            if (diff == 0) {
+                if (_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _dequeue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+
+    // padded apart, producers and consumers do not invalidate each other's cache line
+    char _pad0[64];
+    std::atomic<size_t> _enqueue{0};
+    char _pad1[64];
+    std::atomic<size_t> _dequeue{0};
+    char _pad2[64];
+};
+
+/**
+ * @brief асинхронный поиск: потоки событий ставят тексты в очередь и не ждут, ищут рабочие потоки
+ *
+ *   У каждого рабочего своя очередь BoundedQueue и свой HyperscanWrapper::Scratch. Submit кладет запрос <br>
+ * в очереди по кругу, рабочий берет запросы из своей очереди пачками по \a batch, а когда она пуста, <br>
+ * крадет из чужих. Результат приходит в callback запроса на рабочем потоке или, если callback нет, <br>
+ * в очередь завершений, которую поток событий забирает через Poll. <br> <br>
+ *
+ *   Запросов в работе, включая не забранные через Poll завершения, не больше \a maxInFlight: <br>
+ * дальше Submit возвращает false, и поток событий сам решает, ждать или отбрасывать (backpressure). <br>
+ * Текст запроса не копируется и должен жить до его завершения.
+ *
+ * @remark thread-safe
+ * @tparam DataT тип данных паттернов HyperscanWrapper
+ * @tparam SyncPolicy политика синхронизации HyperscanWrapper
+ */
+template <typename DataT, typename SyncPolicy = MutexSync>
+class AsyncScanner {
+public:
+    typedef HyperscanWrapper<DataT, SyncPolicy> Wrapper;
+
+    /**
+     * @brief результат запроса
+     */
+    struct Completion {
+        uint64_t tag = 0;               //!< метка из Submit
+        std::vector<DataT> matches;     //!< данные сматчившихся паттернов, как у HyperscanWrapper::Find
+        Error error;                    //!< ошибка поиска
+    };
+
+    /**
+     * @brief вызывается на рабочем потоке, \a completion можно забрать через std::move
+     */
+    typedef std::function<void(Completion& completion)> Callback;
+
+    /**
+     * @brief запрос для SubmitBatch
+     */
+    struct Request {
+        const char * text = nullptr;
+        size_t len = 0;
+        uint64_t tag = 0;
+        Callback callback;              //!< пустой - завершение идет в Poll
+    };
+
+    /**
+     * @param hw[in] паттерны, должен жить дольше AsyncScanner
+     * @param workers[in] кол-во рабочих потоков, 0 - std::thread::hardware_concurrency()
+     * @param maxInFlight[in] максимум запросов в работе, см. Submit
+     * @param batch[in] сколько запросов рабочий берет из своей очереди подряд, прежде чем проверить чужие
+     */
+    AsyncScanner(const Wrapper& hw, size_t workers = 0, size_t maxInFlight = 4096, size_t batch = 16)
+        : _hw(hw)
+        , _maxInFlight(std::max<size_t>(maxInFlight, 1))
+        , _batch(std::max<size_t>(batch, 1))
+        , _completions(_maxInFlight)
+    {
+        if (!workers) workers = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+        for (size_t i = 0; i < workers; ++i) {
+            // every queue fits all requests, so Submit fails only because of maxInFlight
+            _queues.emplace_back(new BoundedQueue<Request>(_maxInFlight));
+        }
+
+        for (size_t i = 0; i < workers; ++i) {
+            _workers.emplace_back([this, i]() { Run(i); });
+        }
+    }
+
+    /**
+     * @brief дожидается завершения всех принятых запросов и останавливает рабочих
+     */
+    ~AsyncScanner() {
+        {
+            std::lock_guard<std::mutex> lock(_m);
+            _stop = true;
+        }
+        _cv.notify_all();
+
+        for (std::thread& worker: _workers) {
+            worker.join();
+        }
+    }
+
+    AsyncScanner(const AsyncScanner&) = delete;
+    AsyncScanner& operator=(const AsyncScanner&) = delete;
+
+    /**
+     * @brief ставит текст в очередь на поиск
+     * @param[in] text указатель на начало текста, должен жить до завершения
+     * @param[in] len длина текста
+     * @param[in] tag метка, возвращается в Completion
+     * @param[in] callback вызывается на рабочем потоке, пустой - завершение забирается через Poll
+     * @return false, если в работе уже maxInFlight запросов, запрос не принят
+     */
+    bool Submit(const char * text, size_t len, uint64_t tag, Callback callback = nullptr) {
+        Request request;
+        request.text = text;
+        request.len = len;
+        request.tag = tag;
+        request.callback = std::move(callback);
+
+        if (!Push(request)) return false;
+
+        Wake(1);
+        return true;
+    }
+
+    /**
+     * @brief ставит в очередь несколько запросов, будя рабочих один раз
+     * @param[in] requests принятые запросы перемещаются, их callback становится пустым
+     * @return сколько первых запросов принято, остальные не приняты из-за maxInFlight
+     */
+    size_t SubmitBatch(Request * requests, size_t count) {
+        size_t accepted = 0;
+        while (accepted < count && Push(requests[accepted])) {
+            ++accepted;
+        }
+
+        if (accepted) Wake(accepted);
+        return accepted;
+    }
+
+    /**
+     * @brief забирает завершения запросов без callback, не блокируется
+     * @param[out] out сюда добавляются завершения
+     * @param[in] max сколько забрать максимум
+     * @return кол-во забранных
+     */
+    size_t Poll(std::vector<Completion>& out, size_t max = std::numeric_limits<size_t>::max()) {
+        size_t res = 0;
+        Completion completion;
+
+        while (res < max && _completions.TryPop(completion)) {
+            out.push_back(std::move(completion));
+            ++res;
+        }
+
+        if (res) _inFlight.fetch_sub(res, std::memory_order_release);
+        return res;
+    }
+
+    /**
+     * @brief кол-во запросов в работе, включая не забранные через Poll завершения
+     */
+    size_t InFlight() const {
+        return _inFlight.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief кол-во рабочих потоков
+     */
+    size_t Workers() const {
+        return _workers.size();
+    }
+
+private:
+    bool Push(Request& request) {
+        // reserve a place first, so that maxInFlight holds even with many producers
+        if (_inFlight.fetch_add(1, std::memory_order_acq_rel) >= _maxInFlight) {
+            _inFlight.fetch_sub(1, std::memory_order_release);
+            return false;
+        }
+
+        size_t start = _next.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < _queues.size(); ++i) {
+            if (_queues[(start + i) % _queues.size()]->TryPush(std::move(request))) {
+                _queued.fetch_add(1, std::memory_order_seq_cst);
+                return true;
+            }
+        }
+
+        // unreachable while every queue holds maxInFlight requests
+        _inFlight.fetch_sub(1, std::memory_order_release);
+        return false;
+    }
+
+    void Wake(size_t count) {
+        if (_sleeping.load(std::memory_order_seq_cst) == 0) return;
+
+        std::lock_guard<std::mutex> lock(_m);
+        if (count == 1) {
+            _cv.notify_one();
+        } else {
+            _cv.notify_all();
+        }
+    }
+
+    /**
+     * @brief берет запрос из своей очереди, а если она пуста - из чужих
+     */
+    bool Take(size_t self, size_t& taken, Request& request) {
+        if (taken < _batch && _queues[self]->TryPop(request)) {
+            ++taken;
+            return true;
+        }
+
+        taken = 0;
+        for (size_t i = 1; i <= _queues.size(); ++i) {
+            if (_queues[(self + i) % _queues.size()]->TryPop(request)) return true;
+        }
+
+        return false;
+    }
+
+    void Run(size_t self) {
+        typename Wrapper::Scratch scratch;
+        Request request;
+        size_t taken = 0;
+
+        for (;;) {
+            if (Take(self, taken, request)) {
+                _queued.fetch_sub(1, std::memory_order_relaxed);
+                Complete(request, scratch);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(_m);
+            _sleeping.fetch_add(1, std::memory_order_seq_cst);
+
+            // a Submit that did not see this worker sleeping has already counted its request
+            _cv.wait(lock, [this]() { return _stop || _queued.load(std::memory_order_seq_cst) > 0; });
+            _sleeping.fetch_sub(1, std::memory_order_seq_cst);
+
+            if (_stop && _queued.load(std::memory_order_seq_cst) == 0) return;
+        }
+    }
+
+    void Complete(Request& request, typename Wrapper::Scratch& scratch) {
+        Completion completion;
+        completion.tag = request.tag;
+        _hw.Find(request.text, request.len, completion.matches, scratch, &completion.error);
+
+        if (request.callback) {
+            request.callback(completion);
+            request.callback = nullptr;
+            _inFlight.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+
+        // the queue holds maxInFlight completions, so there is always room
+        bool pushed = _completions.TryPush(std::move(completion));
+        assert(pushed);
+        (void) pushed;
+    }
+
+private:
+    const Wrapper& _hw;
+
+    const size_t _maxInFlight;
+    const size_t _batch;
+
+    std::vector<std::unique_ptr<BoundedQueue<Request>>> _queues;   //!< по очереди на рабочего
+    BoundedQueue<Completion> _completions;                          //!< завершения для Poll
+
+    std::atomic<size_t> _inFlight{0};   //!< принятые и не забранные запросы
+    std::atomic<size_t> _queued{0};     //!< запросы в очередях рабочих
+    std::atomic<size_t> _next{0};       //!< очередь для следующего Submit
+
+    std::mutex _m;                      //!< только для сна рабочих
+    std::condition_variable _cv;
+    std::atomic<size_t> _sleeping{0};
+    bool _stop = false;
+
+    std::vector<std::thread> _workers;
+};
+
+} // namespace Hyperscan
+
+#endif // ASYNCSCANNER_H
@@ -0,0 +1,109 @@
+#ifndef BUILDSCHEDULER_H
+#define BUILDSCHEDULER_H
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace Hyperscan {
+
+/**
+ * @brief склеивает серию запросов на сборку в одну сборку в фоновом потоке
+ *
+ *   Используется HyperscanWrapper::SetBuildDelay: каждое изменение паттернов вызывает Schedule, <br>
+ * а сборка запускается, когда изменений не было \a quiet, но не позже чем через \a maxDelay <br>
+ * после первого несобранного изменения. Сборка всегда берет последнее состояние, <br>
+ * поэтому 1000 изменений подряд стоят одной-двух компиляций, а не тысячи.
+ */
+class BuildScheduler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @param build функция сборки, вызывается из фонового потока
+     * @param quiet сколько должно пройти без изменений перед сборкой
+     * @param maxDelay максимальная задержка сборки после первого изменения, даже если изменения продолжаются
+     */
+    BuildScheduler(std::function<void()> build, std::chrono::milliseconds quiet, std::chrono::milliseconds maxDelay)
+        : _build(std::move(build))
+        , _quiet(quiet)
+        , _maxDelay(maxDelay)
+        , _thread([this]() { Run(); })
+    {}
+
+    /**
+     * @brief останавливает фоновый поток, запланированная, но не начатая сборка не выполняется
+     */
+    ~BuildScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(_m);
+            _stop = true;
+        }
+
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    /**
+     * @brief отмечает, что состояние поменялось и его нужно собрать
+     */
+    void Schedule() {
+        std::lock_guard<std::mutex> lock(_m);
+        Clock::time_point now = Clock::now();
+
+        if (!_dirty) {
+            _dirty = true;
+            _firstChange = now;
+        }
+
+        _lastChange = now;
+        _cv.notify_all();
+    }
+
+private:
+    void Run() {
+        std::unique_lock<std::mutex> lock(_m);
+
+        while (!_stop) {
+            if (!_dirty) {
+                _cv.wait(lock);
+                continue;
+            }
+
+            Clock::time_point deadline = std::min(_lastChange + _quiet, _firstChange + _maxDelay);
+            if (Clock::now() < deadline) {
+                _cv.wait_until(lock, deadline);
+                continue;
+            }
+
+            // changes made during the build schedule the next one
+            _dirty = false;
+            lock.unlock();
+            _build();
+            lock.lock();
+        }
+    }
+
+    BuildScheduler(const BuildScheduler&) = delete;
+    BuildScheduler& operator=(const BuildScheduler&) = delete;
+
+private:
+    std::function<void()> _build;
+    std::chrono::milliseconds _quiet;
+    std::chrono::milliseconds _maxDelay;
+
+    std::mutex _m;
+    std::condition_variable _cv;
+    bool _stop = false;
+    bool _dirty = false;
+    Clock::time_point _firstChange;
+    Clock::time_point _lastChange;
+
+    std::thread _thread;
+};
+
+} // namespace Hyperscan
+
+#endif // BUILDSCHEDULER_H
@@ -0,0 +1,121 @@
+#ifndef DATASTORE_H
+#define DATASTORE_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+
+namespace Hyperscan {
+
+/**
+ * @brief массив данных по номеру слота, разбитый на куски, которые копируются только при записи
+ *
+ *   Копия DataStore копирует только указатели на куски, поэтому снэпшот, который делает <br>
+ * HyperscanWrapper::Build, стоит O(Size / CHUNK_SIZE) и делит с предыдущим снэпшотом все куски, <br>
+ * в которые между сборками ничего не записали. Запись в кусок, который держит еще кто-то, <br>
+ * сначала копирует этот кусок (copy-on-write). <br> <br>
+ *
+ *   Чтение из разных потоков безопасно, запись и копирование одного объекта нужно защищать снаружи. <br>
+ * Копии разных объектов можно менять и читать одновременно: кусок меняется на месте, <br>
+ * только если его больше никто не держит.
+ *
+ * @tparam T тип данных
+ */
+template <typename T>
+class DataStore {
+public:
+    /**
+     * @brief кол-во элементов в куске, при записи копируется не больше
+     */
+    static const size_t CHUNK_SIZE = 1024;
+
+    size_t Size() const {
+        return _size;
+    }
+
+    const T& operator[](size_t i) const {
+        return (*_chunks[i / CHUNK_SIZE])[i % CHUNK_SIZE];
+    }
+
+    /**
+     * @brief добавляет элемент в конец
+     */
+    void PushBack(T value) {
+        if (_size % CHUNK_SIZE == 0) {
+            _chunks.push_back(NewChunk());
+        } else {
+            Unshare(_chunks.size() - 1);
+        }
+
+        _chunks.back()->push_back(std::move(value));
+        ++_size;
+    }
+
+    /**
+     * @brief заменяет элемент \a i, копирует его кусок, если тот общий с другим DataStore
+     */
+    void Set(size_t i, T value) {
+        Unshare(i / CHUNK_SIZE);
+        (*_chunks[i / CHUNK_SIZE])[i % CHUNK_SIZE] = std::move(value);
+    }
+
+    /**
+     * @brief копия, не делящая куски с этим объектом, например чтобы разместить данные на другом узле NUMA
+     */
+    DataStore Clone() const {
+        DataStore res;
+        res._size = _size;
+
+        for (const auto& chunk: _chunks) {
+            res._chunks.push_back(NewChunk());
+            res._chunks.back()->insert(res._chunks.back()->end(), chunk->begin(), chunk->end());
+        }
+
+        return res;
+    }
+
+    /**
+     * @brief вызывает \a f(const T * data, size_t count) для каждого куска по порядку
+     */
+    template <typename F>
+    void ForEachChunk(F f) const {
+        for (const auto& chunk: _chunks) {
+            f(chunk->data(), chunk->size());
+        }
+    }
+
+private:
+    typedef std::vector<T> Chunk;
+
+    static std::shared_ptr<Chunk> NewChunk() {
+        std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+        chunk->reserve(CHUNK_SIZE);
+        return chunk;
+    }
+
+    void Unshare(size_t c) {
+        // nobody else can start sharing the chunk meanwhile: copies are made under the same external lock
+        if (_chunks[c].use_count() == 1) {
+            // use_count is a relaxed load: the fence orders the reads of a snapshot that just dropped the chunk
+            // (its reference was released with acq_rel) before the writes that follow
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return;
+        }
+
+        std::shared_ptr<Chunk> chunk = NewChunk();
+        chunk->insert(chunk->end(), _chunks[c]->begin(), _chunks[c]->end());
+        _chunks[c] = std::move(chunk);
+    }
+
+private:
+    std::vector<std::shared_ptr<Chunk>> _chunks;
+    size_t _size = 0;
+};
+
+template <typename T>
+const size_t DataStore<T>::CHUNK_SIZE;
+
+} // namespace Hyperscan
+
+#endif // DATASTORE_H
@@ -0,0 +1,355 @@
+#ifndef FLOWTABLE_H
+#define FLOWTABLE_H
+
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#include <cassert>
+
+#include <Hyperscan.h>
+
+namespace Hyperscan {
+
+/**
+ * @brief таблица потоков HyperscanWrapper::Stream по айдишнику соединения (flow id)
+ *
+ *   Хеш-таблица с открытой адресацией (линейное пробирование, удаление сдвигом без надгробий) <br>
+ * хранит номера записей, а сами записи с потоками выделены один раз на \a capacity потоков. <br>
+ * Записи связаны в два LRU списка: активные и сжатые. Expire закрывает потоки, простаивающие <br>
+ * дольше \a flowTimeout, и сжимает активные, простаивающие дольше HyperscanWrapper::SetStreamIdleTimeout. <br>
+ * Когда таблица заполнена, новый поток вытесняет самый давний и забирает его hs_stream_t через <br>
+ * Stream::Reset, если тот открыт на текущем снэпшоте, так что в установившемся режиме память на поток не выделяется. <br>
+ * Совпадения в конце закрытого или вытесненного потока получает \a onFlush. <br> <br>
+ *
+ *   Таблица без блокировок и принадлежит одному потоку исполнения, у нее свой Scratch. <br>
+ * Для нескольких рабочих потоков у каждого своя таблица, а соединение отправляется в таблицу Worker(flowId, workers).
+ *
+ * @remark не thread-safe
+ * @tparam DataT тип данных паттернов HyperscanWrapper
+ * @tparam SyncPolicy политика синхронизации HyperscanWrapper
+ */
+template <typename DataT, typename SyncPolicy = MutexSync>
+class FlowTable {
+public:
+    typedef HyperscanWrapper<DataT, SyncPolicy> Wrapper;
+    typedef typename Wrapper::Stream Stream;
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @brief получает айдишник потока и совпадения в конце потока при его закрытии или вытеснении
+     */
+    typedef std::function<void(uint64_t flowId, const std::vector<DataT>& matches)> FlushHandler;
+
+    /**
+     * @param hw[in] паттерны, должен жить дольше таблицы
+     * @param capacity[in] максимальное кол-во потоков, при переполнении вытесняется самый давний
+     * @param flowTimeout[in] Expire закрывает потоки, простаивающие дольше, 0 - только вытеснение
+     * @param onFlush[in] может быть пустым
+     */
+    FlowTable(const Wrapper& hw, size_t capacity, std::chrono::milliseconds flowTimeout = std::chrono::milliseconds(0),
+              FlushHandler onFlush = nullptr)
+        : _hw(hw)
+        , _entries(capacity)
+        , _slots(SlotCount(capacity), NIL)
+        , _flowTimeout(flowTimeout)
+        , _onFlush(std::move(onFlush))
+    {
+        assert(capacity > 0 && capacity < NIL);
+
+        _free.reserve(capacity);
+        for (size_t i = capacity; i > 0; --i) {
+            _free.push_back(i - 1);
+        }
+    }
+
+    FlowTable(const FlowTable&) = delete;
+    FlowTable& operator=(const FlowTable&) = delete;
+
+    /**
+     * @brief номер рабочего потока из \a workers, таблица которого владеет соединением \a flowId
+     */
+    static size_t Worker(uint64_t flowId, size_t workers) {
+        // the high half, the table itself uses the low bits of the same hash
+        return (Hash(flowId) >> 32) % workers;
+    }
+
+    /**
+     * @brief сканирует очередной кусок соединения \a flowId, открывая для него поток, если его еще нет
+     * @param[in] flowId айдишник соединения
+     * @param[in] chunk указатель на начало куска
+     * @param[in] len длина куска
+     * @param[out] res сюда добавляются данные паттернов, сматчившихся в этом куске
+     * @param[out] error может быть записано ErrorCode::SCAN_ERROR, ErrorCode::BUILD_ERROR или ErrorCode::NO_MEMORY
+     * @return false в случае ошибки
+     */
+    bool ScanFlow(uint64_t flowId, const char * chunk, size_t len, std::vector<DataT>& res, Error * error = nullptr) {
+        uint32_t idx = Find(flowId);
+
+        if (idx == NIL) {
+            idx = Acquire(flowId, error);
+            if (idx == NIL) return false;
+        } else {
+            Unlink(idx);
+        }
+
+        PushFront(_active, idx);
+        return _entries[idx].stream.Scan(chunk, len, res, _scratch, error);
+    }
+
+    /**
+     * @brief закрывает поток соединения \a flowId, добавляя в \a res совпадения в конце потока, onFlush не вызывается
+     * @param[out] error может быть записано ErrorCode::SCAN_ERROR или ErrorCode::NO_MEMORY
+     * @return false если такого потока нет или при закрытии произошла ошибка
+     */
+    bool CloseFlow(uint64_t flowId, std::vector<DataT>& res, Error * error = nullptr) {
+        if (error) *error = Error();
+
+        uint32_t idx = Find(flowId);
+        if (idx == NIL) return false;
+
+        Unlink(idx);
+        EraseSlot(flowId);
+        _free.push_back(idx);
+
+        return _entries[idx].stream.Close(res, _scratch, error);
+    }
+
+    /**
+     * @brief закрывает потоки, простаивающие дольше \a flowTimeout, и сжимает простаивающие дольше
+     *        HyperscanWrapper::SetStreamIdleTimeout
+     *
+     *   Списки идут от самых давних, поэтому обходятся только потоки, которые закрываются или сжимаются.
+     *
+     * @param[in] now текущее время
+     * @return кол-во закрытых потоков
+     */
+    size_t Expire(Clock::time_point now = Clock::now()) {
+        size_t closed = 0;
+
+        if (_flowTimeout.count() > 0) {
+            for (List * list: {&_idle, &_active}) {
+                while (list->tail != NIL && now - _entries[list->tail].stream.LastActive() >= _flowTimeout) {
+                    Evict(list->tail, false);
+                    ++closed;
+                }
+            }
+        }
+
+        while (_active.tail != NIL) {
+            uint32_t idx = _active.tail;
+            if (!_entries[idx].stream.CompressIfIdle(now)) break;
+
+            Unlink(idx);
+            PushFront(_idle, idx);
+            _entries[idx].idle = true;
+        }
+
+        return closed;
+    }
+
+    /**
+     * @brief закрывает все потоки, сообщая их совпадения в конце потока в onFlush
+     */
+    void FlushAll() {
+        while (_idle.tail != NIL) Evict(_idle.tail, false);
+        while (_active.tail != NIL) Evict(_active.tail, false);
+    }
+
+    /**
+     * @brief кол-во открытых потоков
+     */
+    size_t Size() const {
+        return _entries.size() - _free.size();
+    }
+
+    /**
+     * @brief максимальное кол-во потоков
+     */
+    size_t Capacity() const {
+        return _entries.size();
+    }
+
+    /**
+     * @brief есть ли поток соединения \a flowId
+     */
+    bool Contains(uint64_t flowId) const {
+        return Find(flowId) != NIL;
+    }
+
+private:
+    static const uint32_t NIL = 0xffffffff;
+
+    struct Entry {
+        uint64_t flowId = 0;
+        Stream stream;
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+        bool idle = false;      //!< в списке сжатых
+    };
+
+    /**
+     * @brief двусвязный список записей, head - самая свежая
+     */
+    struct List {
+        uint32_t head = NIL;
+        uint32_t tail = NIL;
+    };
+
+    static size_t SlotCount(size_t capacity) {
+        // at most half full, so that probe sequences stay short
+        size_t res = 16;
+        while (res < capacity * 2) res *= 2;
+        return res;
+    }
+
+    /**
+     * @brief финализатор splitmix64, айдишники соединений часто идут подряд
+     */
+    static uint64_t Hash(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    uint32_t Find(uint64_t flowId) const {
+        size_t mask = _slots.size() - 1;
+
+        for (size_t i = Hash(flowId) & mask; _slots[i] != NIL; i = (i + 1) & mask) {
+            if (_entries[_slots[i]].flowId == flowId) return _slots[i];
+        }
+
+        return NIL;
+    }
+
+    void InsertSlot(uint64_t flowId, uint32_t idx) {
+        size_t mask = _slots.size() - 1;
+
+        size_t i = Hash(flowId) & mask;
+        while (_slots[i] != NIL) i = (i + 1) & mask;
+
+        _slots[i] = idx;
+    }
+
+    void EraseSlot(uint64_t flowId) {
+        size_t mask = _slots.size() - 1;
+
+        size_t i = Hash(flowId) & mask;
+        while (_entries[_slots[i]].flowId != flowId) i = (i + 1) & mask;
+
+        // backward shift: every following entry of the run that may live closer to its home slot moves into the hole
+        for (size_t j = (i + 1) & mask; _slots[j] != NIL; j = (j + 1) & mask) {
+            size_t home = Hash(_entries[_slots[j]].flowId) & mask;
+
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                _slots[i] = _slots[j];
+                i = j;
+            }
+        }
+
+        _slots[i] = NIL;
+    }
+
+    void PushFront(List& list, uint32_t idx) {
+        Entry& e = _entries[idx];
+        e.prev = NIL;
+        e.next = list.head;
+        e.idle = false;
+
+        if (list.head != NIL) _entries[list.head].prev = idx;
+        list.head = idx;
+        if (list.tail == NIL) list.tail = idx;
+    }
+
+    void Unlink(uint32_t idx) {
+        Entry& e = _entries[idx];
+        List& list = e.idle ? _idle : _active;
+
+        if (e.prev != NIL) _entries[e.prev].next = e.next;
+        else list.head = e.next;
+
+        if (e.next != NIL) _entries[e.next].prev = e.prev;
+        else list.tail = e.prev;
+
+        e.prev = e.next = NIL;
+    }
+
+    /**
+     * @brief убирает поток записи \a idx из таблицы, сообщая его совпадения в конце потока в onFlush
+     * @param recycle оставить поток открытым для следующего соединения, если он открыт на текущем снэпшоте
+     */
+    void Evict(uint32_t idx, bool recycle) {
+        Entry& e = _entries[idx];
+
+        Unlink(idx);
+        EraseSlot(e.flowId);
+
+        _flushed.clear();
+        if (recycle && !_hw.IsStale(e.stream)) {
+            e.stream.Reset(_flushed, _scratch);
+        } else {
+            e.stream.Close(_flushed, _scratch);
+        }
+
+        if (_onFlush) _onFlush(e.flowId, _flushed);
+
+        if (!recycle) _free.push_back(idx);
+    }
+
+    /**
+     * @brief запись под новое соединение: свободная или вытесненная у самого давнего соединения
+     */
+    uint32_t Acquire(uint64_t flowId, Error * error) {
+        uint32_t idx;
+
+        if (!_free.empty()) {
+            idx = _free.back();
+            _free.pop_back();
+        } else {
+            idx = _idle.tail != NIL ? _idle.tail : _active.tail;
+            Evict(idx, true);
+        }
+
+        Entry& e = _entries[idx];
+
+        if (!e.stream.IsOpen()) {
+            e.stream = _hw.OpenStream(error);
+
+            if (!e.stream.IsOpen()) {
+                _free.push_back(idx);
+                return NIL;
+            }
+        }
+
+        e.flowId = flowId;
+        InsertSlot(flowId, idx);
+
+        return idx;
+    }
+
+private:
+    const Wrapper& _hw;
+
+    std::vector<Entry> _entries;    //!< все записи, выделены сразу
+    std::vector<uint32_t> _free;    //!< свободные записи
+    std::vector<uint32_t> _slots;   //!< хеш-таблица: номер записи или NIL, размер - степень двойки
+
+    List _active;
+    List _idle;                     //!< сжатые потоки
+
+    std::chrono::milliseconds _flowTimeout;
+    FlushHandler _onFlush;
+
+    typename Wrapper::Scratch _scratch;
+    std::vector<DataT> _flushed;    //!< переиспользуемый ответ для onFlush
+};
+
+template <typename DataT, typename SyncPolicy>
+const uint32_t FlowTable<DataT, SyncPolicy>::NIL;
+
+} // namespace Hyperscan
+
+#endif // FLOWTABLE_H
@@ -0,0 +1,231 @@
+#ifndef HUGEPAGEALLOCATOR_H
+#define HUGEPAGEALLOCATOR_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+
+#include <sys/mman.h>
+
+#include <hs.h>
+
+namespace Hyperscan {
+
+/**
+ * @brief аллокаторы памяти для баз данных и scratch библиотеки \a %Hyperscan
+ *
+ *   Большие базы данных (от \a largeThreshold байт) размещаются в отдельных отображениях, <br>
+ * выровненных по huge page: прозрачные huge pages (MADV_HUGEPAGE) или явные (MAP_HUGETLB, <br>
+ * если в системе не хватает зарезервированных huge pages, то откатываемся на прозрачные). <br>
+ * Все страницы трогаются сразу при выделении, поэтому первые сканирования после Build <br>
+ * не платят за page faults и промахи TLB. Маленькие базы данных выделяются через malloc. <br> <br>
+ *
+ *   Память под scratch (HyperscanWrapper::Find клонирует scratch на каждый вызов) переиспользуется <br>
+ * через небольшой кэш освобожденных блоков в каждом потоке.
+ *
+ * @remark Install меняет аллокаторы всего процесса, поэтому его нужно вызывать один раз при старте,
+ *         до создания первой базы данных или scratch.
+ */
+class HugePageAllocator {
+public:
+    /**
+     * @brief какие huge pages использовать для больших баз данных
+     */
+    enum Mode {
+        TRANSPARENT_HUGE_PAGES,  //!< madvise(MADV_HUGEPAGE), работает без настройки системы
+        EXPLICIT_HUGE_PAGES      //!< MAP_HUGETLB, требует зарезервированных vm.nr_hugepages
+    };
+
+    /**
+     * @brief счетчики для проверки, что аллокатор работает
+     */
+    struct Stats {
+        size_t largeDatabases;   //!< кол-во баз данных, выделенных отдельными отображениями
+        size_t scratchAllocs;    //!< кол-во выделений scratch
+        size_t scratchReused;    //!< из них взято из кэша потока
+    };
+
+    /**
+     * @brief устанавливает аллокаторы через hs_set_database_allocator и hs_set_scratch_allocator
+     * @param mode какие huge pages использовать
+     * @param largeThreshold начиная с какого размера база данных считается большой
+     * @return true в случае успеха
+     */
+    static bool Install(Mode mode = TRANSPARENT_HUGE_PAGES, size_t largeThreshold = size_t(1) << 20) {
+        State& state = GetState();
+        state.mode = mode;
+        state.largeThreshold = largeThreshold;
+
+        return hs_set_database_allocator(AllocateDatabase, FreeDatabase) == HS_SUCCESS &&
+               hs_set_scratch_allocator(AllocateScratch, FreeScratch) == HS_SUCCESS;
+    }
+
+    static Stats GetStats() {
+        State& state = GetState();
+        return Stats{state.largeDatabases.load(), state.scratchAllocs.load(), state.scratchReused.load()};
+    }
+
+    /**
+     * @brief читает по байту с каждой страницы, чтобы память была отображена до первого сканирования
+     */
+    static void Prefault(const void * ptr, size_t size) {
+        const volatile char * bytes = reinterpret_cast<const volatile char *>(ptr);
+        char sink = 0;
+
+        for (size_t i = 0; i < size; i += SMALL_PAGE_SIZE) {
+            sink ^= bytes[i];
+        }
+
+        (void) sink;
+    }
+
+private:
+    static const size_t SMALL_PAGE_SIZE = 4096;
+    static const size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+    /**
+     * @brief scratch выравнивается на 64 байта, перед ним лежит заголовок с размером
+     */
+    static const size_t SCRATCH_HEADER = 64;
+
+    /**
+     * @brief сколько освобожденных scratch хранит каждый поток
+     */
+    static const size_t SCRATCH_CACHE_SIZE = 4;
+
+    struct State {
+        Mode mode = TRANSPARENT_HUGE_PAGES;
+        size_t largeThreshold = size_t(1) << 20;
+
+        std::mutex m;
+        std::map<void *, size_t> mappings;  //!< большие базы данных -> длина отображения
+
+        std::atomic<size_t> largeDatabases{0};
+        std::atomic<size_t> scratchAllocs{0};
+        std::atomic<size_t> scratchReused{0};
+    };
+
+    struct ScratchCache {
+        std::vector<std::pair<size_t, char *>> blocks;
+
+        ~ScratchCache() {
+            for (auto& b: blocks) {
+                free(b.second - SCRATCH_HEADER);
+            }
+        }
+    };
+
+    static State& GetState() {
+        static State state;
+        return state;
+    }
+
+    static ScratchCache& GetScratchCache() {
+        static thread_local ScratchCache cache;
+        return cache;
+    }
+
+    static void * AllocateDatabase(size_t size) {
+        State& state = GetState();
+        if (size < state.largeThreshold) return malloc(size);
+
+        size_t length = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        char * ptr = nullptr;
+
+        if (state.mode == EXPLICIT_HUGE_PAGES) {
+            void * p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+            if (p != MAP_FAILED) ptr = (char *) p;
+        }
+
+        if (!ptr) {
+            // over-map by one huge page to be able to align the start to a huge page boundary
+            void * p = mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) return nullptr;
+
+            char * raw = (char *) p;
+            ptr = (char *) (((uintptr_t) raw + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+
+            if (ptr != raw) munmap(raw, ptr - raw);
+            munmap(ptr + length, raw + HUGE_PAGE_SIZE - ptr);
+
+            madvise(ptr, length, MADV_HUGEPAGE);
+
+            // fault every page in now instead of during the first scans
+            for (size_t i = 0; i < length; i += SMALL_PAGE_SIZE) {
+                ptr[i] = 0;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(state.m);
+        state.mappings[ptr] = length;
+        ++state.largeDatabases;
+
+        return ptr;
+    }
+
+    static void FreeDatabase(void * ptr) {
+        if (!ptr) return;
+
+        State& state = GetState();
+        size_t length = 0;
+        {
+            std::lock_guard<std::mutex> lock(state.m);
+            auto it = state.mappings.find(ptr);
+
+            if (it != state.mappings.end()) {
+                length = it->second;
+                state.mappings.erase(it);
+            }
+        }
+
+        if (length) {
+            munmap(ptr, length);
+        } else {
+            free(ptr);
+        }
+    }
+
+    static void * AllocateScratch(size_t size) {
+        State& state = GetState();
+        ScratchCache& cache = GetScratchCache();
+        ++state.scratchAllocs;
+
+        for (size_t i = 0; i < cache.blocks.size(); ++i) {
+            if (cache.blocks[i].first == size) {
+                char * ptr = cache.blocks[i].second;
+                cache.blocks[i] = cache.blocks.back();
+                cache.blocks.pop_back();
+
+                ++state.scratchReused;
+                return ptr;
+            }
+        }
+
+        void * raw = nullptr;
+        if (posix_memalign(&raw, SCRATCH_HEADER, size + SCRATCH_HEADER) != 0) return nullptr;
+
+        *reinterpret_cast<size_t *>(raw) = size;
+        return (char *) raw + SCRATCH_HEADER;
+    }
+
+    static void FreeScratch(void * ptr) {
+        if (!ptr) return;
+
+        char * raw = (char *) ptr - SCRATCH_HEADER;
+        ScratchCache& cache = GetScratchCache();
+
+        if (cache.blocks.size() < SCRATCH_CACHE_SIZE) {
+            cache.blocks.emplace_back(*reinterpret_cast<size_t *>(raw), (char *) ptr);
+        } else {
+            free(raw);
+        }
+    }
+};
+
+} // namespace Hyperscan
+
+#endif // HUGEPAGEALLOCATOR_H
@@ -6,13 +6,45 @@
 #include <vector>
 #include <memory>
 #include <queue>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
 #include <cstring>
 #include <cassert>
 #include <algorithm>
+#include <numeric>
+#include <limits>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <type_traits>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <hs.h>
+#ifdef HYPERSCAN_CHIMERA
+#include <ch.h>
+#endif
+
+#include <SharedMemory.h>
+#include <Numa.h>
+#include <HugePageAllocator.h>
+#include <BuildScheduler.h>
+#include <PatternMask.h>
+#include <DataStore.h>
+#include <SyncPolicy.h>
+#include <StreamBufferPool.h>
+#include <StringView.h>
+#include <Normalizer.h>
 
 /**
  * @defgroup Hyperscan
@@ -21,10 +53,19 @@
  *   Класс Hyperscan::HyperscanWrapper реализовывает основную функциональность. <br>
  * Поддерживает большую часть синтаксиса PCRE.
  *
- * @see @link Hyperscan::HyperscanWrapper::Insert(const char *, size_t, const DataT&, Error *) Insert @endlink
+ * @see @link Hyperscan::HyperscanWrapper::Insert(const char *, size_t, DataT, Error *) Insert @endlink
  * @see @link Hyperscan::HyperscanWrapper::Delete(const char *, size_t, const DataT&, Error *) Delete @endlink
  * @see @link Hyperscan::HyperscanWrapper::Build Build @endlink
+ * @see @link Hyperscan::HyperscanWrapper::Revoke(const char *, size_t, const DataT&, Error *) Revoke @endlink
+ * @see @link Hyperscan::HyperscanWrapper::SetShardCount SetShardCount @endlink - шарды и кэш скомпилированных баз данных
  * @see @link Hyperscan::HyperscanWrapper::Find(const char *, size_t, Error *) const Find @endlink
+ * @see @link Hyperscan::HyperscanWrapper::Find(const char *, size_t, const std::vector<std::string> &, Error *) const Find @endlink - поиск по группам паттернов
+ * @see @link Hyperscan::HyperscanWrapper::Find(const char *, size_t, const PatternMask &, Error *) const Find @endlink - поиск по маске включенных паттернов
+ * @see @link Hyperscan::HyperscanWrapper::FindIds(const char *, size_t, MatchSet &, Error *) const FindIds @endlink - айдишники совпадений без копирования данных
+ * @see @link Hyperscan::HyperscanWrapper::FindInFile FindInFile @endlink
+ * @see @link Hyperscan::HyperscanWrapper::Publish Publish @endlink
+ * @see @link Hyperscan::HyperscanWrapper::Attach Attach @endlink
+ * @see Hyperscan::HugePageAllocator - huge pages для больших баз данных
  *
  * @file Hyperscan.h
  * @author Nemchenko Eugene
@@ -39,6 +80,9 @@
 //! Содержит классы для работы с библиотекой %Hyperscan и обработки ошибок
 namespace Hyperscan {
 
+template <typename DataT, typename SyncPolicy = MutexSync>
+class HyperscanWrapper;
+
 /**
  * @brief enum обозначающий код ошибки
  */
@@ -54,7 +98,9 @@ enum ErrorCode : int {
     BUILD_ERROR,                //!< В HyperscanWrapper::Build, (не корректная регулярка, нет памяти и т.п.)
 
     SCAN_ERROR,                 //!< в HyperscanWrapper::Find, не знаю примера, чтобы данная ошибка произошла
-    NO_MEMORY                   //!< в HyperscanWrapper::Find, HyperscanWrapper::Build, память закончилась
+    NO_MEMORY,                  //!< в HyperscanWrapper::Find, HyperscanWrapper::Build, память закончилась
+    FILE_ERROR,                 //!< в HyperscanWrapper::FindInFile, файл не удалось открыть или отобразить в память
+    SHARED_MEMORY_ERROR         //!< в HyperscanWrapper::Publish, HyperscanWrapper::Attach, сегмент не удалось создать или отобразить
 };
 
 
@@ -91,6 +137,10 @@ struct Error {
                 return "Unable to scan input buffer";
             case ErrorCode::NO_MEMORY:
                 return "not enough memory";
+            case ErrorCode::FILE_ERROR:
+                return "unable to open or map file";
+            case ErrorCode::SHARED_MEMORY_ERROR:
+                return "unable to create or map shared memory segment";
             default:
                 return _message;
         }
@@ -113,6 +163,11 @@ private:
         , _pattern(pattern)
     {}
 
+    Error(ErrorCode code, StringView pattern)
+        : _code(code)
+        , _pattern(pattern.data(), pattern.size())
+    {}
+
     Error(ErrorCode code, char const * pattern, char const * message)
         : _code(code)
         , _pattern(pattern)
@@ -125,361 +180,3929 @@ private:
     std::string _message;
 
 private:
-    template<typename DataT>
+    template<typename DataT, typename SyncPolicy>
     friend class HyperscanWrapper;
 };
 
+/**
+ * @brief выражение для компилятора: \a %Hyperscan и Chimera читают паттерн до завершающего нуля,
+ *        поэтому нулевые байты бинарного паттерна передаются как \\x00
+ * @param buffer[out] сюда записывается паттерн с замененными нулями, если они в нем есть
+ * @return указатель на выражение, живет, пока живут \a pattern и \a buffer
+ */
+inline const char * Expression(const std::string& pattern, std::string& buffer) {
+    if (pattern.find('\0') == std::string::npos) return pattern.c_str();
+
+    buffer.clear();
+    for (char c: pattern) {
+        if (c) {
+            buffer.push_back(c);
+        } else {
+            buffer.append("\\x00");
+        }
+    }
+
+    return buffer.c_str();
+}
+
 /**
  * @brief обертка над библиотекой \a %Hyperscan
  * @tparam DataT - тип данных которые будут возвращены если соответствующий паттерн сматчился
+ * @tparam SyncPolicy - как Find получает снэпшот, который подменяет Build: NoSync, MutexSync или RcuSync,
+ *         см. SyncPolicy.h
  */
-template <typename DataT>
+template <typename DataT, typename SyncPolicy>
 class HyperscanWrapper {
+public:
+    /**
+     * @brief совпадение паттерна в тексте, возвращается из HyperscanWrapper::FindMatches
+     */
+    struct Match {
+        DataT data;              //!< данные соответствующие сматчившемуся паттерну
+        unsigned long long to;   //!< смещение конца совпадения от начала текста
+    };
+
+    /**
+     * @brief паттерн, который не компилируется, возвращается из HyperscanWrapper::Validate и HyperscanWrapper::SkippedPatterns
+     */
+    struct InvalidPattern {
+        size_t id;               //!< айдишник паттерна, см. HyperscanWrapper::PatternId
+        std::string group;       //!< группа паттерна
+        std::string pattern;     //!< сам паттерн
+        DataT data;              //!< данные паттерна
+        std::string message;     //!< сообщение об ошибке от \a %Hyperscan
+    };
+
+    /**
+     * @brief ограничения одного поиска, см. HyperscanWrapper::Find(const char *, size_t, const FindOptions &, Error *) const
+     */
+    struct FindOptions {
+        size_t maxMatches = 0;      //!< поиск останавливается, набрав столько совпадений, 0 - без ограничения
+
+        /**
+         * @brief поиск останавливается после этого момента, по умолчанию без ограничения
+         */
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+        /**
+         * @brief с deadline текст длиннее сканируется потоковыми базами кусками такой длины,
+         *        и deadline проверяется между кусками. Только если потоковые базы уже готовы, см. SetStreaming
+         */
+        size_t sliceLength = size_t(1) << 20;
+    };
+
+    /**
+     * @brief ответ Find с ограничениями
+     */
+    struct FindResult {
+        std::vector<DataT> matches;     //!< данные сматчившихся паттернов, как у Find
+        bool truncated = false;         //!< поиск остановлен до конца текста, matches неполный
+        bool deadlineExceeded = false;  //!< остановлен по deadline, иначе по maxMatches
+
+        bool Complete() const {
+            return !truncated;
+        }
+    };
+
+    class MatchHistogram;
+
 private:
     struct Context {
         std::vector<DataT> * res;
-        const std::vector<DataT> * data;
+        const DataStore<DataT> * data;
+        const std::atomic<uint64_t> * dead;
+    };
+
+    struct MatchContext {
+        std::vector<Match> * res;
+        const DataStore<DataT> * data;
+        const std::atomic<uint64_t> * dead;
     };
 
     /**
-     * @brief RAII класс над скомпилированной базой данных и scratch (изменяемая память выделямая для поиска в тексте)
+     * @brief копия добавленных паттернов, которую компилирует Build
      */
-    class DatabaseWrapper {
-    public:
+    struct Staged {
+        std::vector<std::string> patterns;      //!< паттерны по номеру слота
+        std::vector<bool> live;                 //!< занят ли слот
+        std::vector<size_t> group;              //!< номер группы по номеру слота
+        std::vector<std::string> groupNames;    //!< имена групп по номеру
+        std::unordered_map<size_t, std::string> invalid;  //!< пропущенные слоты с ошибкой, см. SetSkipInvalidPatterns
+#ifdef HYPERSCAN_CHIMERA
+        std::vector<size_t> fallback;           //!< слоты паттернов, которые компилируются Chimera, у них live = false
+#endif
+    };
+
+    struct MatchSetContext {
+        PatternMask * res;
+        const std::atomic<uint64_t> * dead;
+    };
+
+    struct BoundedContext {
+        FindResult * res;
+        const DataStore<DataT> * data;
+        const std::atomic<uint64_t> * dead;
+        const FindOptions * options;
+        size_t events;          //!< вызовы callback, часы смотрятся раз в DEADLINE_CHECK_PERIOD вызовов
+
         /**
-         * @brief создает базу данных и сохраняет соответствующие данные, как бы снэпшот на текущий Build
-         *
-         *   В базу данных добавляются паттерны по порядку, с айдишниками соответсвенно 0, 1, 2 ... <br>
-         * когда hs_scan вернет мне айдишник я смогу понять какие данные ему соответствуют <br>
-         * данные нужно копировать т.к. они изменяются в другом потоке могут удаляться и добавляться <br>
-         * HyperscanWrapper::Find захватывает указатель на DatabaseWrapper с ним нужно сохранить и данные <br>
-         * поэтому я их и сохраняю в этом классе.
-         *
-         * @param patterns[in] паттерны добавленный пользователем
-         * @param data[in] данные соответствующие паттернам
-         * @param error[out] указатель на класс ошибки, заполняемый в случае неудачи
+         * @brief прошел ли deadline, если да - помечает ответ обрезанным
          */
-        DatabaseWrapper(const std::vector<char *>& patterns, const std::vector<DataT>& data, Error * error = nullptr)
-            : data(data)
-        {
-            assert(!patterns.empty());
+        bool Expired() {
+            if (options->deadline == std::chrono::steady_clock::time_point::max()) return false;
+            if (std::chrono::steady_clock::now() < options->deadline) return false;
 
-            // flags is a vector = {HS_FLAG_SINGLEMATCH, HS_FLAG_SINGLEMATCH, ...} n times
-            // ids = 1..n
-            // n = max of _patterns.size() from all instances of Hyperscan
-            static std::vector<unsigned> flags;
-            static std::vector<unsigned> ids;
+            res->truncated = true;
+            res->deadlineExceeded = true;
+            return true;
+        }
+    };
 
-            // if we inserted new patterns to `_paterrns` from previous Init call
-            if (patterns.size() > flags.size()) {
-                int prev_sz = flags.size();
+    struct HistogramContext {
+        MatchHistogram * res;
+        const std::atomic<uint64_t> * dead;
+        size_t len;             //!< длина текста, прибавляется к bytes сматчившихся паттернов
+    };
 
-                flags.resize(patterns.size());
-                ids.resize(patterns.size());
+    struct MaskContext {
+        std::vector<DataT> * res;
+        const DataStore<DataT> * data;
+        const std::atomic<uint64_t> * dead;
+        const PatternMask * enabled;
+        size_t remaining;   //!< сколько включенных паттернов еще не сматчилось
+        PatternMask seen;   //!< уже сматчившиеся, паттерн Chimera сообщает по совпадению на каждое окно текста
+    };
 
-                std::fill_n(flags.begin() + prev_sz, flags.size() - prev_sz, HS_FLAG_SINGLEMATCH);
-                std::iota(ids.begin() + prev_sz, ids.end(), prev_sz);
-            }
+    struct GroupContext {
+        std::vector<std::vector<DataT> *> * res;  //!< ответ по номеру группы, nullptr для не запрошенных групп
+        const DataStore<DataT> * data;
+        const std::atomic<uint64_t> * dead;
+        const std::vector<size_t> * groupOf;
+    };
 
-            static const unsigned int mode = HS_MODE_BLOCK;
+    /**
+     * @brief общее для HyperscanWrapper и его потоков: пул сжатых состояний, счетчики памяти и настройки
+     */
+    struct StreamShared {
+        StreamBufferPool pool;
 
-            hs_compile_error_t * compileErr;
-            hs_error_t err = hs_compile_multi(patterns.data(), flags.data(), ids.data(),
-                                              patterns.size(), mode, nullptr, &db, &compileErr);
+        std::atomic<size_t> liveStreams{0};
+        std::atomic<size_t> liveBytes{0};
+        std::atomic<size_t> compressedStreams{0};
+        std::atomic<size_t> compressedBytes{0};
 
-            if (err != HS_SUCCESS) {
-                if (error) {
-                    *error = compileErr->expression < 0
-                             ? Error(ErrorCode::BUILD_ERROR, compileErr->message, "")
-                             : Error(ErrorCode::BUILD_ERROR, compileErr->message, patterns[compileErr->expression]);
-                }
+        std::atomic<long long> idleTimeoutMs{0};    //!< см. HyperscanWrapper::SetStreamIdleTimeout
+    };
 
+    /**
+     * @brief RAII класс над шардом - частью паттернов, скомпилированной в отдельную базу данных
+     *
+     *   Айдишник паттерна в базе данных - номер его слота в HyperscanWrapper, он не меняется при удалении <br>
+     * и добавлении других паттернов. Поэтому шард, в котором ничего не поменялось, между Build остается <br>
+     * тем же самым и берется из кэша по хешу содержимого, см. HyperscanWrapper::BuildShards. <br>
+     * Все паттерны шарда из одной группы. Шард неизменяем после создания и разделяется между снэпшотами.
+     */
+    class Shard {
+    public:
+        /**
+         * @brief компилирует блочную базу данных из \a patterns с айдишниками \a ids
+         * @param group[in] группа паттернов, см. HyperscanWrapper::Insert(const std::string &, const char *, size_t, DataT, Error *)
+         * @param patterns[in] паттерны шарда
+         * @param ids[in] айдишники (номера слотов) соответствующие паттернам
+         * @param hash[in] хеш содержимого, см. HyperscanWrapper::ShardHash
+         * @param error[out] указатель на класс ошибки, заполняемый в случае неудачи
+         */
+        Shard(std::string group, std::vector<std::string> patterns, std::vector<unsigned> ids, uint64_t hash, Error * error = nullptr)
+            : group(std::move(group))
+            , patterns(std::move(patterns))
+            , ids(std::move(ids))
+            , hash(hash)
+        {
+            assert(!this->patterns.empty());
 
-                // As the compileErr pointer points to dynamically allocated memory, if
-                // we get an error, we must be sure to release it. This is not
-                // necessary when no error is detected.
-                hs_free_compile_error(compileErr);
+            int failed = -1;
+            if (!Compile(HS_MODE_BLOCK, &db, error, &failed) && failed >= 0) {
+                failedId = this->ids[failed];
+            }
+        }
+
+        /**
+         * @brief создает шард из сериализованной базы данных, используется для кэша на диске и реплик на узлах NUMA
+         *
+         *   Вся память выделяется и заполняется в вызывающем потоке, <br>
+         * поэтому при политике first-touch оказывается на узле этого потока.
+         *
+         * @param bytes[in] результат hs_serialize_database
+         * @param length[in] длина \a bytes
+         */
+        Shard(std::string group, std::vector<std::string> patterns, std::vector<unsigned> ids, uint64_t hash,
+              const char * bytes, size_t length, Error * error = nullptr)
+            : group(std::move(group))
+            , patterns(std::move(patterns))
+            , ids(std::move(ids))
+            , hash(hash)
+        {
+            if (hs_deserialize_database(bytes, length, &db) != HS_SUCCESS) {
+                if (error) *error = Error(ErrorCode::NO_MEMORY);
                 db = nullptr;
             }
+        }
 
-            if (db) {
-                if (hs_alloc_scratch(db, &scratch) != HS_SUCCESS) {
-                    if (error) {
-                        assert(err == HS_NOMEM);
-                        *error = Error(ErrorCode::NO_MEMORY);
-                    }
+        /**
+         * @brief создает шард поверх базы данных, опубликованной в shared memory через HyperscanWrapper::Publish
+         *
+         *   База данных используется прямо из отображенного только для чтения сегмента и не копируется.
+         *
+         * @param mapped[in] база данных внутри \a segment
+         * @param segment[in] сегмент, который должен жить пока жив шард
+         */
+        Shard(std::string group, std::vector<std::string> patterns, std::vector<unsigned> ids, uint64_t hash,
+              const hs_database_t * mapped, const std::shared_ptr<SharedSegment>& segment)
+            : group(std::move(group))
+            , patterns(std::move(patterns))
+            , ids(std::move(ids))
+            , hash(hash)
+            // hyperscan never writes to a database, so the read-only mapping can be used as is
+            , db(const_cast<hs_database_t *>(mapped))
+            , _segment(segment)
+        {}
 
-                    hs_free_database(db);
-                    scratch = nullptr;
-                    db = nullptr;
-                }
-            }
+        ~Shard() {
+            if (!_segment) hs_free_database(db);
+            hs_free_database(streamDb);
         }
 
         /**
-          * освобождает память базы данный и scratch
-          */
-        ~DatabaseWrapper() {
-            hs_free_database(db);
-            hs_free_scratch(scratch);
+         * @brief компилирует потоковую (HS_MODE_STREAM) базу данных по тем же паттернам
+         *
+         *   Нужна для потоков и текстов длиннее, чем может принять hs_scan. Компилируется один раз: <br>
+         * в Build с HyperscanWrapper::SetStreaming, иначе при первом обращении, остальные потоки ждут окончания компиляции.
+         *
+         * @param error[out] указатель на класс ошибки, заполняемый в случае неудачи
+         * @return true в случае успеха, после этого заполнен streamDb
+         */
+        bool PrepareStream(Error * error = nullptr) const {
+            std::call_once(_streamOnce, [this]() {
+                Compile(HS_MODE_STREAM, &streamDb, &_streamError);
+            });
+
+            if (!streamDb && error) *error = _streamError;
+            return streamDb != nullptr;
         }
 
         /**
-         * @brief скомпилируемая база данных на основе добавленных паттернов
+         * @brief группа паттернов шарда
          */
-        hs_database_t * db = nullptr;
+        const std::string group;
 
         /**
-         * @brief выделенная память для hs_scan, который будет ее изменять для внутренних целей,
-         *        необходимо своя для каждого потока,
+         * @brief паттерны шарда по возрастанию айдишника
          */
-        hs_scratch_t * scratch = nullptr;
+        const std::vector<std::string> patterns;
 
         /**
-         * @brief пользовательские данные соответствующие паттернам
+         * @brief айдишники паттернов, с которыми они скомпилированы
          */
-        std::vector<DataT> data;
-    };
+        const std::vector<unsigned> ids;
 
-    /**
-     * @brief RAII обертка над hs_scracth_t, хранит склонированный scratch
-     */
-    struct ScratchWrapper {
         /**
-         * @brief ScratchWrapper клонирует \a s и заполняет \a *error в случае неудачи
-         * @param s целевой scratch который будет склонирован
-         * @param error указатель на ошибку
+         * @brief хеш содержимого, ключ в кэше шардов
          */
-        ScratchWrapper(hs_scratch_t * s, Error * error = nullptr) {
-            hs_error_t err = hs_clone_scratch(s, &scratch);
+        const uint64_t hash;
 
-            if (err != HS_SUCCESS) {
-                scratch = nullptr;
+        /**
+         * @brief скомпилированная блочная база данных, nullptr если скомпилировать не удалось
+         */
+        hs_database_t * db = nullptr;
 
-                if (error) {
-                    assert(err == HS_NOMEM);
-                    *error = Error(ErrorCode::NO_MEMORY);
-                }
-            }
-        }
+        /**
+         * @brief потоковая база данных, nullptr пока не вызван PrepareStream
+         */
+        mutable hs_database_t * streamDb = nullptr;
 
         /**
-         * @brief ~ScratchWrapper освобождает склонированную память
+         * @brief айдишник паттерна, на котором не удалось скомпилировать db, NO_SLOT если ошибка не в паттерне
          */
-        ~ScratchWrapper() {
-            hs_free_scratch(scratch);
-        }
+        size_t failedId = NO_SLOT;
 
-        hs_scratch_t * scratch = nullptr;
-    };
+    private:
+        bool Compile(unsigned int mode, hs_database_t ** out, Error * error, int * failed = nullptr) const {
+            // local inputs: shards are compiled concurrently, stream databases on reader threads
+            std::vector<const char *> expressions(patterns.size());
+            std::vector<std::string> buffers(patterns.size());
+            std::vector<unsigned> flags(patterns.size(), HS_FLAG_SINGLEMATCH);
 
-public:
-    /**
-      * @brief ~HyperscanWrapper удаляет все паттерны которые были скопированны во время добавления
-      */
-    ~HyperscanWrapper() {
-        for (char* c: _patterns) {
-            delete[] c;
-        }
-    }
+            for (size_t i = 0; i < patterns.size(); ++i) {
+                expressions[i] = Expression(patterns[i], buffers[i]);
+            }
 
-    /**
-     * @brief компилирует все добавленные паттерны, обязательно вызывать после HyperscanWrapper::Insert и HyperscanWrapper::Delete
-     * @param[out] error указатель на класс ошибки, здесь бывают осмысленные ошибки вида "неправильный паттерн"
-     * @return true - в случае успеха, false - в случае ошибки подробности в переменной \a error
-     */
-    bool Build(Error * error = nullptr) {
-        Error local_error;
-        std::shared_ptr<DatabaseWrapper> dw;
+            hs_compile_error_t * compileErr;
+            hs_error_t err = hs_compile_multi(expressions.data(), flags.data(), ids.data(),
+                                              expressions.size(), mode, nullptr, out, &compileErr);
 
-        if (!_patterns.empty()) {
-            dw = std::make_shared<DatabaseWrapper>(_patterns, _data, &local_error);
+            if (err != HS_SUCCESS) {
+                if (error) {
+                    *error = compileErr->expression < 0
+                             ? Error(ErrorCode::BUILD_ERROR, "", compileErr->message)
+                             : Error(ErrorCode::BUILD_ERROR, expressions[compileErr->expression], compileErr->message);
+                }
 
-            if (local_error.GetErrorCode()) {
-                if (error) *error = local_error;
+                if (failed) *failed = compileErr->expression;
+
+                // As the compileErr pointer points to dynamically allocated memory, if
+                // we get an error, we must be sure to release it. This is not
+                // necessary when no error is detected.
+                hs_free_compile_error(compileErr);
+                *out = nullptr;
                 return false;
             }
-        }
 
-        _m.lock();
-        _dw = dw;
-        _m.unlock();
+            return true;
+        }
 
-        return true;
-    }
+        Shard(const Shard&) = delete;
+        Shard& operator=(const Shard&) = delete;
 
-    /**
-     * @brief возвращает текущее кол-во паттернов
-     */
-    size_t Size() const {
-        return _patterns.size();
-    }
+    private:
+        mutable std::once_flag _streamOnce;
+        mutable Error _streamError;
 
-    /**
-     * @see Insert(const char *, size_t, const DataT&, Error *)
-     */
-    bool Insert(const std::string &pattern, const DataT& data, Error * error = nullptr) {
-        return Insert(pattern.c_str(), pattern.size(), data, error);
-    }
+        /**
+         * @brief сегмент shared memory, в котором лежит db, если шард получен через HyperscanWrapper::Attach
+         */
+        std::shared_ptr<SharedSegment> _segment;
+    };
 
+#ifdef HYPERSCAN_CHIMERA
     /**
-     * @brief добавляет (паттерн, данные), необходимо после вызвать HyperscanWrapper::Build.
-     *
-     *   Можно добавлять один и тот же паттерн с разными данными все они будут возвращены в случае успеха <br>
-     * например: Insert("bomba", 1) -> Insert("bomba", 2) -> Build() -> Find("bomba") -> {1, 2} <br> <br>
-     * можно добавлять разные паттерны с одинаковыми айдишниками, но после файнда они будут не различимы <br>
-     * например: Insert("bomba", 1) -> Insert("Putin", 1) -> Build() -> Find("bomba Putin") -> {1, 1} <br> <br>
-     * в случае:  Insert("bomba", 1) -> Insert("bomba", 1) -> ErrorCode::PATTERN_AND_DATA_IN_USE <br>
+     * @brief RAII класс над базой данных Chimera для паттернов, которые не принимает \a %Hyperscan
      *
-     * @remark single writer
-     * @param[in] pattern указатель на начало паттерна
-     * @param[in] len  длина паттерна
-     * @param[in] data данные которые будут возвращены, если данный паттерн сматчился в тексте
-     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_IN_USE
-     * @return true в случае успеха, false в случае неудачи смотри \a error
+     *   Обратные ссылки, lookaround и другие конструкции PCRE, на которых hs_compile_multi возвращает ошибку. <br>
+     * Chimera сканирует текст префильтром \a %Hyperscan и подтверждает через PCRE только кандидатов, <br>
+     * поэтому одно такое правило не переводит весь набор на медленный путь. <br>
+     * Chimera умеет только блочный режим и не сериализуется, поэтому такие паттерны не попадают <br>
+     * в кэш шардов на диске и в HyperscanWrapper::Publish.
      */
-    virtual bool Insert(const char *pattern, size_t len, const DataT& data, Error * error = nullptr) {
-        if (error) *error = Error();
+    struct ChimeraDatabase {
+        /**
+         * @param patterns[in] паттерны
+         * @param ids[in] айдишники (номера слотов) по возрастанию
+         * @param groups[in] группы паттернов
+         * @param error[out] может быть записано ErrorCode::BUILD_ERROR
+         */
+        ChimeraDatabase(std::vector<std::string> patterns, std::vector<unsigned> ids, std::vector<std::string> groups, Error * error)
+            : patterns(std::move(patterns))
+            , ids(std::move(ids))
+            , groups(std::move(groups))
+        {
+            std::vector<const char *> expressions(this->patterns.size());
+            std::vector<std::string> buffers(this->patterns.size());
+            std::vector<unsigned> flags(this->patterns.size(), CH_FLAG_SINGLEMATCH);
+
+            for (size_t i = 0; i < this->patterns.size(); ++i) {
+                expressions[i] = Expression(this->patterns[i], buffers[i]);
+            }
+
+            ch_compile_error_t * compileErr;
+            if (ch_compile_multi(expressions.data(), flags.data(), this->ids.data(), expressions.size(),
+                                 CH_MODE_NOGROUPS, nullptr, &db, &compileErr) != CH_SUCCESS) {
+                if (error) {
+                    *error = compileErr->expression < 0
+                             ? Error(ErrorCode::BUILD_ERROR, "", compileErr->message)
+                             : Error(ErrorCode::BUILD_ERROR, expressions[compileErr->expression], compileErr->message);
+                }
+
+                ch_free_compile_error(compileErr);
+                db = nullptr;
+            }
+        }
 
-        for (size_t i = 0; i < _patterns.size(); ++i) {
-            if (strcmp(_patterns[i], pattern) == 0 && _data[i] == data) {
-                if (error) *error = Error(ErrorCode::PATTERN_AND_DATA_IN_USE, pattern);
+        ~ChimeraDatabase() {
+            ch_free_database(db);
+        }
+
+        /**
+         * @brief компилируется ли \a pattern через Chimera
+         */
+        static bool Accepts(const std::string& pattern) {
+            ch_database_t * db = nullptr;
+            ch_compile_error_t * compileErr = nullptr;
+            std::string buffer;
+
+            if (ch_compile(Expression(pattern, buffer), CH_FLAG_SINGLEMATCH, CH_MODE_NOGROUPS, nullptr, &db, &compileErr) != CH_SUCCESS) {
+                ch_free_compile_error(compileErr);
                 return false;
             }
+
+            ch_free_database(db);
+            return true;
         }
 
-        char * cpy = new char[len + 1];
-        strncpy(cpy, pattern, len + 1);
-        _patterns.push_back(cpy);
-        _data.push_back(data);
+        const std::vector<std::string> patterns;
+        const std::vector<unsigned> ids;
+        const std::vector<std::string> groups;
 
-        return true;
-    }
+        ch_database_t * db = nullptr;
 
-    /**
-     * @see Delete(const char *, size_t, const DataT&, Error *)
-     */
-    bool Delete(const std::string &pattern, const DataT& data, Error * error = nullptr) {
-        return Delete(pattern.c_str(), pattern.size(), data, error);
-    }
+        ChimeraDatabase(const ChimeraDatabase&) = delete;
+        ChimeraDatabase& operator=(const ChimeraDatabase&) = delete;
+    };
+#endif
 
     /**
-     * @brief удаляет (паттерн, данные), необходимо после вызвать HyperscanWrapper::Build.
-     *
-     *   В случае:  Insert("bomba", 1) -> Delete("bomba", 1) -> Delete("bomba", 1) -> ErrorCode::PATTERN_AND_DATA_NOT_FOUND
-     * @remark single writer
-     * @param[in] pattern указатель на начало паттерна
-     * @param[in] len  длина паттерна
-     * @param[in] data данные которые будут возвращены, если данный паттерн сматчился в тексте
-     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_IN_USE
-     * @return true в случае успеха, false в случае неудачи смотри \a error
+     * @brief RAII класс над снэпшотом: шардами и scratch (изменяемая память выделямая для поиска в тексте)
      */
-    virtual bool Delete(const char *pattern, size_t len, const DataT& data, Error * error = nullptr) {
-        if (error) *error = Error();
+    class DatabaseWrapper : public std::enable_shared_from_this<DatabaseWrapper> {
+    public:
+        /**
+         * @brief собирает снэпшот на текущий Build из шардов и сохраняет соответствующие данные
+         *
+         *   hs_scan возвращает айдишник паттерна = номер слота, по нему я понимаю какие данные ему соответствуют <br>
+         * данные нужно копировать т.к. они изменяются в другом потоке могут удаляться и добавляться <br>
+         * HyperscanWrapper::Find захватывает указатель на DatabaseWrapper с ним нужно сохранить и данные <br>
+         * поэтому я их и сохраняю в этом классе. <br>
+         * Выделяется один scratch, которого хватает для каждого из шардов, Find сканирует ими шарды по очереди.
+         *
+         * @param shards[in] скомпилированные шарды, пусто, если все паттерны ушли в Chimera
+         * @param data[in] данные по номеру слота
+         * @param error[out] указатель на класс ошибки, заполняемый в случае неудачи
+         */
+        DatabaseWrapper(std::vector<std::shared_ptr<const Shard>> shards, DataStore<DataT> data, Error * error = nullptr)
+            : shards(std::move(shards))
+            , data(std::move(data))
+            , groupOf(this->data.Size(), 0)
+            , live((this->data.Size() + 63) / 64, 0)
+            , _deadOwned(new std::atomic<uint64_t>[live.size()]())
+        {
+            dead = _deadOwned.get();
+
+            for (auto& shard: this->shards) {
+                auto it = groupIndex.find(shard->group);
+                if (it == groupIndex.end()) {
+                    it = groupIndex.emplace(shard->group, groupShards.size()).first;
+                    groupShards.emplace_back();
+                }
 
-        for (size_t i = 0; i < _patterns.size(); ++i) {
-            if (strcmp(_patterns[i], pattern) == 0 && _data[i] == data) {
+                groupShards[it->second].push_back(shard.get());
+                allShards.push_back(shard.get());
 
-                std::swap(_patterns[i], _patterns.back());
-                std::swap(_data[i], _data.back());
+                for (unsigned id: shard->ids) {
+                    groupOf[id] = it->second;
+                    live[id / 64] |= uint64_t(1) << (id % 64);
+                }
+            }
 
-                delete[] _patterns.back();
-                _patterns.pop_back();
-                _data.pop_back();
+            // hs_alloc_scratch grows the given scratch until it fits every database passed to it
+            for (auto& shard: this->shards) {
+                if (hs_alloc_scratch(shard->db, &scratch) != HS_SUCCESS) {
+                    if (error) *error = Error(ErrorCode::NO_MEMORY);
 
-                return true;
+                    hs_free_scratch(scratch);
+                    scratch = nullptr;
+                    return;
+                }
             }
         }
 
-        if (error) *error = Error(ErrorCode::PATTERN_AND_DATA_NOT_FOUND);
-        return false;
-    }
+        ~DatabaseWrapper() {
+            hs_free_scratch(scratch);
+            hs_free_scratch(streamScratch);
+#ifdef HYPERSCAN_CHIMERA
+            ch_free_scratch(chimeraScratch);
+#endif
+        }
 
-    /**
-     * @see InsertAndBuild(char const *, size_t, const DataT&, Error *)
-     */
-    bool InsertAndBuild(const std::string& pattern, const DataT& data, Error * error = nullptr) {
-        return InsertAndBuild(pattern.c_str(), pattern.size(), data, error);
-    }
+#ifdef HYPERSCAN_CHIMERA
+        /**
+         * @brief добавляет в снэпшот паттерны, скомпилированные Chimera
+         * @param error[out] может быть записано ErrorCode::NO_MEMORY
+         */
+        bool SetChimera(std::shared_ptr<const ChimeraDatabase> db, Error * error) {
+            chimera = std::move(db);
+
+            for (size_t i = 0; i < chimera->ids.size(); ++i) {
+                auto it = groupIndex.find(chimera->groups[i]);
+                if (it == groupIndex.end()) {
+                    it = groupIndex.emplace(chimera->groups[i], groupShards.size()).first;
+                    groupShards.emplace_back();
+                }
+
+                unsigned id = chimera->ids[i];
+                groupOf[id] = it->second;
+                live[id / 64] |= uint64_t(1) << (id % 64);
+            }
+
+            if (ch_alloc_scratch(chimera->db, &chimeraScratch) != CH_SUCCESS) {
+                if (error) *error = Error(ErrorCode::NO_MEMORY);
+                return false;
+            }
+
+            return true;
+        }
+#endif
+
+        /**
+         * @brief кол-во баз данных, каждая из которых сообщает совпадения по порядку
+         */
+        size_t DatabaseCount() const {
+#ifdef HYPERSCAN_CHIMERA
+            if (chimera) return shards.size() + 1;
+#endif
+            return shards.size();
+        }
+
+        /**
+         * @brief помечает паттерн с айдишником \a id отозванным, см. HyperscanWrapper::Revoke
+         *
+         *   Слот мог быть переиспользован после этого Build, поэтому бит ставится, только если <br>
+         * в снэпшоте под этим айдишником скомпилирован именно (\a pattern, \a value).
+         *
+         * @return true если паттерн был в снэпшоте
+         */
+        bool Revoke(unsigned id, StringView pattern, const DataT& value) {
+            // the words of an attached snapshot are written by the publishing process only
+            if (_deadSegment || id >= data.Size() || !(data[id] == value)) return false;
+
+            for (auto& shard: shards) {
+                auto it = std::lower_bound(shard->ids.begin(), shard->ids.end(), id);
+
+                if (it != shard->ids.end() && *it == id && pattern == shard->patterns[it - shard->ids.begin()]) {
+                    dead[id / 64].fetch_or(uint64_t(1) << (id % 64), std::memory_order_release);
+                    return true;
+                }
+            }
+
+#ifdef HYPERSCAN_CHIMERA
+            if (chimera) {
+                auto it = std::lower_bound(chimera->ids.begin(), chimera->ids.end(), id);
+
+                if (it != chimera->ids.end() && *it == id && pattern == chimera->patterns[it - chimera->ids.begin()]) {
+                    dead[id / 64].fetch_or(uint64_t(1) << (id % 64), std::memory_order_release);
+                    return true;
+                }
+            }
+#endif
+
+            return false;
+        }
+
+        /**
+         * @brief готовит потоковые базы данных всех шардов и общий scratch для них
+         *
+         *   Нужны для потоков и текстов длиннее, чем может принять hs_scan. Готовятся один раз: <br>
+         * в Build с HyperscanWrapper::SetStreaming, иначе при первом обращении, остальные потоки ждут окончания.
+         *
+         * @param error[out] указатель на класс ошибки, заполняемый в случае неудачи
+         * @return true в случае успеха, после этого заполнены streamDb всех шардов и streamScratch
+         */
+        bool PrepareStream(Error * error = nullptr) const {
+            std::call_once(_streamOnce, [this]() {
+                for (auto& shard: shards) {
+                    if (!shard->PrepareStream(&_streamError)) break;
+
+                    if (hs_alloc_scratch(shard->streamDb, &streamScratch) != HS_SUCCESS) {
+                        _streamError = Error(ErrorCode::NO_MEMORY);
+                        break;
+                    }
+                }
+
+                if (_streamError.GetErrorCode()) {
+                    hs_free_scratch(streamScratch);
+                    streamScratch = nullptr;
+                } else {
+                    _streamReady.store(true, std::memory_order_release);
+                }
+            });
+
+            if (!streamScratch && error) *error = _streamError;
+            return streamScratch != nullptr;
+        }
+
+        /**
+         * @brief готовы ли потоковые базы, в отличие от PrepareStream не ждет и не компилирует
+         */
+        bool StreamReady() const {
+            return _streamReady.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief шарды, из которых состоит снэпшот
+         */
+        std::vector<std::shared_ptr<const Shard>> shards;
+
+        /**
+         * @brief выделенная память для hs_scan, который будет ее изменять для внутренних целей,
+         *        необходимо своя для каждого потока, подходит для любого из шардов
+         */
+        hs_scratch_t * scratch = nullptr;
+
+        /**
+         * @brief пользовательские данные по номеру слота паттерна, куски без изменений общие с предыдущим снэпшотом
+         */
+        DataStore<DataT> data;
+
+        /**
+         * @brief отозванные айдишники, по биту на слот (live.size() слов), проверяются в FindHandler
+         *
+         *   У снэпшота из HyperscanWrapper::Attach слова лежат в сегменте shared memory, <br>
+         * и Revoke публикующего процесса виден в нем сразу, см. MapDead.
+         */
+        std::atomic<uint64_t> * dead = nullptr;
+
+        /**
+         * @brief номер группы по номеру слота, номер группы - индекс в groupShards
+         */
+        std::vector<size_t> groupOf;
+
+        /**
+         * @brief скомпилированные в этот снэпшот айдишники, по биту на слот
+         */
+        std::vector<uint64_t> live;
+
+        /**
+         * @brief номер группы по имени
+         */
+        std::unordered_map<std::string, size_t> groupIndex;
+
+        /**
+         * @brief шарды каждой группы
+         */
+        std::vector<std::vector<const Shard *>> groupShards;
+
+        /**
+         * @brief все шарды, их сканирует Find без групп
+         */
+        std::vector<const Shard *> allShards;
+
+        /**
+         * @brief реплики этого снэпшота по номеру узла NUMA, пусто если реплики не включены
+         * @see HyperscanWrapper::SetNumaReplicas
+         */
+        std::vector<std::shared_ptr<DatabaseWrapper>> replicas;
+
+        /**
+         * @brief scratch для потоковых баз данных шардов, клонируется так же как и scratch
+         */
+        mutable hs_scratch_t * streamScratch = nullptr;
+
+#ifdef HYPERSCAN_CHIMERA
+        /**
+         * @brief паттерны, которые не принял \a %Hyperscan, nullptr если таких нет
+         */
+        std::shared_ptr<const ChimeraDatabase> chimera;
+
+        /**
+         * @brief scratch для chimera, клонируется на каждое сканирование
+         */
+        ch_scratch_t * chimeraScratch = nullptr;
+#endif
+
+        /**
+         * @brief берет отозванные айдишники из опубликованного сегмента вместо своих
+         * @param words[in] live.size() слов внутри \a segment, отображенного только для чтения
+         */
+        void MapDead(const std::atomic<uint64_t> * words, const std::shared_ptr<SharedSegment>& segment) {
+            // never written through this pointer, see Revoke
+            dead = const_cast<std::atomic<uint64_t> *>(words);
+            _deadSegment = segment;
+            _deadOwned.reset();
+        }
+
+    private:
+        mutable std::once_flag _streamOnce;
+        mutable Error _streamError;
+        mutable std::atomic<bool> _streamReady{false};
+
+        std::unique_ptr<std::atomic<uint64_t>[]> _deadOwned;
+        std::shared_ptr<SharedSegment> _deadSegment;
+    };
+
+    /**
+     * @brief RAII обертка над hs_stream_t сканируемых шардов снэпшота
+     */
+    struct StreamWrapper {
+        /**
+         * @brief открывает по потоку на потоковую базу каждого из \a shards и заполняет \a *error в случае неудачи
+         */
+        StreamWrapper(const std::vector<const Shard *>& shards, Error * error = nullptr) {
+            for (const Shard * shard: shards) {
+                hs_stream_t * stream = nullptr;
+
+                if (hs_open_stream(shard->streamDb, 0, &stream) != HS_SUCCESS) {
+                    Close(nullptr, nullptr, nullptr);
+                    if (error) *error = Error(ErrorCode::NO_MEMORY);
+                    return;
+                }
+
+                streams.push_back(stream);
+            }
+        }
+
+        /**
+         * @brief закрывает потоки без сообщения о совпадениях в конце потока, если их не закрыли через Close
+         */
+        ~StreamWrapper() {
+            Close(nullptr, nullptr, nullptr);
+        }
+
+        /**
+         * @brief сканирует очередной кусок текста во всех потоках
+         */
+        hs_error_t Scan(const char * data, unsigned int length, hs_scratch_t * scratch, match_event_handler onEvent, void * ctx) {
+            for (hs_stream_t * stream: streams) {
+                hs_error_t err = hs_scan_stream(stream, data, length, 0, scratch, onEvent, ctx);
+                if (err != HS_SUCCESS) return err;
+            }
+
+            return HS_SUCCESS;
+        }
+
+        /**
+         * @brief закрывает потоки, сообщая о совпадениях в конце потока в \a onEvent
+         */
+        hs_error_t Close(hs_scratch_t * scratch, match_event_handler onEvent, void * ctx) {
+            hs_error_t res = HS_SUCCESS;
+
+            for (hs_stream_t * stream: streams) {
+                hs_error_t err = hs_close_stream(stream, scratch, onEvent, ctx);
+                if (err != HS_SUCCESS && err != HS_SCAN_TERMINATED) res = err;
+            }
+
+            streams.clear();
+            return res;
+        }
+
+        std::vector<hs_stream_t *> streams;
+    };
+
+    /**
+     * @brief RAII обертка над hs_scracth_t, хранит склонированный scratch
+     */
+    struct ScratchWrapper {
+        /**
+         * @brief ScratchWrapper клонирует \a s и заполняет \a *error в случае неудачи
+         * @param s целевой scratch который будет склонирован
+         * @param error указатель на ошибку
+         */
+        ScratchWrapper(hs_scratch_t * s, Error * error = nullptr) {
+            Clone(s, error);
+        }
+
+        /**
+         * @brief пустой, для случая, когда scratch уже есть и клонировать его не нужно
+         */
+        ScratchWrapper() = default;
+
+        ScratchWrapper(const ScratchWrapper&) = delete;
+        ScratchWrapper& operator=(const ScratchWrapper&) = delete;
+
+        /**
+         * @brief клонирует \a s, если еще ничего не склонировано
+         * @return false в случае неудачи, \a *error заполнен
+         */
+        bool Clone(hs_scratch_t * s, Error * error = nullptr) {
+            assert(!scratch);
+            hs_error_t err = hs_clone_scratch(s, &scratch);
+
+            if (err != HS_SUCCESS) {
+                scratch = nullptr;
+
+                if (error) {
+                    assert(err == HS_NOMEM);
+                    *error = Error(ErrorCode::NO_MEMORY);
+                }
+            }
+
+            return scratch != nullptr;
+        }
+
+        /**
+         * @brief ~ScratchWrapper освобождает склонированную память
+         */
+        ~ScratchWrapper() {
+            hs_free_scratch(scratch);
+        }
+
+        hs_scratch_t * scratch = nullptr;
+    };
+
+    /**
+     * @brief снэпшот, который читает Find: держит его, пока жив, способом, который выбрал SyncPolicy
+     *
+     *   Указывает на реплику снэпшота на узле NUMA текущего потока, если реплики есть.
+     */
+    class Snapshot {
+    public:
+        typedef typename SyncPolicy::template Pointer<DatabaseWrapper>::ReadGuard ReadGuard;
+
+        explicit Snapshot(ReadGuard guard)
+            : _guard(std::move(guard))
+            , _dw(_guard.Get())
+        {}
+
+        Snapshot(Snapshot&& other) = default;
+
+        const DatabaseWrapper * Get() const {
+            return _dw;
+        }
+
+        const DatabaseWrapper * operator->() const {
+            return _dw;
+        }
+
+        const DatabaseWrapper& operator*() const {
+            return *_dw;
+        }
+
+        explicit operator bool() const {
+            return _dw != nullptr;
+        }
+
+        /**
+         * @brief владеющий указатель, чтобы снэпшот пережил Snapshot, см. MatchSet
+         */
+        std::shared_ptr<const DatabaseWrapper> Share() const {
+            return _dw->shared_from_this();
+        }
+
+        void SetReplica(const DatabaseWrapper * replica) {
+            _dw = replica;
+        }
+
+    private:
+        ReadGuard _guard;
+        const DatabaseWrapper * _dw;
+    };
+
+public:
+    /**
+     * @brief айдишники сматчившихся паттернов, заполняется HyperscanWrapper::FindIds
+     *
+     *   Вместо копии DataT на каждое совпадение ставится бит айдишника паттерна, повторные совпадения <br>
+     * схлопываются сами. Память маски переиспользуется между вызовами FindIds, <br>
+     * данные достаются по айдишнику через Resolve без копирования. <br>
+     * Держит снэпшот, которым сканировал последний FindIds, поэтому Resolve корректен и после Build.
+     */
+    class MatchSet : public PatternMask {
+    public:
+        /**
+         * @brief данные паттерна \a id, id должен быть в множестве
+         */
+        const DataT& Resolve(size_t id) const {
+            assert(_dw && id < _dw->data.Size());
+            return _dw->data[id];
+        }
+
+    private:
+        friend class HyperscanWrapper;
+
+        std::shared_ptr<const DatabaseWrapper> _dw;
+    };
+
+    /**
+     * @brief счетчики совпадений по айдишникам паттернов, накапливаются HyperscanWrapper::Count
+     *
+     *   Для подсчета по большим архивам: Count не создает ответ на каждый текст, а увеличивает счетчики <br>
+     * сматчившихся паттернов прямо в callback. У каждого потока своя гистограмма, в конце они <br>
+     * складываются через Merge. Айдишники не меняются между Build, пока паттерн не удалят, <br>
+     * поэтому гистограмма может копиться через несколько Build. Resolve использует снэпшот последнего Count.
+     *
+     * @remark не thread-safe
+     */
+    class MatchHistogram {
+    public:
+        /**
+         * @brief счетчики одного паттерна
+         */
+        struct Counts {
+            uint64_t matches = 0;       //!< сколько раз паттерн сообщил совпадение
+            uint64_t documents = 0;     //!< в скольких текстах паттерн сматчился хотя бы раз
+            uint64_t bytes = 0;         //!< суммарная длина этих текстов
+        };
+
+        /**
+         * @brief кол-во айдишников, у больших счетчики нулевые
+         */
+        size_t Size() const {
+            return _counts.size();
+        }
+
+        /**
+         * @brief счетчики паттерна \a id, id < Size()
+         */
+        const Counts& Get(size_t id) const {
+            return _counts[id];
+        }
+
+        /**
+         * @brief данные паттерна \a id, у которого ненулевые счетчики
+         */
+        const DataT& Resolve(size_t id) const {
+            assert(_dw && id < _dw->data.Size());
+            return _dw->data[id];
+        }
+
+        /**
+         * @brief кол-во текстов, переданных в Count
+         */
+        uint64_t Documents() const {
+            return _documents;
+        }
+
+        /**
+         * @brief суммарная длина текстов, переданных в Count
+         */
+        uint64_t Bytes() const {
+            return _bytes;
+        }
+
+        /**
+         * @brief прибавляет счетчики \a other, например гистограммы другого потока
+         */
+        void Merge(const MatchHistogram& other) {
+            if (_counts.size() < other._counts.size()) {
+                _counts.resize(other._counts.size());
+                _lastDocument.resize(other._counts.size(), 0);
+            }
+
+            for (size_t i = 0; i < other._counts.size(); ++i) {
+                _counts[i].matches += other._counts[i].matches;
+                _counts[i].documents += other._counts[i].documents;
+                _counts[i].bytes += other._counts[i].bytes;
+            }
+
+            _documents += other._documents;
+            _bytes += other._bytes;
+            if (!_dw) _dw = other._dw;
+        }
+
+        /**
+         * @brief обнуляет счетчики, память остается
+         */
+        void Clear() {
+            _counts.assign(_counts.size(), Counts());
+            _lastDocument.assign(_lastDocument.size(), 0);
+            _documents = 0;
+            _bytes = 0;
+        }
+
+    private:
+        friend class HyperscanWrapper;
+
+        /**
+         * @brief начинает очередной текст, вызывается Count до сканирования
+         */
+        void Start(std::shared_ptr<const DatabaseWrapper> dw, size_t len) {
+            if (_counts.size() < dw->data.Size()) {
+                _counts.resize(dw->data.Size());
+                _lastDocument.resize(dw->data.Size(), 0);
+            }
+
+            ++_documents;
+            _bytes += len;
+            _dw = std::move(dw);
+        }
+
+        void Add(unsigned id, size_t len) {
+            Counts& counts = _counts[id];
+            ++counts.matches;
+
+            // the number of the current text instead of a per-text bitmap that would need clearing
+            if (_lastDocument[id] != _documents) {
+                _lastDocument[id] = _documents;
+                ++counts.documents;
+                counts.bytes += len;
+            }
+        }
+
+        std::vector<Counts> _counts;
+        std::vector<uint64_t> _lastDocument;    //!< номер последнего текста, в котором сматчился паттерн
+        uint64_t _documents = 0;
+        uint64_t _bytes = 0;
+        std::shared_ptr<const DatabaseWrapper> _dw;
+    };
+
+    /**
+     * @brief память потоков, см. HyperscanWrapper::GetStreamStats
+     */
+    struct StreamStats {
+        size_t liveStreams;         //!< открытые несжатые потоки
+        size_t liveBytes;           //!< состояние несжатых потоков, hs_stream_size по всем шардам
+        size_t compressedStreams;   //!< сжатые потоки
+        size_t compressedBytes;     //!< сжатое состояние с округлением до StreamBufferPool::BLOCK_SIZE
+        size_t poolBytes;           //!< слабы пула сжатых состояний, включая свободные буферы
+        bool streamsReady;          //!< потоковые базы текущего снэпшота скомпилированы, см. SetStreaming
+    };
+
+    class Stream;
+
+    /**
+     * @brief scratch для Find и потоков, по одному на поток исполнения
+     *
+     *   Find и Stream::Scan без Scratch клонируют scratch снэпшота на каждый вызов. Этот scratch выделяется <br>
+     * один раз и дорастает до баз данных снэпшота, которым сканирует, поэтому подходит для любых снэпшотов.
+     *
+     * @remark не thread-safe
+     */
+    class Scratch {
+    public:
+        Scratch() = default;
+
+        ~Scratch() {
+            hs_free_scratch(_scratch);
+            hs_free_scratch(_blockScratch);
+        }
+
+        Scratch(const Scratch&) = delete;
+        Scratch& operator=(const Scratch&) = delete;
+
+    private:
+        friend class Stream;
+        friend class HyperscanWrapper;
+
+        /**
+         * @brief дорастает до блочных баз данных \a dw, если до этого сканировал другой снэпшот
+         * @param error[out] может быть записано ErrorCode::NO_MEMORY
+         */
+        hs_scratch_t * FitBlock(const Snapshot& dw, Error * error) {
+            // the held snapshot is alive, so no other snapshot can get its address
+            if (_blockFitted.get() == dw.Get()) return _blockScratch;
+
+            for (auto& shard: dw->shards) {
+                if (hs_alloc_scratch(shard->db, &_blockScratch) != HS_SUCCESS) {
+                    if (error) *error = Error(ErrorCode::NO_MEMORY);
+                    return nullptr;
+                }
+            }
+
+            _blockFitted = dw.Share();
+            return _blockScratch;
+        }
+
+        /**
+         * @brief дорастает до потоковых баз данных \a dw, если до этого сканировал другой снэпшот
+         * @param error[out] может быть записано ErrorCode::NO_MEMORY
+         */
+        hs_scratch_t * Fit(const std::shared_ptr<const DatabaseWrapper>& dw, Error * error) {
+            if (_fitted == dw) return _scratch;
+
+            for (auto& shard: dw->shards) {
+                if (hs_alloc_scratch(shard->streamDb, &_scratch) != HS_SUCCESS) {
+                    if (error) *error = Error(ErrorCode::NO_MEMORY);
+                    return nullptr;
+                }
+            }
+
+            _fitted = dw;
+            return _scratch;
+        }
+
+        hs_scratch_t * _scratch = nullptr;
+        std::shared_ptr<const DatabaseWrapper> _fitted;   //!< снэпшот, до которого дорос scratch
+
+        hs_scratch_t * _blockScratch = nullptr;
+        std::shared_ptr<const DatabaseWrapper> _blockFitted;
+    };
+
+    /**
+     * @brief поток: текст, который приходит кусками, например TCP соединение, открывается через HyperscanWrapper::OpenStream
+     *
+     *   Паттерн находится, даже если его совпадение разбито между кусками, и сообщается один раз за поток. <br>
+     * Поток держит снэпшот, которым открыт, Build не меняет паттерны уже открытых потоков, <br>
+     * Revoke действует сразу. Паттерны, которые ушли в Chimera, потоками не ищутся. <br> <br>
+     *
+     *   Состояние потока - по hs_stream_t на шард. Простаивающий поток можно сжать через Compress <br>
+     * или CompressIfIdle: состояние сжимается hs_compress_stream в буфер из StreamBufferPool, <br>
+     * а при следующем Scan разжимается обратно, так что память растет с кол-вом активных потоков, а не всех.
+     *
+     * @remark не thread-safe, каждым потоком одновременно пользуется один поток исполнения
+     */
+    class Stream {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+         * @brief закрытый поток
+         */
+        Stream() = default;
+
+        Stream(Stream&& other) {
+            *this = std::move(other);
+        }
+
+        Stream& operator=(Stream&& other) {
+            if (this != &other) {
+                Discard();
+
+                _dw = std::move(other._dw);
+                _shared = std::move(other._shared);
+                _streams = std::move(other._streams);
+                _buffer = other._buffer;
+                _capacity = other._capacity;
+                _stateBytes = other._stateBytes;
+                _lastActive = other._lastActive;
+
+                other._streams.clear();
+                other._buffer = nullptr;
+            }
+
+            return *this;
+        }
+
+        /**
+         * @brief закрывает поток без сообщения о совпадениях в конце потока
+         */
+        ~Stream() {
+            Discard();
+        }
+
+        /**
+         * @brief открыт ли поток
+         */
+        bool IsOpen() const {
+            return _shared != nullptr;
+        }
+
+        /**
+         * @brief сжато ли состояние потока
+         */
+        bool IsCompressed() const {
+            return _buffer != nullptr;
+        }
+
+        /**
+         * @brief время последнего Scan или открытия
+         */
+        Clock::time_point LastActive() const {
+            return _lastActive;
+        }
+
+        /**
+         * @brief сканирует очередной кусок потока, клонируя scratch
+         * @param[in] text указатель на начало куска
+         * @param[in] len длина куска
+         * @param[out] res сюда добавляются данные паттернов, сматчившихся в этом куске
+         * @param[out] error может быть записано ErrorCode::SCAN_ERROR или ErrorCode::NO_MEMORY
+         * @return false в случае ошибки или если поток закрыт
+         */
+        bool Scan(const char * text, size_t len, std::vector<DataT>& res, Error * error = nullptr) {
+            return ScanWith(text, len, res, nullptr, error);
+        }
+
+        /**
+         * @brief сканирует очередной кусок потока scratch'ем \a scratch без клонирования
+         * @see Scan(const char *, size_t, std::vector<DataT>&, Error *)
+         */
+        bool Scan(const char * text, size_t len, std::vector<DataT>& res, Scratch& scratch, Error * error = nullptr) {
+            return ScanWith(text, len, res, &scratch, error);
+        }
+
+        /**
+         * @brief закрывает поток, добавляя в \a res паттерны, которые сматчились в конце потока
+         * @param[out] error может быть записано ErrorCode::SCAN_ERROR или ErrorCode::NO_MEMORY
+         * @return false в случае ошибки, поток закрывается в любом случае
+         */
+        bool Close(std::vector<DataT>& res, Error * error = nullptr) {
+            return CloseWith(res, nullptr, error);
+        }
+
+        /**
+         * @see Close(std::vector<DataT>&, Error *)
+         */
+        bool Close(std::vector<DataT>& res, Scratch& scratch, Error * error = nullptr) {
+            return CloseWith(res, &scratch, error);
+        }
+
+        /**
+         * @brief сбрасывает поток в начальное состояние, добавляя в \a res паттерны, которые сматчились в конце потока
+         *
+         *   Память потока остается за ним, поэтому новый поток на месте старого не выделяет ее заново, <br>
+         * но паттерны остаются те, с которыми поток был открыт, см. HyperscanWrapper::IsStale.
+         *
+         * @param[out] error может быть записано ErrorCode::SCAN_ERROR или ErrorCode::NO_MEMORY
+         * @return false в случае ошибки, тогда поток закрывается
+         */
+        bool Reset(std::vector<DataT>& res, Scratch& scratch, Error * error = nullptr) {
+            if (error) *error = Error();
+
+            if (!_shared) {
+                if (error) *error = Error(ErrorCode::SCAN_ERROR);
+                return false;
+            }
+
+            _lastActive = Clock::now();
+
+            if (_buffer && !Expand(error)) {
+                Discard();
+                return false;
+            }
+
+            if (_streams.empty()) return true;
+
+            Context ctx{&res, &_dw->data, _dw->dead};
+
+            bool ok = WithScratch(&scratch, error, [&](hs_scratch_t * s) {
+                for (hs_stream_t * stream: _streams) {
+                    if (hs_reset_stream(stream, 0, s, FindHandler, (void*) &ctx) != HS_SUCCESS) {
+                        if (error) *error = Error(ErrorCode::SCAN_ERROR);
+                        return false;
+                    }
+                }
+
+                return true;
+            });
+
+            if (!ok) Discard();
+            return ok;
+        }
+
+        /**
+         * @brief сжимает состояние потока, следующий Scan разожмет его обратно
+         * @param[out] error может быть записано ErrorCode::NO_MEMORY
+         * @return true если поток сжат, в том числе раньше
+         */
+        bool Compress(Error * error = nullptr) {
+            if (error) *error = Error();
+            if (!_shared) return false;
+            if (_buffer || _streams.empty()) return true;
+
+            // every state is stored as its length followed by the compressed bytes
+            size_t total = 0;
+            for (hs_stream_t * stream: _streams) {
+                size_t used = 0;
+                hs_compress_stream(stream, nullptr, 0, &used);
+                total += sizeof(uint64_t) + used;
+            }
+
+            size_t capacity = 0;
+            char * buffer = _shared->pool.Allocate(total, &capacity);
+            if (!buffer) {
+                if (error) *error = Error(ErrorCode::NO_MEMORY);
+                return false;
+            }
+
+            size_t offset = 0;
+            for (hs_stream_t * stream: _streams) {
+                size_t used = 0;
+                if (hs_compress_stream(stream, buffer + offset + sizeof(uint64_t), total - offset - sizeof(uint64_t), &used) != HS_SUCCESS) {
+                    _shared->pool.Free(buffer, capacity);
+                    if (error) *error = Error(ErrorCode::NO_MEMORY);
+                    return false;
+                }
+
+                uint64_t size = used;
+                memcpy(buffer + offset, &size, sizeof(size));
+                offset += sizeof(size) + used;
+            }
+
+            for (hs_stream_t * stream: _streams) {
+                hs_close_stream(stream, nullptr, nullptr, nullptr);
+            }
+            std::vector<hs_stream_t *>().swap(_streams);
+
+            _buffer = buffer;
+            _capacity = capacity;
+
+            --_shared->liveStreams;
+            _shared->liveBytes -= _stateBytes;
+            ++_shared->compressedStreams;
+            _shared->compressedBytes += _capacity;
+
+            return true;
+        }
+
+        /**
+         * @brief сжимает поток, если он простаивает дольше HyperscanWrapper::SetStreamIdleTimeout
+         * @param[in] now текущее время, чтобы обходить много потоков с одним вызовом Clock::now()
+         * @param[out] error может быть записано ErrorCode::NO_MEMORY
+         * @return true если поток сжат этим вызовом
+         */
+        bool CompressIfIdle(Clock::time_point now, Error * error = nullptr) {
+            if (error) *error = Error();
+            if (!_shared || _buffer || _streams.empty()) return false;
+
+            long long timeout = _shared->idleTimeoutMs.load(std::memory_order_relaxed);
+            if (timeout <= 0 || now - _lastActive < std::chrono::milliseconds(timeout)) return false;
+
+            return Compress(error);
+        }
+
+    private:
+        friend class HyperscanWrapper;
+
+        /**
+         * @brief вызывает \a f(hs_scratch_t *) с \a scratch или с клоном scratch'а снэпшота
+         */
+        template <typename F>
+        bool WithScratch(Scratch * scratch, Error * error, F f) {
+            if (scratch) {
+                hs_scratch_t * s = scratch->Fit(_dw, error);
+                return s && f(s);
+            }
+
+            ScratchWrapper sw(_dw->streamScratch, error);
+            return sw.scratch && f(sw.scratch);
+        }
+
+        bool ScanWith(const char * text, size_t len, std::vector<DataT>& res, Scratch * scratch, Error * error) {
+            if (error) *error = Error();
+
+            if (!_shared) {
+                if (error) *error = Error(ErrorCode::SCAN_ERROR);
+                return false;
+            }
+
+            _lastActive = Clock::now();
+            if (_buffer && !Expand(error)) return false;
+
+            // the snapshot has no hyperscan databases
+            if (_streams.empty()) return true;
+
+            Context ctx{&res, &_dw->data, _dw->dead};
+
+            return WithScratch(scratch, error, [&](hs_scratch_t * s) {
+                for (size_t pos = 0; pos < len; pos += MAX_SCAN_LENGTH) {
+                    size_t chunk = std::min(MAX_SCAN_LENGTH, len - pos);
+
+                    for (hs_stream_t * stream: _streams) {
+                        if (hs_scan_stream(stream, text + pos, chunk, 0, s, FindHandler, (void*) &ctx) != HS_SUCCESS) {
+                            if (error) *error = Error(ErrorCode::SCAN_ERROR);
+                            return false;
+                        }
+                    }
+                }
+
+                return true;
+            });
+        }
+
+        bool CloseWith(std::vector<DataT>& res, Scratch * scratch, Error * error) {
+            if (error) *error = Error();
+
+            if (!_shared) {
+                if (error) *error = Error(ErrorCode::SCAN_ERROR);
+                return false;
+            }
+
+            if (_buffer && !Expand(error)) {
+                Discard();
+                return false;
+            }
+
+            bool ok = true;
+            if (!_streams.empty()) {
+                Context ctx{&res, &_dw->data, _dw->dead};
+
+                ok = WithScratch(scratch, error, [&](hs_scratch_t * s) {
+                    bool closed = true;
+
+                    for (hs_stream_t * stream: _streams) {
+                        if (hs_close_stream(stream, s, FindHandler, (void*) &ctx) != HS_SUCCESS) closed = false;
+                    }
+                    _streams.clear();
+
+                    if (!closed && error) *error = Error(ErrorCode::SCAN_ERROR);
+                    return closed;
+                });
+            }
+
+            Discard();
+            return ok;
+        }
+
+        /**
+         * @brief разжимает состояние из _buffer
+         * @param error[out] может быть записано ErrorCode::NO_MEMORY
+         */
+        bool Expand(Error * error) {
+            size_t offset = 0;
+
+            for (auto& shard: _dw->shards) {
+                uint64_t size;
+                memcpy(&size, _buffer + offset, sizeof(size));
+
+                hs_stream_t * stream = nullptr;
+                if (hs_expand_stream(shard->streamDb, &stream, _buffer + offset + sizeof(size), size) != HS_SUCCESS) {
+                    for (hs_stream_t * expanded: _streams) {
+                        hs_close_stream(expanded, nullptr, nullptr, nullptr);
+                    }
+                    _streams.clear();
+
+                    if (error) *error = Error(ErrorCode::NO_MEMORY);
+                    return false;
+                }
+
+                _streams.push_back(stream);
+                offset += sizeof(size) + size;
+            }
+
+            _shared->pool.Free(_buffer, _capacity);
+            _buffer = nullptr;
+
+            --_shared->compressedStreams;
+            _shared->compressedBytes -= _capacity;
+            ++_shared->liveStreams;
+            _shared->liveBytes += _stateBytes;
+
+            return true;
+        }
+
+        /**
+         * @brief освобождает состояние без сообщения о совпадениях, поток становится закрытым
+         */
+        void Discard() {
+            for (hs_stream_t * stream: _streams) {
+                hs_close_stream(stream, nullptr, nullptr, nullptr);
+            }
+            _streams.clear();
+
+            if (_shared) {
+                if (_buffer) {
+                    _shared->pool.Free(_buffer, _capacity);
+                    --_shared->compressedStreams;
+                    _shared->compressedBytes -= _capacity;
+                } else {
+                    --_shared->liveStreams;
+                    _shared->liveBytes -= _stateBytes;
+                }
+            }
+
+            _buffer = nullptr;
+            _shared.reset();
+            _dw.reset();
+        }
+
+    private:
+        std::shared_ptr<const DatabaseWrapper> _dw;     //!< снэпшот, которым открыт поток, nullptr если баз данных не было
+        std::shared_ptr<StreamShared> _shared;          //!< nullptr у закрытого потока
+        std::vector<hs_stream_t *> _streams;            //!< по потоку на шард, пусто пока состояние сжато
+
+        char * _buffer = nullptr;                       //!< сжатое состояние из _shared->pool
+        size_t _capacity = 0;
+        size_t _stateBytes = 0;                         //!< несжатое состояние, hs_stream_size по шардам
+
+        Clock::time_point _lastActive;
+    };
+
+    /**
+      * @brief ~HyperscanWrapper удаляет все паттерны которые были скопированны во время добавления
+      */
+    ~HyperscanWrapper() {
+        // the background build uses the members below
+        _scheduler.reset();
+
+        for (char* c: _patterns) {
+            delete[] c;
+        }
+    }
+
+    /**
+     * @brief компилирует все добавленные паттерны, обязательно вызывать после HyperscanWrapper::Insert и HyperscanWrapper::Delete
+     *
+     *   Компилирует копию паттернов, поэтому Insert и Delete из других потоков не ждут окончания сборки. <br>
+     * Если собрано с HYPERSCAN_CHIMERA (CHIMERA=y в cmake), паттерн, который не принял \a %Hyperscan <br>
+     * (обратные ссылки, lookaround), но принимает PCRE, компилируется в отдельную базу Chimera, <br>
+     * остальные шарды не перекомпилируются. Такие паттерны не поддерживают Publish, а в текстах <br>
+     * длиннее MAX_SCAN_LENGTH не находятся совпадения, пересекающие границу окна.
+     *
+     * @remark thread-safe, одновременные вызовы выполняются по очереди
+     * @param[out] error указатель на класс ошибки, здесь бывают осмысленные ошибки вида "неправильный паттерн"
+     * @return true - в случае успеха, false - в случае ошибки подробности в переменной \a error
+     */
+    bool Build(Error * error = nullptr) {
+        std::lock_guard<std::mutex> buildLock(_buildMutex);
+
+        // the staging area is copied, so that producers are not blocked while shards compile
+        Staged staged;
+        DataStore<DataT> data;
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(_stagingMutex);
+
+            staged.patterns.resize(_patterns.size());
+            staged.live.resize(_patterns.size());
+            for (size_t i = 0; i < _patterns.size(); ++i) {
+                staged.live[i] = _patterns[i] != nullptr;
+                if (staged.live[i]) staged.patterns[i].assign(_patterns[i], _patternLengths[i]);
+            }
+
+            staged.group = _slotGroup;
+            staged.groupNames = _groupNames;
+            // shares the chunks, Insert copies a chunk before writing to it
+            data = _data;
+            generation = _generation;
+
+#ifdef HYPERSCAN_CHIMERA
+            staged.fallback.assign(_fallbackSlots.begin(), _fallbackSlots.end());
+            for (size_t slot: staged.fallback) {
+                staged.live[slot] = false;
+            }
+#endif
+
+            if (_skipInvalid) {
+                staged.invalid = _invalidSlots;
+                for (auto& invalid: staged.invalid) {
+                    staged.live[invalid.first] = false;
+                }
+            }
+        }
+
+        Error local_error;
+        std::shared_ptr<DatabaseWrapper> dw;
+        std::vector<std::shared_ptr<const Shard>> shards;
+
+        bool empty = std::find(staged.live.begin(), staged.live.end(), true) == staged.live.end();
+#ifdef HYPERSCAN_CHIMERA
+        empty = empty && staged.fallback.empty();
+#endif
+        empty = empty && staged.invalid.empty();
+
+        std::vector<InvalidPattern> skipped;
+        std::shared_ptr<DatabaseWrapper> old;
+
+        if (!empty) {
+            std::shared_ptr<const Shard> failed;
+
+            // the shards compiled so far are in the cache, so a retry compiles only the failed one again
+            while (!BuildShards(staged, shards, &local_error, &failed)) {
+                if (!failed || !ExcludeInvalid(staged, *failed, &local_error)) {
+                    return BuildFailed(generation, local_error, error);
+                }
+
+                shards.clear();
+                failed.reset();
+                local_error = Error();
+            }
+
+            for (auto& invalid: staged.invalid) {
+                size_t slot = invalid.first;
+                skipped.push_back(InvalidPattern{slot, staged.groupNames[staged.group[slot]], staged.patterns[slot],
+                                                 data[slot], invalid.second});
+            }
+
+            std::sort(skipped.begin(), skipped.end(), [](const InvalidPattern& a, const InvalidPattern& b) {
+                return a.id < b.id;
+            });
+
+            dw = std::make_shared<DatabaseWrapper>(shards, std::move(data), &local_error);
+
+#ifdef HYPERSCAN_CHIMERA
+            if (!local_error.GetErrorCode() && !staged.fallback.empty() && !BuildChimera(staged, *dw, &local_error)) {
+                return BuildFailed(generation, local_error, error);
+            }
+#endif
+
+            if (local_error.GetErrorCode() || (_numaReplicas && !MakeNumaReplicas(*dw, &local_error))) {
+                return BuildFailed(generation, local_error, error);
+            }
+
+            if (_streaming && !PrepareStreams(*dw, &local_error)) {
+                return BuildFailed(generation, local_error, error);
+            }
+
+            Prefault(*dw);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_stagingMutex);
+
+            // revokes that happened while compiling are not in the copy, apply them before readers see the snapshot
+            _revoked.erase(std::remove_if(_revoked.begin(), _revoked.end(), [generation](const Revoked& r) {
+                return r.generation <= generation;
+            }), _revoked.end());
+
+            for (const Revoked& r: _revoked) {
+                if (dw) RevokeInSnapshot(*dw, r.slot, r.pattern, r.data);
+            }
+
+            // the next Build does not try hyperscan on these rules again, unless the slot got another pattern meanwhile
+#ifdef HYPERSCAN_CHIMERA
+            for (size_t slot: staged.fallback) {
+                if (_patterns[slot] && PatternAt(slot) == staged.patterns[slot]) _fallbackSlots.insert(slot);
+            }
+#endif
+
+            for (auto& invalid: staged.invalid) {
+                if (_patterns[invalid.first] && PatternAt(invalid.first) == staged.patterns[invalid.first]) {
+                    _invalidSlots.insert(invalid);
+                }
+            }
+
+            _skipped = std::move(skipped);
+
+            // only swapped here, waiting for the readers of the old snapshot would hold up Insert and Revoke
+            old = _dw.Exchange(dw);
+        }
+
+        _dw.Reclaim(std::move(old));
+
+        // keep only the shards of the current snapshot, so that the cache does not grow with every rule push
+        _shardCache.clear();
+        for (auto& shard: shards) {
+            _shardCache[shard->hash] = shard;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_generationMutex);
+            _builtGeneration = std::max(_builtGeneration, generation);
+        }
+        _generationCv.notify_all();
+
+        return true;
+    }
+
+    /**
+     * @brief собирает много экземпляров параллельно, например при старте сервиса с отдельным экземпляром на клиента
+     *
+     *   У экземпляров нет общего изменяемого состояния, поэтому их Build можно выполнять одновременно. <br>
+     * Экземпляры раздаются потокам по одному, каждый собирается своими SetBuildThreads потоками.
+     *
+     * @param[in] wrappers экземпляры, каждый встречается один раз
+     * @param[in] threads кол-во потоков, 0 - std::thread::hardware_concurrency()
+     * @param[out] errors если не nullptr, сюда записываются ошибки Build по индексу экземпляра
+     * @return true если собрались все экземпляры
+     */
+    static bool BuildAll(const std::vector<HyperscanWrapper *>& wrappers, size_t threads = 0, std::vector<Error> * errors = nullptr) {
+        if (!threads) threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+        std::vector<Error> local_errors(wrappers.size());
+        std::atomic<bool> ok(true);
+
+        ParallelFor(wrappers.size(), threads, [&](size_t i) {
+            if (!wrappers[i]->Build(&local_errors[i])) ok = false;
+        });
+
+        if (errors) *errors = std::move(local_errors);
+        return ok;
+    }
+
+    /**
+     * @brief включает отложенную сборку: InsertAndBuild, DeleteAndBuild и ScheduleBuild не компилируют сами, <br>
+     *        а будят фоновый поток, который собирает последнее состояние
+     *
+     *   Сборка запускается, когда изменений не было \a quiet, но не позже чем через \a maxDelay после первого <br>
+     * несобранного изменения, промежуточные состояния не компилируются. Дождаться, пока изменение станет <br>
+     * видно в Find, можно через WaitForGeneration с поколением, которое вернул ScheduleBuild.
+     *
+     * @remark нельзя вызывать одновременно с изменениями паттернов
+     * @param[in] quiet сколько должно пройти без изменений, 0 и \a maxDelay = 0 - собирать сразу, как раньше
+     * @param[in] maxDelay максимальная задержка после первого изменения
+     */
+    void SetBuildDelay(std::chrono::milliseconds quiet, std::chrono::milliseconds maxDelay) {
+        _scheduler.reset();
+
+        if (quiet.count() > 0 || maxDelay.count() > 0) {
+            _scheduler.reset(new BuildScheduler([this]() { Build(); }, quiet, maxDelay));
+        }
+    }
+
+    /**
+     * @brief просит собрать текущее состояние
+     *
+     *   С SetBuildDelay сборка выполнится в фоне, иначе сразу в вызывающем потоке. <br>
+     * Ошибка сборки возвращается из WaitForGeneration.
+     *
+     * @remark thread-safe
+     * @return поколение текущего состояния: кол-во изменений паттернов на момент вызова
+     */
+    uint64_t ScheduleBuild() {
+        uint64_t generation = Generation();
+
+        if (_scheduler) {
+            _scheduler->Schedule();
+        } else {
+            Build();
+        }
+
+        return generation;
+    }
+
+    /**
+     * @brief ждет, пока Find станет искать по состоянию не старее поколения \a generation
+     *
+     * @remark thread-safe, поколение должно быть запланировано через ScheduleBuild, InsertAndBuild или DeleteAndBuild
+     * @param[in] generation результат ScheduleBuild или Generation
+     * @param[out] error ошибка сборки, если собрать это поколение не удалось
+     * @return true если поколение видно, false если его сборка завершилась ошибкой
+     */
+    bool WaitForGeneration(uint64_t generation, Error * error = nullptr) {
+        if (error) *error = Error();
+
+        std::unique_lock<std::mutex> lock(_generationMutex);
+        _generationCv.wait(lock, [this, generation]() {
+            return _builtGeneration >= generation || _failedGeneration >= generation;
+        });
+
+        if (_builtGeneration >= generation) return true;
+
+        if (error) *error = _buildError;
+        return false;
+    }
+
+    /**
+     * @brief поколение текущего состояния паттернов, увеличивается каждым Insert, Delete и Revoke
+     */
+    uint64_t Generation() const {
+        std::lock_guard<std::mutex> lock(_stagingMutex);
+        return _generation;
+    }
+
+    /**
+     * @brief поколение, по которому сейчас ищет Find
+     */
+    uint64_t BuiltGeneration() const {
+        std::lock_guard<std::mutex> lock(_generationMutex);
+        return _builtGeneration;
+    }
+
+    /**
+     * @brief задает кол-во шардов, на которые раскладываются паттерны при следующих Build
+     *
+     *   Каждый шард компилируется в отдельную базу данных, при пересборке перекомпилируются только шарды, <br>
+     * в которых добавились или удалились паттерны. Чем больше шардов, тем дешевле маленькие изменения, <br>
+     * но тем медленнее Find, которому приходится сканировать текст каждым шардом по очереди.
+     *
+     * @param[in] count кол-во шардов, по умолчанию 1
+     */
+    void SetShardCount(size_t count) {
+        _shardCount = std::max<size_t>(count, 1);
+    }
+
+    /**
+     * @brief задает кол-во потоков, которыми Build компилирует шарды
+     *
+     *   hs_compile_multi однопоточный, поэтому Build с одним шардом занимает одно ядро. <br>
+     * Шарды, которых нет в кэше, раздаются потокам по одному, так что потоков больше, чем SetShardCount, не бывает. <br>
+     * Find сканирует текст каждым шардом по очереди, поэтому за ускорение Build платится скоростью поиска, <br>
+     * см. BM_PARALLEL_BUILD.
+     *
+     * @param[in] threads кол-во потоков, по умолчанию 1 - компилировать в вызывающем потоке
+     */
+    void SetBuildThreads(size_t threads) {
+        _buildThreads = std::max<size_t>(threads, 1);
+    }
+
+    /**
+     * @brief включает кэш скомпилированных шардов на диске
+     *
+     *   Шард сохраняется в файл "<path>/<хеш содержимого>.hsdb" и при следующих Build, в том числе <br>
+     * в другом процессе после перезапуска, загружается оттуда вместо компиляции. <br>
+     * Хеш учитывает версию библиотеки и платформу, так что чужие файлы не подхватываются. <br>
+     * Рядом с базой данных в файле лежат группа, айдишники и паттерны шарда, файл берется, только если <br>
+     * они совпадают, поэтому коллизия хешей (в том числе подобранная) приводит лишь к перекомпиляции.
+     *
+     * @param[in] path существующий каталог, пустая строка - кэшировать только в памяти
+     */
+    void SetShardCacheDirectory(const std::string& path) {
+        _shardCacheDirectory = path;
+    }
+
+    /**
+     * @brief возвращает кол-во шардов, скомпилированных последним Build, остальные были взяты из кэша
+     */
+    size_t CompiledShardCount() const {
+        return _compiledShards.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief включает пропуск паттернов, которые не компилируются
+     *
+     *   Build без этой опции падает на первом неправильном паттерне. С ней неправильные паттерны <br>
+     * исключаются из сборки, остальные компилируются как обычно, а список исключенных возвращает SkippedPatterns. <br>
+     * Исключенный паттерн запоминается и больше не компилируется, пока его не удалят через Delete.
+     *
+     * @param[in] skip по умолчанию false
+     */
+    void SetSkipInvalidPatterns(bool skip) {
+        _skipInvalid = skip;
+    }
+
+    /**
+     * @brief возвращает паттерны, пропущенные последним успешным Build, по возрастанию айдишника
+     * @see SetSkipInvalidPatterns
+     */
+    std::vector<InvalidPattern> SkippedPatterns() const {
+        // not _buildMutex, which is held for the whole compilation
+        std::lock_guard<std::mutex> lock(_stagingMutex);
+        return _skipped;
+    }
+
+    /**
+     * @brief проверяет все добавленные паттерны по отдельности и возвращает все ошибки, а не только первую, как Build
+     *
+     *   Каждый паттерн разбирается через hs_expression_info и компилируется отдельно, <br>
+     * паттерны раздаются \a threads потокам. Снэпшот, по которому ищет Find, не меняется. <br>
+     * С HYPERSCAN_CHIMERA паттерн, который примет Chimera, считается правильным.
+     *
+     * @remark thread-safe
+     * @param[in] threads кол-во потоков, 0 - std::thread::hardware_concurrency()
+     * @return неправильные паттерны по возрастанию айдишника, пусто, если все компилируются
+     */
+    std::vector<InvalidPattern> Validate(size_t threads = 0) const {
+        if (!threads) threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+        std::vector<InvalidPattern> candidates;
+        {
+            std::lock_guard<std::mutex> lock(_stagingMutex);
+
+            for (size_t i = 0; i < _patterns.size(); ++i) {
+                if (_patterns[i]) {
+                    candidates.push_back(InvalidPattern{i, _groupNames[_slotGroup[i]], PatternAt(i).ToString(), _data[i], std::string()});
+                }
+            }
+        }
+
+        ParallelFor(candidates.size(), threads, [&](size_t i) {
+            candidates[i].message = CheckPattern(candidates[i].pattern);
+#ifdef HYPERSCAN_CHIMERA
+            if (!candidates[i].message.empty() && ChimeraDatabase::Accepts(candidates[i].pattern)) {
+                candidates[i].message.clear();
+            }
+#endif
+        });
+
+        std::vector<InvalidPattern> res;
+        for (InvalidPattern& candidate: candidates) {
+            if (!candidate.message.empty()) res.push_back(std::move(candidate));
+        }
+
+        return res;
+    }
+
+    /**
+     * @brief включает размещение реплики базы данных, данных и scratch на каждом узле NUMA при следующих Build
+     *
+     *   Find берет реплику узла, на котором выполняется вызывающий поток, и не ходит за базой данных <br>
+     * через межпроцессорную шину. Память растет пропорционально кол-ву узлов, на машине с одним узлом ничего не меняется.
+     *
+     * @param[in] enabled true - создавать реплики
+     */
+    void SetNumaReplicas(bool enabled) {
+        _numaReplicas = enabled;
+    }
+
+    /**
+     * @brief включает компиляцию потоковых баз данных в Build
+     *
+     *   Без этой опции потоковые базы шардов компилируются при первом OpenStream после каждого Build, <br>
+     * и все, кто в это время открывает потоки (например FlowTable на пути пакетов), ждут компиляции. <br>
+     * С ней Build и Refresh готовят потоковые базы до того, как снэпшот увидят читатели, так что OpenStream <br>
+     * не компилирует. Неизменившиеся шарды берутся из кэша вместе со своей потоковой базой.
+     *
+     * @param[in] enabled true - компилировать потоковые базы в Build, применяется со следующего Build
+     */
+    void SetStreaming(bool enabled) {
+        _streaming = enabled;
+    }
+
+    /**
+     * @brief открывает поток на текущем снэпшоте
+     *
+     *   Потоковые базы данных шардов общие для всех потоков снэпшота. Без SetStreaming они компилируются <br>
+     * при первом обращении после Build, и вызов ждет компиляции.
+     *
+     * @remark thread-safe
+     * @param[out] error может быть записано ErrorCode::BUILD_ERROR или ErrorCode::NO_MEMORY
+     * @return открытый поток, закрытый в случае ошибки
+     */
+    Stream OpenStream(Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        Stream stream;
+        Snapshot dw = GetDatabase();
+
+        if (dw && !dw->shards.empty()) {
+            if (!dw->PrepareStream(error)) return stream;
+
+            for (auto& shard: dw->shards) {
+                hs_stream_t * s = nullptr;
+                size_t size = 0;
+
+                if (hs_open_stream(shard->streamDb, 0, &s) != HS_SUCCESS) {
+                    if (error) *error = Error(ErrorCode::NO_MEMORY);
+                    return stream;
+                }
+
+                stream._streams.push_back(s);
+
+                if (hs_stream_size(shard->streamDb, &size) == HS_SUCCESS) stream._stateBytes += size;
+            }
+
+            stream._dw = dw.Share();
+        }
+
+        stream._shared = _streamShared;
+        stream._lastActive = Stream::Clock::now();
+
+        ++_streamShared->liveStreams;
+        _streamShared->liveBytes += stream._stateBytes;
+
+        return stream;
+    }
+
+    /**
+     * @brief открыт ли \a stream на снэпшоте, который уже заменил Build
+     * @remark thread-safe
+     */
+    bool IsStale(const Stream& stream) const {
+        Snapshot dw = GetDatabase();
+        return stream._dw.get() != dw.Get();
+    }
+
+    /**
+     * @brief задает, через сколько простоя Stream::CompressIfIdle сжимает поток
+     * @param[in] timeout 0 - не сжимать, по умолчанию
+     */
+    void SetStreamIdleTimeout(std::chrono::milliseconds timeout) {
+        _streamShared->idleTimeoutMs = timeout.count();
+    }
+
+    /**
+     * @brief включает нормализацию текста перед поиском, см. Normalizer
+     *
+     *   Текст нормализуется в буфер своего потока исполнения, который переиспользуется между вызовами, <br>
+     * поэтому паттерны пишутся под нормализованный текст. Применяется в Find, FindIds, FindMatches и Count, <br>
+     * FindMatches переводит позиции совпадений в смещения в исходном тексте. Потоки (OpenStream) <br>
+     * и FindInFile сканируют текст как есть. После поиска буфер больше NORMALIZER_RETAINED отдается.
+     *
+     * @remark thread-safe
+     * @param[in] steps комбинация Normalizer::Step, 0 - без нормализации, по умолчанию
+     */
+    void SetNormalization(unsigned steps) {
+        _normalization.store(steps, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief шаги нормализации, см. SetNormalization
+     */
+    unsigned GetNormalization() const {
+        return _normalization.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief возвращает память открытых потоков: несжатых, сжатых и пула сжатых состояний
+     * @remark thread-safe
+     */
+    StreamStats GetStreamStats() const {
+        StreamStats stats;
+        stats.liveStreams = _streamShared->liveStreams;
+        stats.liveBytes = _streamShared->liveBytes;
+        stats.compressedStreams = _streamShared->compressedStreams;
+        stats.compressedBytes = _streamShared->compressedBytes;
+        stats.poolBytes = _streamShared->pool.ReservedBytes();
+
+        Snapshot dw = GetDatabase();
+        stats.streamsReady = dw && dw->StreamReady();
+
+        return stats;
+    }
+
+    /**
+     * @brief возвращает размер баз данных текущего снэпшота в байтах: блочных баз шардов и базы Chimera
+     *
+     *   Потоковые базы (при первом OpenStream или в Build, см. SetStreaming) не учитываются. До первого Build - 0.
+     *
+     * @remark thread-safe
+     */
+    size_t DatabaseSize() const {
+        Snapshot dw = GetDatabase();
+        if (!dw) return 0;
+
+        size_t res = 0;
+        size_t size;
+
+        for (auto& shard: dw->shards) {
+            if (hs_database_size(shard->db, &size) == HS_SUCCESS) res += size;
+        }
+
+#ifdef HYPERSCAN_CHIMERA
+        if (dw->chimera && ch_database_size(dw->chimera->db, &size) == CH_SUCCESS) res += size;
+#endif
+
+        return res;
+    }
+
+    /**
+     * @brief возвращает текущее кол-во паттернов
+     */
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(_stagingMutex);
+        return _patterns.size() - _free.size();
+    }
+
+    /**
+     * @see Insert(const char *, size_t, DataT, Error *)
+     */
+    bool Insert(StringView pattern, DataT data, Error * error = nullptr) {
+        return Insert(pattern.data(), pattern.size(), std::move(data), error);
+    }
+
+    /**
+     * @brief добавляет (паттерн, данные), необходимо после вызвать HyperscanWrapper::Build.
+     *
+     *   Можно добавлять один и тот же паттерн с разными данными все они будут возвращены в случае успеха <br>
+     * например: Insert("bomba", 1) -> Insert("bomba", 2) -> Build() -> Find("bomba") -> {1, 2} <br> <br>
+     * можно добавлять разные паттерны с одинаковыми айдишниками, но после файнда они будут не различимы <br>
+     * например: Insert("bomba", 1) -> Insert("Putin", 1) -> Build() -> Find("bomba Putin") -> {1, 1} <br> <br>
+     * в случае:  Insert("bomba", 1) -> Insert("bomba", 1) -> ErrorCode::PATTERN_AND_DATA_IN_USE <br>
+     * Паттерн попадает в группу по умолчанию с пустым именем.
+     *
+     * @remark thread-safe, можно вызывать одновременно с Build
+     * @param[in] pattern указатель на начало паттерна
+     * @param[in] len  длина паттерна
+     * @param[in] data данные которые будут возвращены, если данный паттерн сматчился в тексте,
+     *            передаются по значению, чтобы временные объекты перемещались без копирования
+     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_IN_USE
+     * @return true в случае успеха, false в случае неудачи смотри \a error
+     */
+    virtual bool Insert(const char *pattern, size_t len, DataT data, Error * error = nullptr) {
+        return InsertIntoGroup(std::string(), pattern, len, std::move(data), error);
+    }
+
+    /**
+     * @see Insert(const std::string &, const char *, size_t, DataT, Error *)
+     */
+    bool Insert(const std::string &group, StringView pattern, DataT data, Error * error = nullptr) {
+        return Insert(group, pattern.data(), pattern.size(), std::move(data), error);
+    }
+
+    /**
+     * @brief добавляет (паттерн, данные) в именованную группу, например группу правил одного клиента
+     *
+     *   Каждая группа компилируется в свои шарды, Find(const char *, size_t, const std::vector<std::string> &, Error *) const <br>
+     * сканирует текст только базами данных выбранных групп и возвращает ответ по группам. <br>
+     * Одна и та же пара (паттерн, данные) может быть в нескольких группах.
+     *
+     * @remark thread-safe, можно вызывать одновременно с Build
+     * @param[in] group имя группы
+     * @see Insert(const char *, size_t, DataT, Error *)
+     */
+    virtual bool Insert(const std::string &group, const char *pattern, size_t len, DataT data, Error * error = nullptr) {
+        return InsertIntoGroup(group, pattern, len, std::move(data), error);
+    }
+
+    /**
+     * @see Delete(const char *, size_t, const DataT&, Error *)
+     */
+    bool Delete(StringView pattern, const DataT& data, Error * error = nullptr) {
+        return Delete(pattern.data(), pattern.size(), data, error);
+    }
+
+    /**
+     * @brief удаляет (паттерн, данные) из группы по умолчанию, необходимо после вызвать HyperscanWrapper::Build.
+     *
+     *   В случае:  Insert("bomba", 1) -> Delete("bomba", 1) -> Delete("bomba", 1) -> ErrorCode::PATTERN_AND_DATA_NOT_FOUND
+     * @remark thread-safe, можно вызывать одновременно с Build
+     * @param[in] pattern указатель на начало паттерна
+     * @param[in] len  длина паттерна
+     * @param[in] data данные которые будут возвращены, если данный паттерн сматчился в тексте
+     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_IN_USE
+     * @return true в случае успеха, false в случае неудачи смотри \a error
+     */
+    virtual bool Delete(const char *pattern, size_t len, const DataT& data, Error * error = nullptr) {
+        return DeleteFromGroup(std::string(), pattern, len, data, error);
+    }
+
+    /**
+     * @see Delete(const std::string &, const char *, size_t, const DataT&, Error *)
+     */
+    bool Delete(const std::string &group, StringView pattern, const DataT& data, Error * error = nullptr) {
+        return Delete(group, pattern.data(), pattern.size(), data, error);
+    }
+
+    /**
+     * @brief удаляет (паттерн, данные) из группы \a group
+     * @see Delete(const char *, size_t, const DataT&, Error *)
+     */
+    virtual bool Delete(const std::string &group, const char *pattern, size_t len, const DataT& data, Error * error = nullptr) {
+        return DeleteFromGroup(group, pattern, len, data, error);
+    }
+
+    /**
+     * @see Revoke(const char *, size_t, const DataT&, Error *)
+     */
+    bool Revoke(StringView pattern, const DataT& data, Error * error = nullptr) {
+        return Revoke(pattern.data(), pattern.size(), data, error);
+    }
+
+    /**
+     * @brief удаляет (паттерн, данные) и сразу перестает их находить, не дожидаясь Build
+     *
+     *   Делает Delete и помечает айдишник паттерна отозванным в текущем снэпшоте (и его репликах на узлах NUMA): <br>
+     * Find, начатые после возврата из Revoke, не вернут эти данные. Скомпилированная база данных не меняется, <br>
+     * паттерн продолжает сканироваться, пока следующий Build не уберет его окончательно, <br>
+     * поэтому отзыв - это поиск слота по хешу паттерна и установка бита, без компиляции.
+     *
+     * @remark thread-safe, можно вызывать одновременно с Build
+     * @param[in] pattern указатель на начало паттерна
+     * @param[in] len  длина паттерна
+     * @param[in] data данные, переданные в Insert
+     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_NOT_FOUND
+     * @return true в случае успеха, false в случае неудачи смотри \a error
+     */
+    bool Revoke(const char *pattern, size_t len, const DataT& data, Error * error = nullptr) {
+        return Revoke(std::string(), pattern, len, data, error);
+    }
+
+    /**
+     * @see Revoke(const std::string &, const char *, size_t, const DataT&, Error *)
+     */
+    bool Revoke(const std::string &group, StringView pattern, const DataT& data, Error * error = nullptr) {
+        return Revoke(group, pattern.data(), pattern.size(), data, error);
+    }
+
+    /**
+     * @brief отзывает (паттерн, данные) из группы \a group
+     * @see Revoke(const char *, size_t, const DataT&, Error *)
+     */
+    virtual bool Revoke(const std::string &group, const char *pattern, size_t len, const DataT& data, Error * error = nullptr) {
+        if (error) *error = Error();
+
+        std::lock_guard<std::mutex> lock(_stagingMutex);
+
+        size_t slot = FindSlot(group, StringView(pattern, len), data);
+        if (!EraseSlot(slot, error)) return false;
+
+        // a Build that copied the patterns before this call applies the revoke to its snapshot too
+        _revoked.push_back(Revoked{slot, std::string(pattern, len), data, _generation});
+
+        std::shared_ptr<DatabaseWrapper> dw = _dw.Get();
+
+        if (dw) RevokeInSnapshot(*dw, slot, StringView(pattern, len), data);
+
+        // attached processes read the tombstones of the published snapshot straight from its segment
+        if (_publishedDw && RevokeInSnapshot(*_publishedDw, slot, StringView(pattern, len), data)) {
+            const SharedHeader * header = reinterpret_cast<const SharedHeader *>(_publishedSegment->Data());
+            std::atomic<uint64_t> * dead = reinterpret_cast<std::atomic<uint64_t> *>(_publishedSegment->Data() + header->deadOffset);
+
+            dead[slot / 64].fetch_or(uint64_t(1) << (slot % 64), std::memory_order_release);
+        }
+
+        return true;
+    }
+
+    /**
+     * @see InsertAndBuild(char const *, size_t, DataT, Error *)
+     */
+    bool InsertAndBuild(StringView pattern, DataT data, Error * error = nullptr) {
+        return InsertAndBuild(pattern.data(), pattern.size(), std::move(data), error);
+    }
+
+    /**
+     * @brief Insert + Build, с SetBuildDelay - Insert + ScheduleBuild
+     * @param[in] pattern указатель на начало паттерна
+     * @param[in] len  длина паттерна
+     * @param[in] data данные которые будут возвращены, если данный паттерн сматчился в тексте
+     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_IN_USE или ErrorCode::BUILD_ERROR
+     * @return true в случае успеха, false в случае неудачи смотри \a error
+     */
+    bool InsertAndBuild(char const * pattern, size_t len, DataT data, Error * error = nullptr) {
+        return Insert(pattern, len, std::move(data), error) && BuildOrSchedule(error);
+    }
+
+    /**
+     * @see DeleteAndBuild(char const *, size_t, const DataT&, Error *)
+     */
+    bool DeleteAndBuild(StringView pattern, const DataT& data, Error * error = nullptr) {
+        return DeleteAndBuild(pattern.data(), pattern.size(), data, error);
+    }
+
+    /**
+     * @brief Delete + Build, с SetBuildDelay - Delete + ScheduleBuild
+     * @param[in] pattern указатель на начало паттерна
+     * @param[in] len  длина паттерна
+     * @param[in] data данные которые будут возвращены, если данный паттерн сматчился в тексте
+     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_NOT_FOUND или ErrorCode::BUILD_ERROR
+     * @return true в случае успеха, false в случае неудачи смотри \a error
+     */
+    bool DeleteAndBuild(char const * pattern, size_t len, const DataT& data, Error * error = nullptr) {
+        return Delete(pattern, len, data, error) && BuildOrSchedule(error);
+    }
+
+    /**
+     * @see Find(const char *, size_t, Error *) const
+     */
+    std::vector<DataT> Find(StringView text, Error * error = nullptr) const {
+        return Find(text.data(), text.size(), error);
+    }
+
+    /**
+     * @brief Find ищет в тексте добавленные паттерны
+     *
+     *   Каждый раз копирует указатель на текущее состояние = DatabaseWrapper <br>
+     * клонирует необходимую память, которую он будет изменять в ходе поиска <br>
+     * создает контекст с указателем на ответ и пользовательские данные
+     * который будет передаваться в callback(FindHandler) вызываемый из hs_scan <br>
+     * Длина текста не ограничена: тексты длиннее 4 Гб (предел hs_scan) сканируются <br>
+     * потоковой базой данных по кусочкам, см. ScanBuffer
+     *
+     * @remark thread-safe, multiple readers
+     * @param[in] text указатель на начало текста
+     * @param[in] len  длина текста
+     * @param[out] error может быть записано ErrorCode::SCAN_ERROR
+     * @return вектор данных соответствующих паттернам которые сматчились во время поиска
+     */
+    std::vector<DataT> Find(const char *text, size_t len, Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        Snapshot dw = GetDatabase();
+
+        std::vector<DataT> res;
+        if (!dw) return res;
+
+        NormalizedText normalized(*this, text, len);
+
+        Context ctx{&res, &dw->data, dw->dead};
+        ScanBuffer(*dw, text, len, FindHandler, (void*) &ctx, error);
+
+        return res;
+    }
+
+    /**
+     * @brief Find, который добавляет ответ в \a res и сканирует scratch'ем \a scratch, не клонируя его
+     *
+     *   Для потоков, которые ищут постоянно, например рабочих потоков AsyncScanner: у каждого свой Scratch <br>
+     * и свой переиспользуемый \a res, поэтому поиск не выделяет память.
+     *
+     * @remark thread-safe, если у каждого потока свой \a scratch
+     * @see Find(const char *, size_t, Error *) const
+     */
+    void Find(const char *text, size_t len, std::vector<DataT> &res, Scratch &scratch, Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        Snapshot dw = GetDatabase();
+        if (!dw) return;
+
+        NormalizedText normalized(*this, text, len);
+
+        hs_scratch_t * s = nullptr;
+        if (!dw->shards.empty() && !(s = scratch.FitBlock(dw, error))) return;
+
+        Context ctx{&res, &dw->data, dw->dead};
+        ScanBuffer(*dw, dw->allShards, text, len, FindHandler, (void*) &ctx, error, s);
+    }
+
+    /**
+     * @see FindIds(const char *, size_t, MatchSet &, Error *) const
+     */
+    void FindIds(StringView text, MatchSet &res, Error * error = nullptr) const {
+        FindIds(text.data(), text.size(), res, error);
+    }
+
+    /**
+     * @brief ищет в тексте добавленные паттерны и записывает в \a res айдишники сматчившихся
+     *
+     *   В отличии от Find не копирует DataT и не выделяет память на каждое совпадение: <br>
+     * \a res очищается и переиспользуется, данные достаются через MatchSet::Resolve.
+     *
+     * @remark thread-safe, multiple readers, \a res свой у каждого потока
+     * @param[in] text указатель на начало текста
+     * @param[in] len  длина текста
+     * @param[out] res айдишники сматчившихся паттернов
+     * @param[out] error может быть записано ErrorCode::SCAN_ERROR
+     */
+    void FindIds(const char *text, size_t len, MatchSet &res, Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        Snapshot dw = GetDatabase();
+
+        res._dw = dw ? dw.Share() : nullptr;
+        res.Reset(dw ? dw->data.Size() : 0);
+        if (!dw) return;
+
+        NormalizedText normalized(*this, text, len);
+
+        MatchSetContext ctx{&res, dw->dead};
+        ScanBuffer(*dw, text, len, FindIdsHandler, (void*) &ctx, error);
+    }
+
+    /**
+     * @see Count(const char *, size_t, MatchHistogram &, Scratch &, Error *) const
+     */
+    void Count(StringView text, MatchHistogram &res, Scratch &scratch, Error * error = nullptr) const {
+        Count(text.data(), text.size(), res, scratch, error);
+    }
+
+    /**
+     * @brief ищет в тексте добавленные паттерны и прибавляет совпадения к счетчикам \a res
+     *
+     *   Режим подсчета для больших корпусов: ответ на каждый текст не создается, <br>
+     * совпадения считаются прямо в callback. Каждый поток копит свою гистограмму со своим \a scratch, <br>
+     * в конце гистограммы складываются через MatchHistogram::Merge.
+     *
+     * @remark thread-safe, если у каждого потока свои \a res и \a scratch
+     * @param[in] text указатель на начало текста
+     * @param[in] len  длина текста
+     * @param[in,out] res счетчики, к которым прибавляются совпадения
+     * @param[in] scratch scratch потока
+     * @param[out] error может быть записано ErrorCode::SCAN_ERROR или ErrorCode::NO_MEMORY
+     */
+    void Count(const char *text, size_t len, MatchHistogram &res, Scratch &scratch, Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        // the histogram counts the bytes of the original documents
+        size_t original = len;
+        Snapshot dw = GetDatabase();
+        if (!dw) return;
+
+        NormalizedText normalized(*this, text, len);
+
+        hs_scratch_t * s = nullptr;
+        if (!dw->shards.empty() && !(s = scratch.FitBlock(dw, error))) return;
+
+        res.Start(dw.Share(), original);
+
+        HistogramContext ctx{&res, dw->dead, original};
+        ScanBuffer(*dw, dw->allShards, text, len, CountHandler, (void*) &ctx, error, s);
+    }
+
+    /**
+     * @see PatternId(const std::string &, const char *, size_t, const DataT&, size_t *, Error *) const
+     */
+    bool PatternId(StringView pattern, const DataT& data, size_t * id, Error * error = nullptr) const {
+        return PatternId(std::string(), pattern.data(), pattern.size(), data, id, error);
+    }
+
+    /**
+     * @brief айдишник пары (паттерн, данные) для PatternMask
+     *
+     *   Айдишник выдается в Insert и не меняется, пока пару не удалят, поэтому маски <br>
+     * можно собрать один раз, например на каждую категорию правил, и переиспользовать между Build.
+     *
+     * @remark thread-safe
+     * @param[in] group имя группы, в которую добавлена пара
+     * @param[in] pattern указатель на начало паттерна
+     * @param[in] len  длина паттерна
+     * @param[in] data данные, переданные в Insert
+     * @param[out] id айдишник паттерна
+     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_NOT_FOUND
+     * @return true в случае успеха, false в случае неудачи смотри \a error
+     */
+    virtual bool PatternId(const std::string &group, const char *pattern, size_t len, const DataT& data, size_t * id,
+                           Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        std::lock_guard<std::mutex> lock(_stagingMutex);
+
+        size_t slot = FindSlot(group, StringView(pattern, len), data);
+        if (slot == NO_SLOT) {
+            if (error) *error = Error(ErrorCode::PATTERN_AND_DATA_NOT_FOUND, StringView(pattern, len));
+            return false;
+        }
+
+        *id = slot;
+        return true;
+    }
+
+    /**
+     * @see Find(const char *, size_t, const PatternMask &, Error *) const
+     */
+    std::vector<DataT> Find(StringView text, const PatternMask &enabled, Error * error = nullptr) const {
+        return Find(text.data(), text.size(), enabled, error);
+    }
+
+    /**
+     * @brief ищет в тексте только паттерны, включенные в \a enabled
+     *
+     *   Совпадения выключенных паттернов отбрасываются в callback, база данных одна на все маски. <br>
+     * Паттерны компилируются с HS_FLAG_SINGLEMATCH, поэтому каждый включенный паттерн сообщает <br>
+     * не больше одного совпадения, и сканирование останавливается, как только сматчились все включенные.
+     *
+     * @remark thread-safe, multiple readers
+     * @param[in] text указатель на начало текста
+     * @param[in] len  длина текста
+     * @param[in] enabled айдишники включенных паттернов, см. PatternId
+     * @param[out] error может быть записано ErrorCode::SCAN_ERROR
+     * @return вектор данных соответствующих включенным паттернам которые сматчились во время поиска
+     */
+    std::vector<DataT> Find(const char *text, size_t len, const PatternMask &enabled, Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        Snapshot dw = GetDatabase();
+
+        std::vector<DataT> res;
+        if (!dw) return res;
+
+        NormalizedText normalized(*this, text, len);
+
+        const std::vector<uint64_t>& words = enabled.Words();
+        size_t remaining = 0;
+
+        for (size_t i = 0; i < std::min(words.size(), dw->live.size()); ++i) {
+            uint64_t alive = dw->live[i] & ~dw->dead[i].load(std::memory_order_acquire);
+            remaining += __builtin_popcountll(words[i] & alive);
+        }
+
+        if (!remaining) return res;
+
+        MaskContext ctx{&res, &dw->data, dw->dead, &enabled, remaining, PatternMask(dw->data.Size())};
+        ScanBuffer(*dw, text, len, FindMaskHandler, (void*) &ctx, error);
+
+        return res;
+    }
+
+    /**
+     * @see Find(const char *, size_t, const std::vector<std::string> &, Error *) const
+     */
+    std::map<std::string, std::vector<DataT>> Find(StringView text, const std::vector<std::string> &groups,
+                                                    Error * error = nullptr) const {
+        return Find(text.data(), text.size(), groups, error);
+    }
+
+    /**
+     * @brief ищет в тексте паттерны только из групп \a groups, см. Insert(const std::string &, const char *, size_t, DataT, Error *)
+     *
+     *   Текст сканируется только базами данных выбранных групп, по одной на шард группы, <br>
+     * с одним scratch на все группы, поэтому стоимость поиска зависит от размера выбранных групп, <br>
+     * а не от всех добавленных паттернов.
+     *
+     * @remark thread-safe, multiple readers
+     * @param[in] text указатель на начало текста
+     * @param[in] len  длина текста
+     * @param[in] groups имена групп, группа по умолчанию - пустая строка
+     * @param[out] error может быть записано ErrorCode::SCAN_ERROR
+     * @return данные сматчившихся паттернов по имени группы, для каждой запрошенной группы есть запись,
+     *         у неизвестных групп она пустая
+     */
+    std::map<std::string, std::vector<DataT>> Find(const char *text, size_t len, const std::vector<std::string> &groups,
+                                                    Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        std::map<std::string, std::vector<DataT>> res;
+        for (const std::string& group: groups) {
+            res[group];
+        }
+
+        Snapshot dw = GetDatabase();
+        if (!dw) return res;
+
+        NormalizedText normalized(*this, text, len);
+
+        std::vector<std::vector<DataT> *> out(dw->groupShards.size(), nullptr);
+        std::vector<const Shard *> shards;
+
+        for (auto& r: res) {
+            auto it = dw->groupIndex.find(r.first);
+            if (it == dw->groupIndex.end()) continue;
+
+            out[it->second] = &r.second;
+            shards.insert(shards.end(), dw->groupShards[it->second].begin(), dw->groupShards[it->second].end());
+        }
+
+        GroupContext ctx{&out, &dw->data, dw->dead, &dw->groupOf};
+        ScanBuffer(*dw, shards, text, len, FindGroupHandler, (void*) &ctx, error);
+
+        return res;
+    }
+
+    /**
+     * @see Find(const char *, size_t, const FindOptions &, Error *) const
+     */
+    FindResult Find(StringView text, const FindOptions &options, Error * error = nullptr) const {
+        return Find(text.data(), text.size(), options, error);
+    }
+
+    /**
+     * @brief Find с ограничением кол-ва совпадений и времени поиска
+     *
+     *   Callback останавливает сканирование на совпадении сверх options.maxMatches, тогда ответ обрезан, <br>
+     * или, проверяя часы раз в DEADLINE_CHECK_PERIOD совпадений, после options.deadline. Так как текст <br>
+     * без совпадений callback не вызывает, с deadline текст длиннее options.sliceLength сканируется <br>
+     * потоковыми базами кусками, deadline проверяется между кусками и между шардами. Поиск их не компилирует: <br>
+     * пока потоковые базы не готовы (см. SetStreaming), текст сканируется блочными базами кусками по MAX_SCAN_LENGTH, <br>
+     * deadline проверяется между кусками, между шардами и в callback, а совпадения, пересекающие границу куска, <br>
+     * не находятся. Паттерны Chimera проверяют deadline только в callback.
+     *
+     * @remark thread-safe, multiple readers
+     * @param[in] text указатель на начало текста
+     * @param[in] len  длина текста
+     * @param[in] options ограничения
+     * @param[out] error может быть записано ErrorCode::SCAN_ERROR или ErrorCode::NO_MEMORY
+     * @return данные сматчившихся паттернов и то, полный ли ответ
+     */
+    FindResult Find(const char *text, size_t len, const FindOptions &options, Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        FindResult res;
+
+        Snapshot dw = GetDatabase();
+        if (!dw) return res;
+
+        NormalizedText normalized(*this, text, len);
+
+        BoundedContext ctx{&res, &dw->data, dw->dead, &options, 0};
+        if (ctx.Expired()) return res;
+
+        ScanBounded(*dw, text, len, ctx, error);
+
+        return res;
+    }
+
+    /**
+     * @see FindMatches(const char *, size_t, Error *) const
+     */
+    std::vector<Match> FindMatches(StringView text, Error * error = nullptr) const {
+        return FindMatches(text.data(), text.size(), error);
+    }
+
+    /**
+     * @brief FindMatches аналогичен Find, но вместе с данными возвращает позицию конца совпадения
+     *
+     *   Позиции отсчитываются от начала всего текста, в том числе для текстов длиннее 4 Гб, <br>
+     * которые сканируются потоковой базой данных по кусочкам.
+     *
+     * @remark thread-safe, multiple readers
+     * @param[in] text указатель на начало текста
+     * @param[in] len  длина текста
+     * @param[out] error может быть записано ErrorCode::SCAN_ERROR
+     * @return вектор совпадений в порядке их позиций в тексте
+     */
+    std::vector<Match> FindMatches(const char *text, size_t len, Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        Snapshot dw = GetDatabase();
+
+        std::vector<Match> res;
+        if (!dw) return res;
+
+        NormalizedText normalized(*this, text, len);
+
+        MatchContext ctx{&res, &dw->data, dw->dead};
+        ScanBuffer(*dw, text, len, FindMatchHandler, (void*) &ctx, error);
+
+        if (dw->DatabaseCount() > 1) {
+            // every shard reports its own matches in order, merge them
+            std::stable_sort(res.begin(), res.end(), [](const Match& a, const Match& b) {
+                return a.to < b.to;
+            });
+        }
+
+        if (normalized.normalizer) {
+            for (Match& match: res) {
+                match.to = normalized.normalizer->OriginalOffset(match.to);
+            }
+        }
+
+        return res;
+    }
+
+    /**
+     * @brief FindInFile ищет добавленные паттерны в файле, не читая его в память
+     *
+     *   Файл отображается в память через mmap (с MADV_SEQUENTIAL) и сканируется на месте. <br>
+     * Файлы длиннее, чем может принять hs_scan (4 Гб), сканируются потоковой базой данных <br>
+     * окнами по STREAM_WINDOW байт, каждое окно отображается и освобождается отдельно, <br>
+     * так что потребление памяти не зависит от размера файла.
+     *
+     * @remark thread-safe, multiple readers
+     * @param[in] path путь к файлу
+     * @param[out] error может быть записано ErrorCode::FILE_ERROR, ErrorCode::SCAN_ERROR, ErrorCode::BUILD_ERROR
+     * @return вектор данных соответствующих паттернам которые сматчились во время поиска
+     */
+    std::vector<DataT> FindInFile(const std::string &path, Error * error = nullptr) const {
+        if (error) *error = Error();
+
+        std::vector<DataT> res;
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            if (error) *error = Error(ErrorCode::FILE_ERROR, path.c_str());
+            return res;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            if (error) *error = Error(ErrorCode::FILE_ERROR, path.c_str());
+            close(fd);
+            return res;
+        }
+
+        Snapshot dw = GetDatabase();
+        size_t size = st.st_size;
+
+        if (dw && size > 0) {
+            Context ctx{&res, &dw->data, dw->dead};
+
+            if (size <= MAX_SCAN_LENGTH) {
+                ScanMappedFile(*dw, fd, size, FindHandler, (void*) &ctx, path, error);
+            } else {
+                ScanMappedFileStreaming(*dw, fd, size, FindHandler, (void*) &ctx, path, error);
+            }
+        }
+
+        close(fd);
+        return res;
+    }
+
+    /**
+     * @brief публикует текущую скомпилированную базу данных в shared memory для других процессов
+     *
+     *   Снэпшот последнего Build сериализуется в новый сегмент "<name>.N" (базы данных шардов разворачиваются <br>
+     * через hs_deserialize_database_at прямо в сегменте, рядом лежат данные и паттерны), <br>
+     * после чего в управляющем сегменте \a name атомарно выставляется поколение N, <br>
+     * а сегмент предыдущего поколения удаляется (процессы, которые его уже отобразили, продолжают с ним работать). <br>
+     * Отозванные через Revoke айдишники тоже лежат в сегменте, а Revoke после Publish дописывает их <br>
+     * в последний опубликованный сегмент, так что подключенные процессы перестают их находить без Refresh.
+     *
+     * @remark single writer, требует trivially copyable DataT
+     * @param[in] name имя управляющего сегмента, в формате shm_open: "/name"
+     * @param[out] error может быть записано ErrorCode::SHARED_MEMORY_ERROR или ErrorCode::NO_MEMORY
+     * @return true в случае успеха, false в случае неудачи смотри \a error
+     */
+    bool Publish(const std::string &name, Error * error = nullptr) {
+        static_assert(std::is_trivially_copyable<DataT>::value, "Publish copies DataT into shared memory as bytes");
+
+        if (error) *error = Error();
+
+        if (!OpenSharedControl(name, true)) {
+            if (error) *error = Error(ErrorCode::SHARED_MEMORY_ERROR, name.c_str());
+            return false;
+        }
+
+        std::shared_ptr<DatabaseWrapper> dw = _dw.Get();
+
+#ifdef HYPERSCAN_CHIMERA
+        // chimera databases can not be serialized
+        if (dw && dw->chimera) {
+            if (error) *error = Error(ErrorCode::SHARED_MEMORY_ERROR, name.c_str());
+            return false;
+        }
+#endif
+
+        size_t shardCount = dw ? dw->shards.size() : 0;
+        size_t count = dw ? dw->data.Size() : 0;
+
+        SharedHeader header;
+        header.magic = SharedHeader::MAGIC;
+        header.generation = SharedGeneration() + 1;
+        header.count = count;
+        header.shardCount = shardCount;
+        header.shardsOffset = AlignUp(sizeof(SharedHeader), 8);
+        header.dataOffset = AlignUp(header.shardsOffset + shardCount * sizeof(SharedShard), 64);
+        header.deadOffset = AlignUp(header.dataOffset + count * sizeof(DataT), 64);
+
+        static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "the tombstone words are shared as uint64_t");
+        size_t size = header.deadOffset + (count + 63) / 64 * sizeof(uint64_t);
+
+        std::vector<std::unique_ptr<char, void (*)(void *)>> serialized;
+        std::vector<size_t> lengths(shardCount);
+        std::vector<SharedShard> table(shardCount);
+
+        for (size_t i = 0; i < shardCount; ++i) {
+            const Shard& shard = *dw->shards[i];
+            char * bytes = nullptr;
+            size_t dbSize = 0;
+
+            if (hs_serialize_database(shard.db, &bytes, &lengths[i]) != HS_SUCCESS) {
+                if (error) *error = Error(ErrorCode::NO_MEMORY);
+                return false;
+            }
+
+            serialized.emplace_back(bytes, free);
+
+            if (hs_serialized_database_size(bytes, lengths[i], &dbSize) != HS_SUCCESS) {
+                if (error) *error = Error(ErrorCode::NO_MEMORY);
+                return false;
+            }
+
+            SharedShard& s = table[i];
+            s.hash = shard.hash;
+            s.count = shard.ids.size();
+            s.dbOffset = AlignUp(size, 64);
+            s.idsOffset = AlignUp(s.dbOffset + dbSize, 8);
+            s.patternsOffset = AlignUp(s.idsOffset + s.count * sizeof(uint32_t), 8);
+            s.patternsBytes = s.patternsOffset + (s.count + 1) * sizeof(uint64_t);
+
+            size = s.patternsBytes;
+            for (const std::string& pattern: shard.patterns) {
+                size += pattern.size();
+            }
+
+            s.groupOffset = size;
+            s.groupBytes = shard.group.size();
+            size += s.groupBytes;
+        }
+
+        std::string segmentName = SharedSegmentName(name, header.generation);
+
+        // a publisher that died halfway might have left this generation behind
+        SharedSegment::Unlink(segmentName);
+
+        std::shared_ptr<SharedSegment> segment = SharedSegment::Create(segmentName, size);
+        if (!segment) {
+            if (error) *error = Error(ErrorCode::SHARED_MEMORY_ERROR, segmentName.c_str());
+            return false;
+        }
+
+        char * base = segment->Data();
+        memcpy(base, &header, sizeof(header));
+        memcpy(base + header.shardsOffset, table.data(), shardCount * sizeof(SharedShard));
+
+        if (count) {
+            char * out = base + header.dataOffset;
+            dw->data.ForEachChunk([&out](const DataT * chunk, size_t n) {
+                memcpy(out, chunk, n * sizeof(DataT));
+                out += n * sizeof(DataT);
+            });
+        }
+
+        for (size_t i = 0; i < shardCount; ++i) {
+            const Shard& shard = *dw->shards[i];
+            const SharedShard& s = table[i];
+
+            if (hs_deserialize_database_at(serialized[i].get(), lengths[i], reinterpret_cast<hs_database_t *>(base + s.dbOffset)) != HS_SUCCESS) {
+                SharedSegment::Unlink(segmentName);
+                if (error) *error = Error(ErrorCode::NO_MEMORY);
+                return false;
+            }
+
+            uint32_t * ids = reinterpret_cast<uint32_t *>(base + s.idsOffset);
+            uint64_t * offsets = reinterpret_cast<uint64_t *>(base + s.patternsOffset);
+            offsets[0] = 0;
+
+            for (size_t j = 0; j < s.count; ++j) {
+                ids[j] = shard.ids[j];
+                memcpy(base + s.patternsBytes + offsets[j], shard.patterns[j].data(), shard.patterns[j].size());
+                offsets[j + 1] = offsets[j] + shard.patterns[j].size();
+            }
+
+            memcpy(base + s.groupOffset, shard.group.data(), s.groupBytes);
+        }
+
+        {
+            // a Revoke after this block writes into the segment itself, see Revoke
+            std::lock_guard<std::mutex> lock(_stagingMutex);
+
+            std::atomic<uint64_t> * dead = reinterpret_cast<std::atomic<uint64_t> *>(base + header.deadOffset);
+            for (size_t i = 0; i < (count + 63) / 64; ++i) {
+                dead[i].store(dw->dead[i].load(std::memory_order_acquire), std::memory_order_relaxed);
+            }
+
+            _publishedSegment = segment;
+            _publishedDw = dw;
+        }
+
+        SharedControlBlock()->generation.store(header.generation, std::memory_order_release);
+        _sharedGeneration = header.generation;
+
+        if (header.generation > 1) {
+            SharedSegment::Unlink(SharedSegmentName(name, header.generation - 1));
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief начинает использовать базу данных, опубликованную другим процессом через Publish
+     *
+     *   Сегменты отображаются только для чтения и не создаются, поэтому процессу достаточно права на чтение. <br>
+     * База данных не копируется, в процессе выделяется только свой scratch. <br>
+     * Дальше для перехода на новые поколения нужно периодически вызывать HyperscanWrapper::Refresh. <br>
+     * Последующие локальные Build заменяют подключенную базу данных.
+     *
+     * @remark single writer
+     * @param[in] name имя управляющего сегмента, переданное в Publish
+     * @param[out] error может быть записано ErrorCode::SHARED_MEMORY_ERROR, если ничего еще не опубликовано
+     * @return true в случае успеха, false в случае неудачи смотри \a error
+     */
+    bool Attach(const std::string &name, Error * error = nullptr) {
+        if (error) *error = Error();
+
+        if (!OpenSharedControl(name, false)) {
+            if (error) *error = Error(ErrorCode::SHARED_MEMORY_ERROR, name.c_str());
+            return false;
+        }
+
+        return Refresh(error);
+    }
+
+    /**
+     * @brief переходит на последнее опубликованное поколение, если оно поменялось с прошлого вызова
+     *
+     *   Если поколение не поменялось, то стоит одно атомарное чтение, поэтому можно вызывать перед каждым запросом.
+     *
+     * @remark single writer
+     * @param[out] error может быть записано ErrorCode::SHARED_MEMORY_ERROR или ErrorCode::NO_MEMORY
+     * @return true в случае успеха, false в случае неудачи смотри \a error
+     */
+    bool Refresh(Error * error = nullptr) {
+        if (error) *error = Error();
+
+        if (!_sharedControl) {
+            if (error) *error = Error(ErrorCode::SHARED_MEMORY_ERROR);
+            return false;
+        }
+
+        // the publisher may replace the generation we just read, in that case look again
+        for (int attempt = 0; attempt < 16; ++attempt) {
+            uint64_t generation = SharedGeneration();
+            if (generation == 0) break;
+            if (generation == _sharedGeneration) return true;
+
+            std::shared_ptr<SharedSegment> segment = SharedSegment::Open(SharedSegmentName(_sharedName, generation));
+            if (!segment) continue;
+
+            const SharedHeader * header = reinterpret_cast<const SharedHeader *>(segment->Data());
+            if (segment->Size() < sizeof(SharedHeader) || header->magic != SharedHeader::MAGIC || header->generation != generation) {
+                break;
+            }
+
+            std::shared_ptr<DatabaseWrapper> dw;
+            if (header->shardCount) {
+                Error local_error;
+                dw = MapSnapshot(segment, &local_error);
+
+                if (dw && _streaming && !PrepareStreams(*dw, &local_error)) dw.reset();
+
+                if (!dw) {
+                    if (error) *error = local_error;
+                    return false;
+                }
+            }
+
+            _dw.Store(dw);
+
+            _sharedGeneration = generation;
+            return true;
+        }
+
+        if (error) *error = Error(ErrorCode::SHARED_MEMORY_ERROR, _sharedName.c_str());
+        return false;
+    }
+
+    /**
+     * @brief удаляет управляющий сегмент \a name и сегмент последнего опубликованного поколения
+     */
+    static void Unpublish(const std::string &name) {
+        std::shared_ptr<SharedSegment> control = SharedSegment::Open(name, false);
+        if (control && control->Size() >= sizeof(SharedControl)) {
+            uint64_t generation = reinterpret_cast<SharedControl *>(control->Data())->generation.load();
+            if (generation) SharedSegment::Unlink(SharedSegmentName(name, generation));
+        }
+
+        SharedSegment::Unlink(name);
+    }
+
+private:
+    /**
+     * @brief максимальная длина текста которую принимает hs_scan
+     */
+    static const size_t MAX_SCAN_LENGTH = std::numeric_limits<unsigned int>::max();
+
+    /**
+     * @brief размер окна, которым сканируются файлы длиннее MAX_SCAN_LENGTH, кратен размеру страницы
+     */
+    static const size_t STREAM_WINDOW = size_t(1) << 30;
+
+    /**
+     * @brief раз во сколько совпадений Find с ограничениями смотрит на часы
+     */
+    static const size_t DEADLINE_CHECK_PERIOD = 64;
+
+    static const size_t NO_SLOT = std::numeric_limits<size_t>::max();
+
+    /**
+     * @brief сколько байт буфера нормализации поток исполнения оставляет себе после поиска
+     */
+    static const size_t NORMALIZER_RETAINED = size_t(4) << 20;
+
+    /**
+     * @brief параметры FNV-1a, которым хешируются паттерны и содержимое шардов
+     */
+    static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+    static const uint64_t FNV_PRIME = 1099511628211ull;
+
+    /**
+     * @brief начало файла кэша шарда, см. ShardCacheKey
+     */
+    static const uint64_t SHARD_CACHE_MAGIC = 0x48535348415244ull; // "HSSHARD"
+
+    static size_t AlignUp(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static std::string SharedSegmentName(const std::string &name, uint64_t generation) {
+        return name + "." + std::to_string(generation);
+    }
+
+    /**
+     * @brief отображает управляющий сегмент \a name, если он еще не отображен
+     * @param create true - для Publish: создать сегмент, если его нет, и отобразить для записи, <br>
+     * false - для Attach: открыть только существующий и только для чтения
+     */
+    bool OpenSharedControl(const std::string &name, bool create) {
+        if (_sharedControl && _sharedName == name && (_sharedWritable || !create)) return true;
+
+        std::shared_ptr<SharedSegment> control = create
+                                                 ? SharedSegment::OpenOrCreate(name, sizeof(SharedControl))
+                                                 : SharedSegment::Open(name, false);
+
+        if (control && control->Size() < sizeof(SharedControl)) control = nullptr;
+
+        if (_sharedName != name) _sharedGeneration = 0;
+
+        _sharedControl = std::move(control);
+        _sharedName = name;
+        _sharedWritable = create;
+
+        return _sharedControl != nullptr;
+    }
+
+    SharedControl * SharedControlBlock() const {
+        return reinterpret_cast<SharedControl *>(_sharedControl->Data());
+    }
+
+    uint64_t SharedGeneration() const {
+        return SharedControlBlock()->generation.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief паттерн в слоте \a slot, вызывается под _stagingMutex
+     */
+    StringView PatternAt(size_t slot) const {
+        return StringView(_patterns[slot], _patternLengths[slot]);
+    }
+
+    /**
+     * @brief слот (айдишник) пары (\a pattern, \a data) в группе \a group, NO_SLOT если пара не добавлена,
+     *        вызывается под _stagingMutex
+     */
+    size_t FindSlot(const std::string& group, StringView pattern, const DataT& data) const {
+        auto it = _groupIds.find(group);
+        if (it == _groupIds.end()) return NO_SLOT;
+
+        auto range = _slotIndex.equal_range(SlotKey(it->second, pattern));
+        for (auto slot = range.first; slot != range.second; ++slot) {
+            size_t i = slot->second;
+            if (_slotGroup[i] == it->second && PatternAt(i) == pattern && _data[i] == data) {
+                return i;
+            }
+        }
+
+        return NO_SLOT;
+    }
+
+    /**
+     * @brief ключ _slotIndex: хеш группы и паттерна
+     */
+    static uint64_t SlotKey(size_t group, StringView pattern) {
+        uint64_t hash = Fnv1a(FNV_OFFSET, &group, sizeof(group));
+        return Fnv1a(hash, pattern.data(), pattern.size());
+    }
+
+    bool InsertIntoGroup(const std::string& group, const char * pattern, size_t len, DataT&& data, Error * error) {
+        if (error) *error = Error();
+
+        std::lock_guard<std::mutex> lock(_stagingMutex);
+
+        if (FindSlot(group, StringView(pattern, len), data) != NO_SLOT) {
+            if (error) *error = Error(ErrorCode::PATTERN_AND_DATA_IN_USE, StringView(pattern, len));
+            return false;
+        }
+
+        auto it = _groupIds.find(group);
+        if (it == _groupIds.end()) {
+            it = _groupIds.emplace(group, _groupNames.size()).first;
+            _groupNames.push_back(group);
+        }
+
+        // memcpy, not strncpy: binary patterns may contain zero bytes
+        char * cpy = new char[len + 1];
+        memcpy(cpy, pattern, len);
+        cpy[len] = '\0';
+
+        size_t slot;
+
+        if (_free.empty()) {
+            slot = _patterns.size();
+            _patterns.push_back(cpy);
+            _patternLengths.push_back(len);
+            _data.PushBack(std::move(data));
+            _slotGroup.push_back(it->second);
+        } else {
+            slot = _free.back();
+            _free.pop_back();
+
+            _patterns[slot] = cpy;
+            _patternLengths[slot] = len;
+            _data.Set(slot, std::move(data));
+            _slotGroup[slot] = it->second;
+        }
+
+        _slotIndex.emplace(SlotKey(it->second, StringView(pattern, len)), slot);
+        ++_generation;
+
+        return true;
+    }
+
+    bool DeleteFromGroup(const std::string& group, const char * pattern, size_t len, const DataT& data, Error * error) {
+        if (error) *error = Error();
+
+        std::lock_guard<std::mutex> lock(_stagingMutex);
+        return EraseSlot(FindSlot(group, StringView(pattern, len), data), error);
+    }
+
+    /**
+     * @brief освобождает слот \a slot, вызывается под _stagingMutex
+     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_NOT_FOUND, если \a slot == NO_SLOT
+     */
+    bool EraseSlot(size_t slot, Error * error) {
+        if (slot == NO_SLOT) {
+            if (error) *error = Error(ErrorCode::PATTERN_AND_DATA_NOT_FOUND);
+            return false;
+        }
+
+        auto range = _slotIndex.equal_range(SlotKey(_slotGroup[slot], PatternAt(slot)));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == slot) {
+                _slotIndex.erase(it);
+                break;
+            }
+        }
+
+        // the slot keeps its place so that the ids of the other patterns and their shards stay the same,
+        // the data stays in the slot until it is reused by Insert
+        delete[] _patterns[slot];
+        _patterns[slot] = nullptr;
+        _free.push_back(slot);
+        ++_generation;
+
+#ifdef HYPERSCAN_CHIMERA
+        _fallbackSlots.erase(slot);
+#endif
+        _invalidSlots.erase(slot);
+
+        return true;
+    }
+
+    /**
+     * @brief помечает паттерн отозванным в снэпшоте \a dw и его репликах на узлах NUMA
+     * @return false, если паттерна нет в снэпшоте
+     */
+    static bool RevokeInSnapshot(DatabaseWrapper& dw, size_t slot, StringView pattern, const DataT& data) {
+        if (!dw.Revoke(slot, pattern, data)) return false;
+
+        for (auto& replica: dw.replicas) {
+            if (replica) replica->Revoke(slot, pattern, data);
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief компилирует потоковые базы снэпшота \a dw и его реплик в SetBuildThreads потоков, см. SetStreaming
+     * @param error[out] может быть записано ErrorCode::BUILD_ERROR или ErrorCode::NO_MEMORY
+     */
+    bool PrepareStreams(const DatabaseWrapper& dw, Error * error) const {
+        std::vector<const DatabaseWrapper *> snapshots(1, &dw);
+        for (auto& replica: dw.replicas) {
+            if (replica) snapshots.push_back(replica.get());
+        }
+
+        std::vector<const Shard *> shards;
+        for (const DatabaseWrapper * snapshot: snapshots) {
+            shards.insert(shards.end(), snapshot->allShards.begin(), snapshot->allShards.end());
+        }
+
+        // shards taken from the cache already have theirs, call_once returns at once
+        ParallelFor(shards.size(), _buildThreads, [&](size_t i) {
+            shards[i]->PrepareStream();
+        });
+
+        for (const DatabaseWrapper * snapshot: snapshots) {
+            if (!snapshot->shards.empty() && !snapshot->PrepareStream(error)) return false;
+        }
+
+        return true;
+    }
+
+    bool BuildOrSchedule(Error * error) {
+        if (!_scheduler) return Build(error);
+
+        _scheduler->Schedule();
+        return true;
+    }
+
+    /**
+     * @brief запоминает ошибку сборки поколения \a generation для WaitForGeneration
+     * @return false
+     */
+    bool BuildFailed(uint64_t generation, const Error& buildError, Error * error) {
+        if (error) *error = buildError;
+
+        {
+            std::lock_guard<std::mutex> lock(_generationMutex);
+            _failedGeneration = std::max(_failedGeneration, generation);
+            _buildError = buildError;
+        }
+        _generationCv.notify_all();
+
+        return false;
+    }
+
+    /**
+     * @brief возвращает указатель на текущее состояние
+     */
+    Snapshot GetDatabase() const {
+        Snapshot snapshot(_dw.Read());
+        const DatabaseWrapper * dw = snapshot.Get();
+
+        if (dw && !dw->replicas.empty()) {
+            size_t node = NumaTopology::Instance().CurrentNode();
+            if (node < dw->replicas.size() && dw->replicas[node]) {
+                snapshot.SetReplica(dw->replicas[node].get());
+            }
+        }
+
+        return snapshot;
+    }
+
+    /**
+     * @brief трогает все страницы баз данных и scratch нового снэпшота до того, как его увидят читатели
+     * @see HugePageAllocator
+     */
+    static void Prefault(const DatabaseWrapper& dw) {
+        size_t size;
+
+        for (auto& shard: dw.shards) {
+            if (hs_database_size(shard->db, &size) == HS_SUCCESS) {
+                HugePageAllocator::Prefault(shard->db, size);
+            }
+        }
+
+        if (hs_scratch_size(dw.scratch, &size) == HS_SUCCESS) {
+            HugePageAllocator::Prefault(dw.scratch, size);
+        }
+    }
+
+    /**
+     * @brief создает реплики \a dw на каждом узле NUMA, каждая собирается потоком привязанным к своему узлу
+     */
+    bool MakeNumaReplicas(DatabaseWrapper& dw, Error * error) const {
+        const NumaTopology& numa = NumaTopology::Instance();
+        if (numa.NodeCount() < 2) return true;
+
+        std::vector<std::unique_ptr<char, void (*)(void *)>> serialized;
+        std::vector<size_t> lengths(dw.shards.size());
+
+        for (size_t i = 0; i < dw.shards.size(); ++i) {
+            char * bytes = nullptr;
+            if (hs_serialize_database(dw.shards[i]->db, &bytes, &lengths[i]) != HS_SUCCESS) {
+                if (error) *error = Error(ErrorCode::NO_MEMORY);
+                return false;
+            }
+
+            serialized.emplace_back(bytes, free);
+        }
+
+        dw.replicas.resize(numa.NodeCount());
+        for (size_t node = 0; node < numa.NodeCount(); ++node) {
+            if (numa.Cpus(node).empty()) continue;
+
+            Error local_error;
+            numa.RunOnNode(node, [&]() {
+                std::vector<std::shared_ptr<const Shard>> shards;
+
+                for (size_t i = 0; i < dw.shards.size(); ++i) {
+                    const Shard& origin = *dw.shards[i];
+                    std::shared_ptr<const Shard> shard = std::make_shared<Shard>(origin.group, origin.patterns, origin.ids, origin.hash,
+                                                                                 serialized[i].get(), lengths[i], &local_error);
+                    if (!shard->db) return;
+                    shards.push_back(shard);
+                }
+
+                // a deep copy, so that the data is in the memory of the node too
+                dw.replicas[node] = std::make_shared<DatabaseWrapper>(std::move(shards), dw.data.Clone(), &local_error);
+
+#ifdef HYPERSCAN_CHIMERA
+                if (dw.chimera && !local_error.GetErrorCode()) dw.replicas[node]->SetChimera(dw.chimera, &local_error);
+#endif
+            });
+
+            if (local_error.GetErrorCode()) {
+                if (error) *error = local_error;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief создает снэпшот поверх базы данных, опубликованной в shared memory через Publish
+     *
+     *   Базы данных шардов используются прямо из отображенного только для чтения сегмента и не копируются, <br>
+     * своими у процесса остаются только scratch, данные и паттерны.
+     *
+     * @param segment[in] сегмент, начинающийся с SharedHeader, в котором есть хотя бы один шард
+     * @return nullptr в случае неудачи, смотри \a error
+     */
+    static std::shared_ptr<DatabaseWrapper> MapSnapshot(const std::shared_ptr<SharedSegment>& segment, Error * error) {
+        const char * base = segment->Data();
+        const SharedHeader * header = reinterpret_cast<const SharedHeader *>(base);
+        const SharedShard * table = reinterpret_cast<const SharedShard *>(base + header->shardsOffset);
+
+        std::vector<std::shared_ptr<const Shard>> shards;
+        for (size_t i = 0; i < header->shardCount; ++i) {
+            const SharedShard& s = table[i];
+            const uint32_t * ids = reinterpret_cast<const uint32_t *>(base + s.idsOffset);
+            const uint64_t * offsets = reinterpret_cast<const uint64_t *>(base + s.patternsOffset);
+            const char * bytes = base + s.patternsBytes;
+
+            std::vector<std::string> patterns;
+            patterns.reserve(s.count);
+            for (size_t j = 0; j < s.count; ++j) {
+                patterns.emplace_back(bytes + offsets[j], offsets[j + 1] - offsets[j]);
+            }
+
+            shards.push_back(std::make_shared<Shard>(std::string(base + s.groupOffset, s.groupBytes), std::move(patterns),
+                                                     std::vector<unsigned>(ids, ids + s.count), s.hash,
+                                                     reinterpret_cast<const hs_database_t *>(base + s.dbOffset), segment));
+        }
+
+        const DataT * d = reinterpret_cast<const DataT *>(base + header->dataOffset);
+        DataStore<DataT> data;
+        for (size_t i = 0; i < header->count; ++i) {
+            data.PushBack(d[i]);
+        }
+
+        std::shared_ptr<DatabaseWrapper> dw = std::make_shared<DatabaseWrapper>(std::move(shards), std::move(data), error);
+        dw->MapDead(reinterpret_cast<const std::atomic<uint64_t> *>(base + header->deadOffset), segment);
+
+        return dw->scratch ? dw : nullptr;
+    }
+
+    /**
+     * @brief проверяет паттерн отдельно от остальных: разбор через hs_expression_info и компиляция одного паттерна
+     * @return пустая строка, если паттерн компилируется, иначе сообщение об ошибке от \a %Hyperscan
+     */
+    static std::string CheckPattern(const std::string& pattern) {
+        hs_expr_info_t * info = nullptr;
+        hs_compile_error_t * compileErr = nullptr;
+        std::string message;
+        std::string buffer;
+        const char * expression = Expression(pattern, buffer);
+
+        if (hs_expression_info(expression, HS_FLAG_SINGLEMATCH, &info, &compileErr) != HS_SUCCESS) {
+            message = compileErr->message;
+            hs_free_compile_error(compileErr);
+            return message;
+        }
+
+        free(info);
+
+        // the parser accepts some patterns that the compiler does not, e.g. too large ones
+        hs_database_t * db = nullptr;
+        if (hs_compile(expression, HS_FLAG_SINGLEMATCH, HS_MODE_BLOCK, nullptr, &db, &compileErr) != HS_SUCCESS) {
+            message = compileErr->message;
+            hs_free_compile_error(compileErr);
+            return message;
+        }
+
+        hs_free_database(db);
+        return message;
+    }
+
+    /**
+     * @brief проверяет по одному паттерны шарда, который не скомпилировался, и убирает из сборки те, что не компилируются
+     *
+     *   С HYPERSCAN_CHIMERA паттерн, который принимает Chimera, переносится в staged.fallback, <br>
+     * с SetSkipInvalidPatterns остальные такие паттерны переносятся в staged.invalid. <br>
+     * Все паттерны шарда проверяются сразу, поэтому шард перекомпилируется один раз, сколько бы в нем ни было ошибок.
+     *
+     * @param error[out] может быть записано ErrorCode::BUILD_ERROR для паттерна, который некуда убрать
+     * @return true, если что-то убрано и сборку можно повторить
+     */
+    bool ExcludeInvalid(Staged& staged, const Shard& shard, Error * error) const {
+        bool fallback = false;
+#ifdef HYPERSCAN_CHIMERA
+        fallback = true;
+#endif
+        // the error is not in a single pattern, e.g. the shard is too large as a whole
+        if ((!fallback && !_skipInvalid) || shard.failedId == NO_SLOT) return false;
+
+        std::vector<std::string> messages(shard.patterns.size());
+        std::vector<char> accepted(shard.patterns.size(), false);
+
+        ParallelFor(shard.patterns.size(), _buildThreads, [&](size_t i) {
+            messages[i] = CheckPattern(shard.patterns[i]);
+#ifdef HYPERSCAN_CHIMERA
+            if (!messages[i].empty()) accepted[i] = ChimeraDatabase::Accepts(shard.patterns[i]);
+#endif
+        });
+
+        bool excluded = false;
+        for (size_t i = 0; i < shard.patterns.size(); ++i) {
+            if (messages[i].empty()) continue;
+
+            size_t slot = shard.ids[i];
+            staged.live[slot] = false;
+            excluded = true;
+
+#ifdef HYPERSCAN_CHIMERA
+            if (accepted[i]) {
+                staged.fallback.push_back(slot);
+                continue;
+            }
+#endif
+
+            if (!_skipInvalid) {
+                if (error) *error = Error(ErrorCode::BUILD_ERROR, shard.patterns[i].c_str(), messages[i].c_str());
+                return false;
+            }
+
+            staged.invalid[slot] = messages[i];
+        }
+
+        return excluded;
+    }
+
+#ifdef HYPERSCAN_CHIMERA
+    /**
+     * @brief компилирует паттерны staged.fallback через Chimera и добавляет их в \a dw
+     * @param error[out] может быть записано ErrorCode::BUILD_ERROR или ErrorCode::NO_MEMORY
+     */
+    static bool BuildChimera(Staged& staged, DatabaseWrapper& dw, Error * error) {
+        std::sort(staged.fallback.begin(), staged.fallback.end());
+
+        std::vector<std::string> patterns;
+        std::vector<unsigned> ids;
+        std::vector<std::string> groups;
+
+        for (size_t slot: staged.fallback) {
+            patterns.push_back(staged.patterns[slot]);
+            ids.push_back(slot);
+            groups.push_back(staged.groupNames[staged.group[slot]]);
+        }
+
+        auto chimera = std::make_shared<const ChimeraDatabase>(std::move(patterns), std::move(ids), std::move(groups), error);
+        if (!chimera->db) return false;
+
+        return dw.SetChimera(chimera, error);
+    }
+#endif
+
+    /**
+     * @brief раскладывает паттерны по шардам и компилирует только те шарды, которых нет в кэше
+     *
+     *   Шард паттерна определяется его группой и хешем самого паттерна и не зависит от остальных паттернов, <br>
+     * внутри шарда паттерны идут по возрастанию номера слота. Шард ищется сначала среди шардов <br>
+     * прошлого Build, затем в каталоге SetShardCacheDirectory, и только потом компилируется. <br>
+     * Недостающие шарды компилируются параллельно в SetBuildThreads потоках.
+     *
+     * @param staged[in] копия добавленных паттернов
+     * @param shards[out] шарды нового снэпшота
+     * @param error[out] может быть записано ErrorCode::BUILD_ERROR
+     * @param failed[out] шард, который не скомпилировался
+     */
+    bool BuildShards(const Staged& staged, std::vector<std::shared_ptr<const Shard>>& shards, Error * error,
+                     std::shared_ptr<const Shard> * failed = nullptr) {
+        // every group is split into its own _shardCount shards
+        std::vector<std::vector<unsigned>> buckets(staged.groupNames.size() * _shardCount);
+        for (size_t i = 0; i < staged.patterns.size(); ++i) {
+            if (staged.live[i]) {
+                size_t shard = Fnv1a(FNV_OFFSET, staged.patterns[i].data(), staged.patterns[i].size()) % _shardCount;
+                buckets[staged.group[i] * _shardCount + shard].push_back(i);
+            }
+        }
+
+        // shards missing from both caches, compiled concurrently below
+        std::vector<size_t> pending;
+        std::vector<std::string> pendingGroups;
+        std::vector<std::vector<std::string>> pendingPatterns;
+        std::vector<std::vector<unsigned>> pendingIds;
+        std::vector<uint64_t> pendingHashes;
+
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            std::vector<unsigned>& ids = buckets[b];
+            if (ids.empty()) continue;
+
+            const std::string& group = staged.groupNames[b / _shardCount];
+            std::vector<std::string> patterns(ids.size());
+            for (size_t j = 0; j < ids.size(); ++j) {
+                patterns[j] = staged.patterns[ids[j]];
+            }
+
+            uint64_t hash = ShardHash(group, patterns, ids);
+            std::shared_ptr<const Shard> shard;
+
+            auto it = _shardCache.find(hash);
+            if (it != _shardCache.end() && it->second->group == group && it->second->ids == ids && it->second->patterns == patterns) {
+                shard = it->second;
+            }
+
+            if (!shard) shard = LoadShard(group, patterns, ids, hash);
+
+            if (!shard) {
+                pending.push_back(shards.size());
+                pendingGroups.push_back(group);
+                pendingPatterns.push_back(std::move(patterns));
+                pendingIds.push_back(std::move(ids));
+                pendingHashes.push_back(hash);
+            }
+
+            shards.push_back(shard);
+        }
+
+        std::vector<Error> errors(pending.size());
+
+        ParallelFor(pending.size(), _buildThreads, [&](size_t i) {
+            std::shared_ptr<const Shard> shard = std::make_shared<Shard>(std::move(pendingGroups[i]), std::move(pendingPatterns[i]),
+                                                                         std::move(pendingIds[i]), pendingHashes[i], &errors[i]);
+            if (shard->db) SaveShard(*shard);
+            shards[pending[i]] = shard;
+        });
+
+        _compiledShards.store(pending.size(), std::memory_order_relaxed);
+
+        for (size_t i = 0; i < pending.size(); ++i) {
+            const std::shared_ptr<const Shard>& shard = shards[pending[i]];
+
+            if (!shard->db) {
+                if (error) *error = errors[i];
+                if (failed) *failed = shard;
+                return false;
+            }
+
+            // a Build that fails on another shard does not compile this one again
+            _shardCache[shard->hash] = shard;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief вызывает \a f(i) для i от 0 до \a count в \a threads потоках (включая вызывающий),
+     *        потоки берут следующий индекс, как только освобождаются
+     */
+    template <typename F>
+    static void ParallelFor(size_t count, size_t threads, F f) {
+        std::atomic<size_t> next(0);
+
+        auto worker = [&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                f(i);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < std::min(threads, count); ++t) {
+            pool.emplace_back(worker);
+        }
+
+        worker();
+
+        for (std::thread& t: pool) {
+            t.join();
+        }
+    }
+
+    /**
+     * @brief хеш содержимого шарда: версия библиотеки, платформа, режим, флаги, группа, айдишники и паттерны
+     */
+    static uint64_t ShardHash(const std::string& group, const std::vector<std::string>& patterns, const std::vector<unsigned>& ids) {
+        static const uint64_t prefix = []() {
+            hs_platform_info_t platform;
+            memset(&platform, 0, sizeof(platform));
+            hs_populate_platform(&platform);
+
+            const char * version = hs_version();
+            unsigned int mode = HS_MODE_BLOCK;
+            unsigned int flags = HS_FLAG_SINGLEMATCH;
+
+            uint64_t hash = Fnv1a(FNV_OFFSET, version, strlen(version));
+            hash = Fnv1a(hash, &platform.tune, sizeof(platform.tune));
+            hash = Fnv1a(hash, &platform.cpu_features, sizeof(platform.cpu_features));
+            hash = Fnv1a(hash, &mode, sizeof(mode));
+            return Fnv1a(hash, &flags, sizeof(flags));
+        }();
+
+        uint64_t groupLen = group.size();
+        uint64_t hash = Fnv1a(prefix, &groupLen, sizeof(groupLen));
+        hash = Fnv1a(hash, group.data(), groupLen);
+
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            uint64_t len = patterns[i].size();
+
+            hash = Fnv1a(hash, &ids[i], sizeof(ids[i]));
+            hash = Fnv1a(hash, &len, sizeof(len));
+            hash = Fnv1a(hash, patterns[i].data(), len);
+        }
+
+        return hash;
+    }
+
+    static uint64_t Fnv1a(uint64_t hash, const void * bytes, size_t len) {
+        const unsigned char * p = reinterpret_cast<const unsigned char *>(bytes);
+
+        for (size_t i = 0; i < len; ++i) {
+            hash ^= p[i];
+            hash *= FNV_PRIME;
+        }
+
+        return hash;
+    }
+
+    std::string ShardCachePath(uint64_t hash) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.hsdb", (unsigned long long) hash);
+        return _shardCacheDirectory + "/" + name;
+    }
+
+    /**
+     * @brief заголовок файла кэша шарда: группа, айдишники и паттерны, по которым он скомпилирован
+     *
+     *   Файл кэша - этот заголовок и следом результат hs_serialize_database. Хеш в имени файла только <br>
+     * находит кандидата, а совпадение заголовка проверяет, что это тот же шард, как и в кэше в памяти.
+     */
+    static std::string ShardCacheKey(const std::string& group, const std::vector<std::string>& patterns,
+                                     const std::vector<unsigned>& ids) {
+        std::string key;
+
+        auto put = [&key](const void * bytes, size_t len) {
+            key.append(reinterpret_cast<const char *>(bytes), len);
+        };
+
+        uint64_t magic = SHARD_CACHE_MAGIC;
+        uint64_t groupLen = group.size();
+        uint64_t count = patterns.size();
+
+        put(&magic, sizeof(magic));
+        put(&groupLen, sizeof(groupLen));
+        put(group.data(), groupLen);
+        put(&count, sizeof(count));
+
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            uint64_t len = patterns[i].size();
+
+            put(&ids[i], sizeof(ids[i]));
+            put(&len, sizeof(len));
+            put(patterns[i].data(), len);
+        }
+
+        return key;
+    }
+
+    /**
+     * @brief загружает шард из каталога кэша, nullptr если файла нет, он испорчен или в нем другой шард
+     */
+    std::shared_ptr<const Shard> LoadShard(const std::string& group, const std::vector<std::string>& patterns,
+                                           const std::vector<unsigned>& ids, uint64_t hash) const {
+        if (_shardCacheDirectory.empty()) return nullptr;
+
+        std::ifstream file(ShardCachePath(hash), std::ios::binary);
+        if (!file) return nullptr;
+
+        std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::string key = ShardCacheKey(group, patterns, ids);
+
+        // the same hash with other rules: a collision, the shard is compiled and the file replaced
+        if (bytes.size() <= key.size() || bytes.compare(0, key.size(), key) != 0) return nullptr;
+
+        std::shared_ptr<const Shard> shard = std::make_shared<Shard>(group, patterns, ids, hash,
+                                                                     bytes.data() + key.size(), bytes.size() - key.size());
+
+        return shard->db ? shard : nullptr;
+    }
+
+    /**
+     * @brief сохраняет базу данных шарда в каталог кэша, ошибки записи игнорируются
+     *
+     *   Файл пишется под временным именем и переименовывается, поэтому другие процессы <br>
+     * никогда не видят недописанный файл.
+     */
+    void SaveShard(const Shard& shard) const {
+        if (_shardCacheDirectory.empty()) return;
+
+        char * bytes = nullptr;
+        size_t length = 0;
+        if (hs_serialize_database(shard.db, &bytes, &length) != HS_SUCCESS) return;
+
+        std::unique_ptr<char, void (*)(void *)> serialized(bytes, free);
+
+        std::string path = ShardCachePath(shard.hash);
+        std::string tmp = path + ".tmp." + std::to_string(getpid());
+
+        std::string key = ShardCacheKey(shard.group, shard.patterns, shard.ids);
+
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(key.data(), key.size());
+        file.write(bytes, length);
+        file.close();
+
+        if (!file || rename(tmp.c_str(), path.c_str()) != 0) {
+            unlink(tmp.c_str());
+        }
+    }
 
     /**
-     * @brief Insert + Build
-     * @param[in] pattern указатель на начало паттерна
-     * @param[in] len  длина паттерна
-     * @param[in] data данные которые будут возвращены, если данный паттерн сматчился в тексте
-     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_IN_USE или ErrorCode::BUILD_ERROR
-     * @return true в случае успеха, false в случае неудачи смотри \a error
+     * @brief сканирует текст произвольной длины всеми шардами по очереди
+     *
+     *   Тексты не длиннее MAX_SCAN_LENGTH сканируются блочными базами за один вызов hs_scan на шард, <br>
+     * более длинные - потоковыми базами окнами по STREAM_WINDOW байт, поэтому смещения <br>
+     * в \a onEvent всегда отсчитываются от начала всего текста.
      */
-    bool InsertAndBuild(char const * pattern, size_t len, const DataT& data, Error * error = nullptr) {
-        return Insert(pattern, len, data, error) && Build(error);
+    void ScanBuffer(const DatabaseWrapper& dw, const char * text, size_t len,
+                    match_event_handler onEvent, void * ctx, Error * error) const {
+        ScanBuffer(dw, dw.allShards, text, len, onEvent, ctx, error);
     }
 
     /**
-     * @see DeleteAndBuild(char const *, size_t, const DataT&, Error *)
+     * @brief сканирует текст только шардами \a shards снэпшота \a dw
+     * @param scratch блочный scratch, подходящий для \a shards, nullptr - клонировать scratch снэпшота
      */
-    bool DeleteAndBuild(const std::string& pattern, const DataT& data, Error * error = nullptr) {
-        return DeleteAndBuild(pattern.c_str(), pattern.size(), data, error);
+    void ScanBuffer(const DatabaseWrapper& dw, const std::vector<const Shard *>& shards, const char * text, size_t len,
+                    match_event_handler onEvent, void * ctx, Error * error, hs_scratch_t * scratch = nullptr) const {
+#ifdef HYPERSCAN_CHIMERA
+        // chimera patterns belong to every group that has any
+        if (dw.chimera && !ScanChimera(dw, text, len, 0, onEvent, ctx, error)) return;
+#endif
+
+        if (shards.empty()) return;
+
+        if (len <= MAX_SCAN_LENGTH) {
+            ScratchWrapper sw;
+            if (!scratch) {
+                assert(dw.scratch);
+                if (!sw.Clone(dw.scratch, error)) return;
+
+                scratch = sw.scratch;
+            }
+
+            for (const Shard * shard: shards) {
+                hs_error_t err = hs_scan(shard->db, text, len, 0, scratch, onEvent, ctx);
+
+                // the callback asked to stop, the rest of the shards can not add anything
+                if (err == HS_SCAN_TERMINATED) return;
+
+                if (err != HS_SUCCESS) {
+                    if (error) *error = Error(ErrorCode::SCAN_ERROR);
+                    return;
+                }
+            }
+            return;
+        }
+
+        ScanStreaming(dw, shards, len, onEvent, ctx, error,
+                      [&](size_t offset, size_t windowLen, StreamWrapper& streams, hs_scratch_t * scratch) {
+            hs_error_t err = streams.Scan(text + offset, windowLen, scratch, onEvent, ctx);
+            if (err != HS_SUCCESS) {
+                if (error && err != HS_SCAN_TERMINATED) *error = Error(ErrorCode::SCAN_ERROR);
+                return false;
+            }
+            return true;
+        });
     }
 
     /**
-     * @brief Delete + Build
-     * @param[in] pattern указатель на начало паттерна
-     * @param[in] len  длина паттерна
-     * @param[in] data данные которые будут возвращены, если данный паттерн сматчился в тексте
-     * @param[out] error может быть записано ErrorCode::PATTERN_AND_DATA_NOT_FOUND или ErrorCode::BUILD_ERROR
-     * @return true в случае успеха, false в случае неудачи смотри \a error
+     * @brief сканирует текст для Find с ограничениями, проверяя deadline между шардами и кусками текста
      */
-    bool DeleteAndBuild(char const * pattern, size_t len, const DataT& data, Error * error = nullptr) {
-        return Delete(pattern, len, data, error) && Build(error);
+    void ScanBounded(const DatabaseWrapper& dw, const char * text, size_t len, BoundedContext& ctx, Error * error) const {
+#ifdef HYPERSCAN_CHIMERA
+        if (dw.chimera && !ScanChimera(dw, text, len, 0, FindBoundedHandler, (void*) &ctx, error)) return;
+#endif
+
+        if (dw.shards.empty()) return;
+
+        // slicing must not compile the stream databases behind the caller's deadline
+        bool sliced = ctx.options->deadline != std::chrono::steady_clock::time_point::max()
+                      && len > std::max<size_t>(ctx.options->sliceLength, 1)
+                      && dw.StreamReady();
+
+        if (!sliced && (len <= MAX_SCAN_LENGTH || !dw.StreamReady())) {
+            ScratchWrapper sw(dw.scratch, error);
+            if (!sw.scratch) return;
+
+            // without the stream databases a text longer than hs_scan accepts is cut into block scans
+            size_t offset = 0;
+            do {
+                size_t blockLen = std::min(len - offset, MAX_SCAN_LENGTH);
+
+                for (const Shard * shard: dw.allShards) {
+                    if (ctx.Expired()) return;
+
+                    hs_error_t err = hs_scan(shard->db, text + offset, blockLen, 0, sw.scratch,
+                                             FindBoundedHandler, (void*) &ctx);
+                    if (err == HS_SCAN_TERMINATED) return;
+
+                    if (err != HS_SUCCESS) {
+                        if (error) *error = Error(ErrorCode::SCAN_ERROR);
+                        return;
+                    }
+                }
+
+                offset += blockLen;
+            } while (offset < len);
+            return;
+        }
+
+        ScanStreaming(dw, dw.allShards, len, FindBoundedHandler, (void*) &ctx, error,
+                      [&](size_t offset, size_t windowLen, StreamWrapper& streams, hs_scratch_t * scratch) {
+            if (ctx.Expired()) return false;
+
+            hs_error_t err = streams.Scan(text + offset, windowLen, scratch, FindBoundedHandler, (void*) &ctx);
+            if (err != HS_SUCCESS) {
+                if (error && err != HS_SCAN_TERMINATED) *error = Error(ErrorCode::SCAN_ERROR);
+                return false;
+            }
+            return true;
+        }, sliced ? std::max<size_t>(ctx.options->sliceLength, 1) : STREAM_WINDOW);
     }
 
     /**
-     * @see Find(const char *, size_t, Error *) const
+     * @brief прогоняет \a size байт через потоковые базы данных \a shards окнами по \a window байт
+     * @param scanWindow функтор bool(offset, len, StreamWrapper&, hs_scratch_t *), сканирующий одно окно,
+     *        в случае неудачи сам заполняет \a error и возвращает false
      */
-    std::vector<DataT> Find(const std::string &text, Error * error = nullptr) const {
-        return Find(text.c_str(), text.size(), error);
+    template <typename WindowScanner>
+    void ScanStreaming(const DatabaseWrapper& dw, const std::vector<const Shard *>& shards, size_t size,
+                       match_event_handler onEvent, void * ctx, Error * error, WindowScanner scanWindow,
+                       size_t window = STREAM_WINDOW) const {
+        if (shards.empty()) return;
+        if (!dw.PrepareStream(error)) return;
+
+        ScratchWrapper sw(dw.streamScratch, error);
+        if (!sw.scratch) return;
+
+        StreamWrapper streams(shards, error);
+        if (streams.streams.empty()) return;
+
+        for (size_t offset = 0; offset < size; offset += window) {
+            if (!scanWindow(offset, std::min(window, size - offset), streams, sw.scratch)) {
+                return;
+            }
+        }
+
+        if (streams.Close(sw.scratch, onEvent, ctx) != HS_SUCCESS && error) {
+            *error = Error(ErrorCode::SCAN_ERROR);
+        }
     }
 
     /**
-     * @brief Find ищет в тексте добавленные паттерны
-     *
-     *   Каждый раз копирует указатель на текущее состояние = DatabaseWrapper <br>
-     * клонирует необходимую память, которую он будет изменять в ходе поиска <br>
-     * создает контекст с указателем на ответ и пользовательские данные
-     * который будет передаваться в callback(FindHandler) вызываемый из hs_scan
-     *
-     * @remark thread-safe, multiple readers
-     * @param[in] text указатель на начало текста
-     * @param[in] len  длина текста
-     * @param[out] error может быть записано ErrorCode::SCAN_ERROR
-     * @return вектор данных соответствующих паттернам которые сматчились во время поиска
+     * @brief отображает файл целиком и сканирует его блочной базой данных
      */
-    std::vector<DataT> Find(const char *text, size_t len, Error * error = nullptr) const {
-        if (error) *error = Error();
+    void ScanMappedFile(const DatabaseWrapper& dw, int fd, size_t size, match_event_handler onEvent, void * ctx,
+                        const std::string& path, Error * error) const {
+        void * text = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            if (error) *error = Error(ErrorCode::FILE_ERROR, path.c_str());
+            return;
+        }
 
-        _m.lock();
-        std::shared_ptr<DatabaseWrapper> dw = _dw;
-        _m.unlock();
+        madvise(text, size, MADV_SEQUENTIAL);
+        ScanBuffer(dw, (const char *) text, size, onEvent, ctx, error);
+        munmap(text, size);
+    }
 
-        std::vector<DataT> res;
-        if (!dw) return res;
+    /**
+     * @brief сканирует файл потоковой базой данных, отображая его по окнам размера STREAM_WINDOW
+     */
+    void ScanMappedFileStreaming(const DatabaseWrapper& dw, int fd, size_t size, match_event_handler onEvent, void * ctx,
+                                 const std::string& path, Error * error) const {
+#ifdef HYPERSCAN_CHIMERA
+        // chimera has no streaming mode, its patterns are scanned window by window
+        for (size_t offset = 0; dw.chimera && offset < size; offset += STREAM_WINDOW) {
+            size_t len = std::min(STREAM_WINDOW, size - offset);
+
+            void * window = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, offset);
+            if (window == MAP_FAILED) {
+                if (error) *error = Error(ErrorCode::FILE_ERROR, path.c_str());
+                return;
+            }
+
+            madvise(window, len, MADV_SEQUENTIAL);
+            bool more = ScanChimera(dw, (const char *) window, len, offset, onEvent, ctx, error);
+            munmap(window, len);
+
+            if (!more) return;
+        }
+#endif
+
+        ScanStreaming(dw, dw.allShards, size, onEvent, ctx, error,
+                      [&](size_t offset, size_t len, StreamWrapper& streams, hs_scratch_t * scratch) {
+            void * window = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, offset);
+            if (window == MAP_FAILED) {
+                if (error) *error = Error(ErrorCode::FILE_ERROR, path.c_str());
+                return false;
+            }
+
+            madvise(window, len, MADV_SEQUENTIAL);
+            hs_error_t err = streams.Scan((const char *) window, len, scratch, onEvent, ctx);
+            munmap(window, len);
+
+            if (err != HS_SUCCESS) {
+                if (error) *error = Error(ErrorCode::SCAN_ERROR);
+                return false;
+            }
+            return true;
+        });
+    }
+
+#ifdef HYPERSCAN_CHIMERA
+    /**
+     * @brief контекст ChimeraHandler: обработчик и контекст \a %Hyperscan, к которым пересылаются совпадения
+     */
+    struct ChimeraContext {
+        match_event_handler onEvent;
+        void * ctx;
+        unsigned long long offset;  //!< смещение сканируемого куска от начала текста
+    };
+
+    /**
+     * @brief сканирует текст паттернами Chimera кусками не длиннее MAX_SCAN_LENGTH
+     * @param offset[in] смещение \a text от начала всего текста, прибавляется к позициям совпадений
+     * @param error[out] может быть записано ErrorCode::SCAN_ERROR или ErrorCode::NO_MEMORY
+     * @return false, если поиск остановлен обработчиком или ошибкой
+     */
+    static bool ScanChimera(const DatabaseWrapper& dw, const char * text, size_t len, size_t offset,
+                            match_event_handler onEvent, void * ctx, Error * error) {
+        ch_scratch_t * scratch = nullptr;
+        if (ch_clone_scratch(dw.chimeraScratch, &scratch) != CH_SUCCESS) {
+            if (error) *error = Error(ErrorCode::NO_MEMORY);
+            return false;
+        }
+
+        ChimeraContext context{onEvent, ctx, offset};
+        ch_error_t err = CH_SUCCESS;
+        size_t pos = 0;
 
-        assert(dw->scratch);
-        ScratchWrapper sw(dw->scratch);
-        Context ctx{&res, &dw->data};
+        // matches crossing a MAX_SCAN_LENGTH border are not found, chimera has no streaming mode
+        do {
+            size_t chunk = std::min(MAX_SCAN_LENGTH, len - pos);
+            context.offset = offset + pos;
 
-        if (hs_scan(dw->db, text, len, 0, sw.scratch, FindHandler, (void*) &ctx) != HS_SUCCESS && error) {
+            err = ch_scan(dw.chimera->db, text + pos, chunk, 0, scratch, ChimeraHandler, nullptr, &context);
+            pos += chunk;
+        } while (err == CH_SUCCESS && pos < len);
+
+        ch_free_scratch(scratch);
+
+        if (err != CH_SUCCESS && err != CH_SCAN_TERMINATED && error) {
             *error = Error(ErrorCode::SCAN_ERROR);
         }
 
-        return res;
+        return err == CH_SUCCESS;
+    }
+
+    /**
+     * @brief callback ch_scan, пересылает совпадение в обработчик \a %Hyperscan из ChimeraContext
+     */
+    static ch_callback_t ChimeraHandler(unsigned int id, unsigned long long from, unsigned long long to,
+                                        unsigned int flags, unsigned int size, const ch_capture_t * captured, void * ctx) {
+        ChimeraContext * context = reinterpret_cast<ChimeraContext *>(ctx);
+
+        if (context->onEvent(id, context->offset + from, context->offset + to, flags, context->ctx)) {
+            return CH_CALLBACK_TERMINATE;
+        }
+
+        return CH_CALLBACK_CONTINUE;
+    }
+#endif
+
+    /**
+     * @brief нормализованный текст одного поиска, см. SetNormalization
+     *
+     *   Живет до конца поиска, после которого буфер потока исполнения ужимается до NORMALIZER_RETAINED.
+     */
+    struct NormalizedText {
+        /**
+         * @brief заменяет \a text и \a len нормализованным текстом, если включена SetNormalization
+         */
+        NormalizedText(const HyperscanWrapper& hw, const char *& text, size_t& len) {
+            unsigned steps = hw._normalization.load(std::memory_order_relaxed);
+            if (!steps) return;
+
+            // one buffer per thread, shared by all wrappers, a scan on this thread is over before the next one starts
+            static thread_local Normalizer buffer;
+            normalizer = &buffer;
+
+            StringView normalized = normalizer->Normalize(text, len, steps);
+            text = normalized.data();
+            len = normalized.size();
+        }
+
+        NormalizedText(const NormalizedText&) = delete;
+        NormalizedText& operator=(const NormalizedText&) = delete;
+
+        ~NormalizedText() {
+            if (normalizer) normalizer->Shrink(NORMALIZER_RETAINED);
+        }
+
+        Normalizer * normalizer = nullptr;  //!< нормализатор с картой смещений или nullptr, если текст не менялся
+    };
+
+    /**
+     * @brief отозван ли паттерн с айдишником \a id через Revoke
+     */
+    static bool IsDead(const std::atomic<uint64_t> * dead, unsigned int id) {
+        return dead[id / 64].load(std::memory_order_acquire) & (uint64_t(1) << (id % 64));
     }
 
-private:
     /**
      * @brief FindHandler callback вызываемый функцией hs_scan
      *
-     *   Сохраняет в ответ данные соответствующие айдишнику паттерна который сматчился
+     *   Сохраняет в ответ данные соответствующие айдишнику паттерна который сматчился, <br>
+     * если паттерн не отозван через Revoke
      *
      * @param id соответсвтвующий паттерну добавленному в базу данных
      * @param from позиция в тексте начиная с которой сматчился паттерн
@@ -491,33 +4114,305 @@ private:
     static int FindHandler(unsigned int id, unsigned long long from,
                             unsigned long long to, unsigned int flags, void * ctx) {
         Context * context = reinterpret_cast<Context *>(ctx);
+        if (IsDead(context->dead, id)) return 0;
+
+        context->res->push_back((*context->data)[id]);
+
+        return 0;
+    }
+
+    /**
+     * @brief FindBoundedHandler callback вызываемый из Find с ограничениями, останавливает поиск по FindOptions
+     * @param ctx указатель на BoundedContext
+     * @see FindHandler
+     */
+    static int FindBoundedHandler(unsigned int id, unsigned long long from,
+                                  unsigned long long to, unsigned int flags, void * ctx) {
+        BoundedContext * context = reinterpret_cast<BoundedContext *>(ctx);
+        if (IsDead(context->dead, id)) return 0;
+
+        // the budget is full only when one more match exists, hitting it exactly is a complete answer
+        size_t maxMatches = context->options->maxMatches;
+        if (maxMatches && context->res->matches.size() >= maxMatches) {
+            context->res->truncated = true;
+            return 1;
+        }
+
+        context->res->matches.push_back((*context->data)[id]);
+
+        // reading the clock on every match would cost more than the match itself
+        if (++context->events % DEADLINE_CHECK_PERIOD == 0 && context->Expired()) return 1;
+
+        return 0;
+    }
+
+    /**
+     * @brief FindIdsHandler callback вызываемый из FindIds, ставит бит сматчившегося паттерна
+     * @param ctx указатель на MatchSetContext
+     * @see FindHandler
+     */
+    static int FindIdsHandler(unsigned int id, unsigned long long from,
+                              unsigned long long to, unsigned int flags, void * ctx) {
+        MatchSetContext * context = reinterpret_cast<MatchSetContext *>(ctx);
+        if (IsDead(context->dead, id)) return 0;
+
+        context->res->Set(id);
+
+        return 0;
+    }
+
+    /**
+     * @brief CountHandler callback вызываемый из Count, увеличивает счетчики сматчившегося паттерна
+     * @param ctx указатель на HistogramContext
+     * @see FindHandler
+     */
+    static int CountHandler(unsigned int id, unsigned long long from,
+                            unsigned long long to, unsigned int flags, void * ctx) {
+        HistogramContext * context = reinterpret_cast<HistogramContext *>(ctx);
+        if (IsDead(context->dead, id)) return 0;
+
+        context->res->Add(id, context->len);
+
+        return 0;
+    }
+
+    /**
+     * @brief FindMaskHandler callback вызываемый из Find с маской, пропускает выключенные паттерны
+     *        и останавливает поиск, когда сматчились все включенные
+     * @param ctx указатель на MaskContext
+     * @see FindHandler
+     */
+    static int FindMaskHandler(unsigned int id, unsigned long long from,
+                               unsigned long long to, unsigned int flags, void * ctx) {
+        MaskContext * context = reinterpret_cast<MaskContext *>(ctx);
+        if (!context->enabled->Test(id) || context->seen.Test(id) || IsDead(context->dead, id)) return 0;
+
+        context->seen.Set(id);
         context->res->push_back((*context->data)[id]);
 
+        // a pattern revoked after remaining was counted only delays the stop until the end of the text
+        return --context->remaining == 0;
+    }
+
+    /**
+     * @brief FindGroupHandler callback вызываемый из Find по группам, сохраняет данные в ответ группы паттерна
+     * @param ctx указатель на GroupContext
+     * @see FindHandler
+     */
+    static int FindGroupHandler(unsigned int id, unsigned long long from,
+                                unsigned long long to, unsigned int flags, void * ctx) {
+        GroupContext * context = reinterpret_cast<GroupContext *>(ctx);
+        if (IsDead(context->dead, id)) return 0;
+
+        std::vector<DataT> * res = (*context->res)[(*context->groupOf)[id]];
+        if (res) res->push_back((*context->data)[id]);
+
+        return 0;
+    }
+
+    /**
+     * @brief FindMatchHandler callback вызываемый из FindMatches, сохраняет данные вместе с позицией совпадения
+     * @param ctx указатель на MatchContext
+     * @see FindHandler
+     */
+    static int FindMatchHandler(unsigned int id, unsigned long long from,
+                                unsigned long long to, unsigned int flags, void * ctx) {
+        MatchContext * context = reinterpret_cast<MatchContext *>(ctx);
+        if (IsDead(context->dead, id)) return 0;
+
+        context->res->push_back(Match{(*context->data)[id], to});
+
         return 0;
     }
 
 private:
     /**
-     * @brief паттерны добавленные пользователем
+     * @brief паттерны добавленные пользователем, могут содержать нулевые байты, длины в _patternLengths
      */
     std::vector<char *> _patterns;
+    std::vector<size_t> _patternLengths;
 
     /**
      * @brief данные соответсвтующие паттернам
      */
-    std::vector<DataT> _data;
+    DataStore<DataT> _data;
+
+    /**
+     * @brief свободные слоты в _patterns (nullptr) после Delete, переиспользуются в Insert
+     */
+    std::vector<size_t> _free;
+
+    /**
+     * @brief номер группы паттерна по номеру слота
+     */
+    std::vector<size_t> _slotGroup;
+
+    /**
+     * @brief занятые слоты по SlotKey, по нему Insert, Delete, Revoke и PatternId находят слот не перебирая все паттерны
+     */
+    std::unordered_multimap<uint64_t, size_t> _slotIndex;
+
+    /**
+     * @brief имена групп по номеру и номера по имени, группы не удаляются, группа 0 - группа по умолчанию
+     */
+    std::vector<std::string> _groupNames = {std::string()};
+    std::unordered_map<std::string, size_t> _groupIds = {{std::string(), 0}};
+
+    /**
+     * @brief защищает _patterns, _data, _free, группы, _generation, _revoked и _skipped от одновременных изменений и Build
+     */
+    mutable std::mutex _stagingMutex;
+
+    /**
+     * @brief кол-во изменений паттернов, см. Generation
+     */
+    uint64_t _generation = 0;
+
+    /**
+     * @brief отзывы, которые должны попасть в снэпшоты, собранные из более ранних поколений
+     */
+    struct Revoked {
+        size_t slot;
+        std::string pattern;
+        DataT data;
+        uint64_t generation;
+    };
+    std::vector<Revoked> _revoked;
+
+    /**
+     * @brief Build выполняются по очереди
+     */
+    mutable std::mutex _buildMutex;
+
+    /**
+     * @brief последнее собранное и последнее не собравшееся поколения, см. WaitForGeneration
+     */
+    mutable std::mutex _generationMutex;
+    std::condition_variable _generationCv;
+    uint64_t _builtGeneration = 0;
+    uint64_t _failedGeneration = 0;
+    Error _buildError;
+
+    /**
+     * @brief фоновая сборка, см. SetBuildDelay
+     */
+    std::unique_ptr<BuildScheduler> _scheduler;
+
+    /**
+     * @brief кол-во шардов, см. SetShardCount
+     */
+    size_t _shardCount = 1;
+
+    /**
+     * @brief шарды последнего Build по хешу содержимого
+     */
+    std::unordered_map<uint64_t, std::shared_ptr<const Shard>> _shardCache;
+
+#ifdef HYPERSCAN_CHIMERA
+    /**
+     * @brief слоты паттернов, которые не принял \a %Hyperscan, они сразу компилируются Chimera
+     */
+    std::unordered_set<size_t> _fallbackSlots;
+#endif
+
+    /**
+     * @brief пул и счетчики потоков, потоки держат его и после удаления HyperscanWrapper
+     */
+    std::shared_ptr<StreamShared> _streamShared = std::make_shared<StreamShared>();
+
+    /**
+     * @brief шаги нормализации текста перед поиском, см. SetNormalization
+     */
+    std::atomic<unsigned> _normalization{0};
+
+    /**
+     * @brief пропускать ли паттерны, которые не компилируются, см. SetSkipInvalidPatterns
+     */
+    bool _skipInvalid = false;
+
+    /**
+     * @brief слоты паттернов, которые не компилируются, с сообщением об ошибке, Build сразу их пропускает
+     */
+    std::unordered_map<size_t, std::string> _invalidSlots;
 
     /**
-     * @brief указатель на скомпилированную базу данных и продублированные данные
+     * @brief паттерны, пропущенные последним Build, под _stagingMutex
      */
-    std::shared_ptr<DatabaseWrapper> _dw;
+    std::vector<InvalidPattern> _skipped;
 
     /**
-     * @brief временное решение для реализации single Build multiple Find ;)
+     * @brief каталог кэша шардов на диске, см. SetShardCacheDirectory
      */
-    mutable std::mutex _m;
+    std::string _shardCacheDirectory;
+
+    /**
+     * @brief кол-во шардов, скомпилированных последним Build, читается без _buildMutex
+     */
+    std::atomic<size_t> _compiledShards{0};
+
+    /**
+     * @brief кол-во потоков компиляции шардов, см. SetBuildThreads
+     */
+    size_t _buildThreads = 1;
+
+    /**
+     * @brief указатель на скомпилированную базу данных и продублированные данные, синхронизируется SyncPolicy
+     */
+    typename SyncPolicy::template Pointer<DatabaseWrapper> _dw;
+
+    /**
+     * @brief имя и отображение управляющего сегмента для Publish и Attach
+     */
+    std::string _sharedName;
+    std::shared_ptr<SharedSegment> _sharedControl;
+    bool _sharedWritable = false;   //!< _sharedControl отображен для записи через Publish
+
+    /**
+     * @brief последнее опубликованное или подключенное поколение
+     */
+    uint64_t _sharedGeneration = 0;
+
+    /**
+     * @brief последний опубликованный сегмент (отображен для записи) и его снэпшот, под _stagingMutex
+     */
+    std::shared_ptr<SharedSegment> _publishedSegment;
+    std::shared_ptr<DatabaseWrapper> _publishedDw;
+
+    /**
+     * @brief создавать ли реплики базы данных на узлах NUMA, см. SetNumaReplicas
+     */
+    bool _numaReplicas = false;
+
+    /**
+     * @brief компилировать ли потоковые базы в Build, см. SetStreaming
+     */
+    bool _streaming = false;
 };
 
+template <typename DataT, typename SyncPolicy>
+const size_t HyperscanWrapper<DataT, SyncPolicy>::MAX_SCAN_LENGTH;
+
+template <typename DataT, typename SyncPolicy>
+const size_t HyperscanWrapper<DataT, SyncPolicy>::STREAM_WINDOW;
+
+template <typename DataT, typename SyncPolicy>
+const size_t HyperscanWrapper<DataT, SyncPolicy>::DEADLINE_CHECK_PERIOD;
+
+template <typename DataT, typename SyncPolicy>
+const size_t HyperscanWrapper<DataT, SyncPolicy>::NO_SLOT;
+
+template <typename DataT, typename SyncPolicy>
+const size_t HyperscanWrapper<DataT, SyncPolicy>::NORMALIZER_RETAINED;
+
+template <typename DataT, typename SyncPolicy>
+const uint64_t HyperscanWrapper<DataT, SyncPolicy>::FNV_OFFSET;
+
+template <typename DataT, typename SyncPolicy>
+const uint64_t HyperscanWrapper<DataT, SyncPolicy>::FNV_PRIME;
+
+template <typename DataT, typename SyncPolicy>
+const uint64_t HyperscanWrapper<DataT, SyncPolicy>::SHARD_CACHE_MAGIC;
+
 } // namespace Hyperscan
 
 /*! @} End of Doxygen Groups*/
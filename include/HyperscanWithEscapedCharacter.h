@@ -1,8 +1,6 @@
 #ifndef HYPERSCANWITHESCAPEDCHARACTER_H
 #define HYPERSCANWITHESCAPEDCHARACTER_H
 
-#include <set>
-#include <map>
 #include <string>
 #include <Hyperscan.h>
 
@@ -20,20 +18,44 @@ namespace Hyperscan {
  * #bom$ba -> \\#bom\\$ba
  *
  * @tparam DataT - тип данных которые будут возвращены если соответствующий паттерн сматчился
+ * @tparam SyncPolicy - политика синхронизации, см. HyperscanWrapper
  */
-template <typename DataT>
-struct HyperscanWithEscapedCharacter : public HyperscanWrapper<DataT> {
-    using HyperscanWrapper<DataT>::Insert;
-    using HyperscanWrapper<DataT>::Delete;
-
-    bool Insert(const char *pattern, size_t len, const DataT& data, Error * error = nullptr) override {
-        std::string temp = CreateEscapedString(std::string(pattern, len));
-        return HyperscanWrapper<DataT>::Insert(temp.c_str(), temp.size(), data, error);
+template <typename DataT, typename SyncPolicy = MutexSync>
+struct HyperscanWithEscapedCharacter : public HyperscanWrapper<DataT, SyncPolicy> {
+    using HyperscanWrapper<DataT, SyncPolicy>::Insert;
+    using HyperscanWrapper<DataT, SyncPolicy>::Delete;
+    using HyperscanWrapper<DataT, SyncPolicy>::Revoke;
+    using HyperscanWrapper<DataT, SyncPolicy>::PatternId;
+
+    bool Insert(const char *pattern, size_t len, DataT data, Error * error = nullptr) override {
+        const std::string& temp = CreateEscapedString(StringView(pattern, len));
+        return HyperscanWrapper<DataT, SyncPolicy>::Insert(temp.data(), temp.size(), std::move(data), error);
     }
 
     bool Delete(const char *pattern, size_t len, const DataT& data, Error * error = nullptr) override {
-        std::string temp = CreateEscapedString(std::string(pattern, len));
-        return HyperscanWrapper<DataT>::Delete(temp.c_str(), temp.size(), data, error);
+        const std::string& temp = CreateEscapedString(StringView(pattern, len));
+        return HyperscanWrapper<DataT, SyncPolicy>::Delete(temp.data(), temp.size(), data, error);
+    }
+
+    bool Insert(const std::string &group, const char *pattern, size_t len, DataT data, Error * error = nullptr) override {
+        const std::string& temp = CreateEscapedString(StringView(pattern, len));
+        return HyperscanWrapper<DataT, SyncPolicy>::Insert(group, temp.data(), temp.size(), std::move(data), error);
+    }
+
+    bool Delete(const std::string &group, const char *pattern, size_t len, const DataT& data, Error * error = nullptr) override {
+        const std::string& temp = CreateEscapedString(StringView(pattern, len));
+        return HyperscanWrapper<DataT, SyncPolicy>::Delete(group, temp.data(), temp.size(), data, error);
+    }
+
+    bool Revoke(const std::string &group, const char *pattern, size_t len, const DataT& data, Error * error = nullptr) override {
+        const std::string& temp = CreateEscapedString(StringView(pattern, len));
+        return HyperscanWrapper<DataT, SyncPolicy>::Revoke(group, temp.data(), temp.size(), data, error);
+    }
+
+    bool PatternId(const std::string &group, const char *pattern, size_t len, const DataT& data, size_t * id,
+                   Error * error = nullptr) const override {
+        const std::string& temp = CreateEscapedString(StringView(pattern, len));
+        return HyperscanWrapper<DataT, SyncPolicy>::PatternId(group, temp.data(), temp.size(), data, id, error);
     }
 
 private:
@@ -41,27 +63,35 @@ private:
      * Ex: *bomba* -> .*bomba.*
      *     bom?b?* -> bom.b..*
      *     #bom$ba -> \#bom\$ba
+     *
+     * The result lives in a per-thread buffer until the next call on this thread,
+     * the base class copies it anyway.
      */
-    std::string CreateEscapedString(const std::string pattern) {
-        const std::set<char> specials = {'-' ,'[' ,']' ,'/' ,'{' ,'}' ,'(' ,')' ,'*' ,'+' ,'?' ,'^' ,'$' ,'|', '.', ',', '#'};
-
-        const std::map<char, std::string> converter = {{'*', ".*"},
-                                                       {'?', "."}};
-
+    static const std::string& CreateEscapedString(StringView pattern) {
+        static thread_local std::string res;
 
-        std::string res;
+        res.clear();
         res.reserve(pattern.size() * 2);
 
         bool escaped = false;
         for (char c: pattern) {
             if (!escaped) {
-                if (c == '\\') {
-                    escaped = true;
-                } else if (converter.count(c)) {
-                    res.append(converter.at(c));
-                    continue;
-                } else  if (specials.count(c)) {
-                    res.push_back('\\');
+                switch (c) {
+                    case '\\':
+                        escaped = true;
+                        break;
+                    case '*':
+                        res.append(".*");
+                        continue;
+                    case '?':
+                        res.push_back('.');
+                        continue;
+                    case '-': case '[': case ']': case '/': case '{': case '}': case '(': case ')':
+                    case '+': case '^': case '$': case '|': case '.': case ',': case '#':
+                        res.push_back('\\');
+                        break;
+                    default:
+                        break;
                 }
             } else {
                 escaped = false;
@@ -0,0 +1,312 @@
+#ifndef NORMALIZER_H
+#define NORMALIZER_H
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HYPERSCAN_NORMALIZER_X86
+#endif
+
+#include <StringView.h>
+
+namespace Hyperscan {
+
+/**
+ * @brief нормализация текста перед поиском, см. HyperscanWrapper::SetNormalization
+ *
+ *   Шаги выполняются за один проход в порядке: percent-декодирование, приведение ASCII к нижнему регистру, <br>
+ * схлопывание пробельных символов (пробел, \\t, \\n, \\v, \\f, \\r) в один пробел. Блоки по 16 (SSE2) или 32 (AVX2, <br>
+ * если его поддерживает процессор) байт без '%' и без повторных пробелов обрабатываются целиком, <br>
+ * остальные байты по одному. Некорректные %-последовательности остаются как есть. <br> <br>
+ *
+ *   Результат пишется в буфер, который переиспользуется следующим вызовом. Пока длина не меняется, <br>
+ * смещения совпадают, а в местах изменения запоминаются точки, по которым OriginalOffset переводит <br>
+ * смещение в нормализованном тексте в смещение в исходном.
+ *
+ * @remark не thread-safe, по одному на поток исполнения
+ */
+class Normalizer {
+public:
+    /**
+     * @brief шаги нормализации, комбинируются через |
+     */
+    enum Step : unsigned {
+        LOWERCASE = 1,          //!< ASCII A-Z -> a-z
+        PERCENT_DECODE = 2,     //!< %XX -> байт XX
+        FOLD_WHITESPACE = 4     //!< подряд идущие пробельные символы -> один пробел
+    };
+
+    Normalizer() = default;
+
+    Normalizer(const Normalizer&) = delete;
+    Normalizer& operator=(const Normalizer&) = delete;
+
+    /**
+     * @brief нормализует текст
+     * @param[in] steps комбинация Step
+     * @return нормализованный текст, живет до следующего вызова Normalize
+     */
+    StringView Normalize(const char * text, size_t len, unsigned steps) {
+        // blocks are stored whole, so the buffer has room for one block past the end
+        if (_buffer.size() < len + BLOCK_SLACK) _buffer.resize(len + BLOCK_SLACK);
+
+        _points.clear();
+        _inLen = len;
+        _outLen = 0;
+
+        if (!steps) {
+            memcpy(_buffer.data(), text, len);
+            _outLen = len;
+            return StringView(_buffer.data(), _outLen);
+        }
+
+#ifdef HYPERSCAN_NORMALIZER_X86
+        if (HasAvx2()) {
+            Run<32>(text, len, steps, BlockAvx2);
+        } else {
+            Run<16>(text, len, steps, BlockSse2);
+        }
+#else
+        Run<16>(text, len, steps, nullptr);
+#endif
+
+        return StringView(_buffer.data(), _outLen);
+    }
+
+    /**
+     * @brief смещение в исходном тексте, соответствующее смещению \a offset в нормализованном
+     *
+     *   Начало нормализованного байта переводится в начало байтов, из которых он получился, <br>
+     * поэтому конец совпадения переводится в конец исходного фрагмента, включая схлопнутые пробелы.
+     *
+     * @param offset смещение от 0 до длины нормализованного текста включительно
+     */
+    size_t OriginalOffset(size_t offset) const {
+        if (offset >= _outLen) return _inLen;
+
+        auto it = std::upper_bound(_points.begin(), _points.end(), offset, [](size_t value, const Point& p) {
+            return value < p.out;
+        });
+
+        if (it == _points.begin()) return offset;
+
+        --it;
+        return it->in + (offset - it->out);
+    }
+
+    /**
+     * @brief отдает память буфера, если он занимает больше \a maxRetained байт
+     *
+     *   Буфер растет под самый длинный текст, и без этого один огромный текст держал бы память до конца <br>
+     * жизни нормализатора. Карта смещений последнего текста после этого недействительна.
+     */
+    void Shrink(size_t maxRetained) {
+        if (_buffer.capacity() > maxRetained) std::vector<char>().swap(_buffer);
+        if (_points.capacity() * sizeof(Point) > maxRetained) std::vector<Point>().swap(_points);
+    }
+
+    /**
+     * @brief сколько байт занимают буферы нормализатора
+     */
+    size_t Capacity() const {
+        return _buffer.capacity() + _points.capacity() * sizeof(Point);
+    }
+
+    /**
+     * @brief поддерживает ли процессор AVX2
+     */
+    static bool HasAvx2() {
+#ifdef HYPERSCAN_NORMALIZER_X86
+        static const bool res = __builtin_cpu_supports("avx2");
+        return res;
+#else
+        return false;
+#endif
+    }
+
+private:
+    static const size_t BLOCK_SLACK = 32;
+
+    /**
+     * @brief с этого места нормализованного текста смещения в исходном сдвинуты: байт out получен из байта in
+     */
+    struct Point {
+        size_t out;
+        size_t in;
+    };
+
+    /**
+     * @brief обрабатывает блок целиком и записывает его в \a out
+     * @param ws[out] маска пробельных символов блока
+     * @return маска '%' блока
+     */
+    typedef uint32_t (*BlockFn)(const char * in, char * out, unsigned steps, uint32_t * ws);
+
+    template <size_t W>
+    void Run(const char * text, size_t len, unsigned steps, BlockFn block) {
+        char * out = _buffer.data();
+        size_t i = 0;
+        bool lastSpace = false;     // the last output byte is a folded whitespace
+
+        while (block && len - i >= W) {
+            uint32_t ws = 0;
+            uint32_t problem = block(text + i, out + _outLen, steps, &ws);
+
+            // a whitespace right after another one is dropped, the block can not be taken whole
+            problem |= ws & ((ws << 1) | (lastSpace ? 1u : 0u));
+
+            if (!problem) {
+                _outLen += W;
+                i += W;
+                lastSpace = ws >> (W - 1);
+                continue;
+            }
+
+            // the bytes before the first problem are already in place
+            size_t p = __builtin_ctz(problem);
+            _outLen += p;
+            i += p;
+            if (p) lastSpace = (ws >> (p - 1)) & 1;
+
+            i = Scalar(text, len, i, steps, lastSpace);
+        }
+
+        while (i < len) {
+            i = Scalar(text, len, i, steps, lastSpace);
+        }
+    }
+
+    /**
+     * @brief обрабатывает байт \a i (или %-последовательность или серию пробелов с него)
+     * @return позиция следующего необработанного байта
+     */
+    size_t Scalar(const char * text, size_t len, size_t i, unsigned steps, bool& lastSpace) {
+        unsigned char c = text[i];
+        size_t next = i + 1;
+
+        if ((steps & PERCENT_DECODE) && c == '%' && len - i >= 3 && IsHex(text[i + 1]) && IsHex(text[i + 2])) {
+            c = (Hex(text[i + 1]) << 4) | Hex(text[i + 2]);
+            next = i + 3;
+        }
+
+        if ((steps & LOWERCASE) && c >= 'A' && c <= 'Z') {
+            c |= 0x20;
+        }
+
+        if ((steps & FOLD_WHITESPACE) && IsSpace(c)) {
+            if (lastSpace) {
+                // dropped, the bytes after it are shifted
+                Shift(next);
+                return next;
+            }
+
+            c = ' ';
+            lastSpace = true;
+        } else {
+            lastSpace = false;
+        }
+
+        _buffer[_outLen++] = c;
+        if (next != i + 1) Shift(next);
+
+        return next;
+    }
+
+    /**
+     * @brief запоминает, что следующий байт нормализованного текста получен из байта \a in
+     */
+    void Shift(size_t in) {
+        if (!_points.empty() && _points.back().out == _outLen) {
+            _points.back().in = in;
+        } else {
+            _points.push_back(Point{_outLen, in});
+        }
+    }
+
+    static bool IsSpace(unsigned char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    static bool IsHex(char c) {
+        return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+    }
+
+    static unsigned char Hex(char c) {
+        return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+    }
+
+#ifdef HYPERSCAN_NORMALIZER_X86
+    // signed compares: bytes >= 0x80 are negative and never fall into the ASCII ranges
+    static uint32_t BlockSse2(const char * in, char * out, unsigned steps, uint32_t * ws) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+        __m128i t = c;
+        uint32_t percent = 0;
+
+        if (steps & LOWERCASE) {
+            __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)),
+                                          _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+            t = _mm_or_si128(t, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        }
+
+        if (steps & PERCENT_DECODE) {
+            percent = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('%')));
+        }
+
+        *ws = 0;
+        if (steps & FOLD_WHITESPACE) {
+            __m128i space = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+                                         _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('\t' - 1)),
+                                                       _mm_cmplt_epi8(c, _mm_set1_epi8('\r' + 1))));
+            *ws = _mm_movemask_epi8(space);
+            t = _mm_or_si128(_mm_andnot_si128(space, t), _mm_and_si128(space, _mm_set1_epi8(' ')));
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), t);
+        return percent;
+    }
+
+    __attribute__((target("avx2")))
+    static uint32_t BlockAvx2(const char * in, char * out, unsigned steps, uint32_t * ws) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+        __m256i t = c;
+        uint32_t percent = 0;
+
+        if (steps & LOWERCASE) {
+            __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)),
+                                             _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+            t = _mm256_or_si256(t, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+        }
+
+        if (steps & PERCENT_DECODE) {
+            percent = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('%')));
+        }
+
+        *ws = 0;
+        if (steps & FOLD_WHITESPACE) {
+            __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+                                            _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('\t' - 1)),
+                                                             _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), c)));
+            *ws = _mm256_movemask_epi8(space);
+            t = _mm256_blendv_epi8(t, _mm256_set1_epi8(' '), space);
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), t);
+        return percent;
+    }
+#endif
+
+private:
+    std::vector<char> _buffer;
+    std::vector<Point> _points;     //!< по возрастанию out
+    size_t _inLen = 0;
+    size_t _outLen = 0;
+};
+
+} // namespace Hyperscan
+
+#endif // NORMALIZER_H
@@ -0,0 +1,133 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <sched.h>
+#include <pthread.h>
+
+namespace Hyperscan {
+
+/**
+ * @brief топология NUMA машины, прочитанная из /sys/devices/system/node
+ *
+ *   Используется HyperscanWrapper для размещения реплик базы данных на каждом узле. <br>
+ * Память реплики выделяется и впервые трогается потоком, привязанным к процессорам узла, <br>
+ * поэтому по политике first-touch она оказывается в памяти этого узла, libnuma не нужна. <br>
+ * Если sysfs недоступен, считается что узел один.
+ */
+class NumaTopology {
+public:
+    /**
+     * @brief топология текущей машины, читается один раз
+     */
+    static const NumaTopology& Instance() {
+        static NumaTopology topology;
+        return topology;
+    }
+
+    /**
+     * @brief кол-во узлов (максимальный номер узла + 1), номера узлов могут идти с пропусками
+     */
+    size_t NodeCount() const {
+        return _cpus.size();
+    }
+
+    /**
+     * @brief процессоры узла \a node, пустой вектор если такого узла нет
+     */
+    const std::vector<int>& Cpus(size_t node) const {
+        static const std::vector<int> empty;
+        return node < _cpus.size() ? _cpus[node] : empty;
+    }
+
+    /**
+     * @brief узел, на котором сейчас выполняется вызывающий поток
+     */
+    size_t CurrentNode() const {
+        int cpu = sched_getcpu();
+        return cpu >= 0 && (size_t) cpu < _nodeOfCpu.size() ? _nodeOfCpu[cpu] : 0;
+    }
+
+    /**
+     * @brief привязывает вызывающий поток к процессорам узла \a node
+     * @return false если узла нет или привязать не удалось
+     */
+    bool PinCurrentThread(size_t node) const {
+        const std::vector<int>& cpus = Cpus(node);
+        if (cpus.empty()) return false;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu: cpus) {
+            CPU_SET(cpu, &set);
+        }
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    /**
+     * @brief выполняет \a f в отдельном потоке, привязанном к узлу \a node, и дожидается окончания
+     */
+    template <typename F>
+    void RunOnNode(size_t node, F f) const {
+        std::thread t([this, node, &f]() {
+            PinCurrentThread(node);
+            f();
+        });
+        t.join();
+    }
+
+private:
+    NumaTopology() {
+        std::vector<int> nodes = ReadList("/sys/devices/system/node/online");
+
+        for (int node: nodes) {
+            if ((size_t) node >= _cpus.size()) _cpus.resize(node + 1);
+            _cpus[node] = ReadList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+
+            for (int cpu: _cpus[node]) {
+                if ((size_t) cpu >= _nodeOfCpu.size()) _nodeOfCpu.resize(cpu + 1, 0);
+                _nodeOfCpu[cpu] = node;
+            }
+        }
+
+        if (_cpus.empty()) _cpus.resize(1);
+    }
+
+    /**
+     * @brief читает список в формате sysfs, например "0-3,8-11"
+     */
+    static std::vector<int> ReadList(const std::string& path) {
+        std::vector<int> res;
+        std::ifstream file(path);
+        std::string range;
+
+        while (std::getline(file, range, ',')) {
+            std::istringstream in(range);
+            int from, to;
+            char dash;
+
+            if (!(in >> from)) continue;
+            if (!(in >> dash >> to)) to = from;
+
+            for (int i = from; i <= to; ++i) {
+                res.push_back(i);
+            }
+        }
+
+        return res;
+    }
+
+private:
+    std::vector<std::vector<int>> _cpus;
+    std::vector<size_t> _nodeOfCpu;
+};
+
+} // namespace Hyperscan
+
+#endif // NUMA_H
@@ -0,0 +1,173 @@
+#ifndef PATTERNMASK_H
+#define PATTERNMASK_H
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace Hyperscan {
+
+/**
+ * @brief битовая маска паттернов по айдишнику, см. HyperscanWrapper::PatternId
+ *
+ *   Передается в HyperscanWrapper::Find, чтобы включать и выключать паттерны на каждый запрос <br>
+ * без отдельной базы данных на каждую комбинацию: выключенные паттерны сканируются, <br>
+ * но их совпадения отбрасываются. Ее же заполняет HyperscanWrapper::FindIds сматчившимися паттернами. <br>
+ * Маска растет при Set, айдишники за ее концом выключены.
+ */
+class PatternMask {
+public:
+    PatternMask() = default;
+
+    /**
+     * @param size сколько айдишников выделить сразу, все выключены
+     */
+    explicit PatternMask(size_t size)
+        : _words((size + 63) / 64, 0)
+    {}
+
+    /**
+     * @brief включает или выключает паттерн с айдишником \a id
+     */
+    void Set(size_t id, bool value = true) {
+        if (id / 64 >= _words.size()) {
+            if (!value) return;
+            _words.resize(id / 64 + 1, 0);
+        }
+
+        if (value) {
+            _words[id / 64] |= uint64_t(1) << (id % 64);
+        } else {
+            _words[id / 64] &= ~(uint64_t(1) << (id % 64));
+        }
+    }
+
+    /**
+     * @brief включен ли паттерн с айдишником \a id
+     */
+    bool Test(size_t id) const {
+        return id / 64 < _words.size() && (_words[id / 64] & (uint64_t(1) << (id % 64)));
+    }
+
+    /**
+     * @brief выключает все паттерны
+     */
+    void Clear() {
+        _words.assign(_words.size(), 0);
+    }
+
+    /**
+     * @brief выключает все паттерны и выделяет место под \a size айдишников, память не освобождается
+     */
+    void Reset(size_t size) {
+        _words.assign((size + 63) / 64, 0);
+    }
+
+    /**
+     * @brief есть ли хоть один включенный паттерн
+     */
+    bool Any() const {
+        for (uint64_t w: _words) {
+            if (w) return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief кол-во включенных паттернов
+     */
+    size_t Count() const {
+        size_t res = 0;
+        for (uint64_t w: _words) {
+            res += __builtin_popcountll(w);
+        }
+
+        return res;
+    }
+
+    /**
+     * @brief вызывает \a f(id) для каждого включенного айдишника по возрастанию
+     */
+    template <typename F>
+    void ForEach(F f) const {
+        for (size_t i = 0; i < _words.size(); ++i) {
+            for (uint64_t w = _words[i]; w; w &= w - 1) {
+                f(i * 64 + __builtin_ctzll(w));
+            }
+        }
+    }
+
+    /**
+     * @brief пересечение
+     */
+    PatternMask& operator&=(const PatternMask& other) {
+        for (size_t i = 0; i < _words.size(); ++i) {
+            _words[i] &= i < other._words.size() ? other._words[i] : 0;
+        }
+
+        return *this;
+    }
+
+    /**
+     * @brief объединение
+     */
+    PatternMask& operator|=(const PatternMask& other) {
+        if (other._words.size() > _words.size()) _words.resize(other._words.size(), 0);
+
+        for (size_t i = 0; i < other._words.size(); ++i) {
+            _words[i] |= other._words[i];
+        }
+
+        return *this;
+    }
+
+    /**
+     * @brief разность
+     */
+    PatternMask& operator-=(const PatternMask& other) {
+        for (size_t i = 0; i < std::min(_words.size(), other._words.size()); ++i) {
+            _words[i] &= ~other._words[i];
+        }
+
+        return *this;
+    }
+
+    bool operator==(const PatternMask& other) const {
+        size_t common = std::min(_words.size(), other._words.size());
+
+        for (size_t i = 0; i < common; ++i) {
+            if (_words[i] != other._words[i]) return false;
+        }
+
+        // trailing zero words do not change the set
+        for (size_t i = common; i < _words.size(); ++i) {
+            if (_words[i]) return false;
+        }
+
+        for (size_t i = common; i < other._words.size(); ++i) {
+            if (other._words[i]) return false;
+        }
+
+        return true;
+    }
+
+    bool operator!=(const PatternMask& other) const {
+        return !(*this == other);
+    }
+
+    /**
+     * @brief маска по 64 айдишника в слове, айдишник id - бит id % 64 слова id / 64
+     */
+    const std::vector<uint64_t>& Words() const {
+        return _words;
+    }
+
+private:
+    std::vector<uint64_t> _words;
+};
+
+} // namespace Hyperscan
+
+#endif // PATTERNMASK_H
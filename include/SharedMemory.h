@@ -0,0 +1,159 @@
+#ifndef SHAREDMEMORY_H
+#define SHAREDMEMORY_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Hyperscan {
+
+/**
+ * @brief RAII обертка над отображенным в память сегментом POSIX shared memory
+ *
+ *   Используется в HyperscanWrapper::Publish и HyperscanWrapper::Attach, чтобы один процесс <br>
+ * компилировал базу данных, а остальные отображали ее только для чтения.
+ */
+class SharedSegment {
+public:
+    /**
+     * @brief создает новый сегмент размера \a size и отображает его для записи
+     * @return nullptr, если сегмент уже существует или не удалось выделить память
+     */
+    static std::shared_ptr<SharedSegment> Create(const std::string& name, size_t size) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd == -1) return nullptr;
+
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+
+        std::shared_ptr<SharedSegment> res = Map(fd, size, true);
+        if (!res) shm_unlink(name.c_str());
+        return res;
+    }
+
+    /**
+     * @brief открывает существующий сегмент, или создает его размера \a size, если его еще нет
+     */
+    static std::shared_ptr<SharedSegment> OpenOrCreate(const std::string& name, size_t size) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd == -1) return nullptr;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || ((size_t) st.st_size < size && ftruncate(fd, size) != 0)) {
+            close(fd);
+            return nullptr;
+        }
+
+        return Map(fd, size, true);
+    }
+
+    /**
+     * @brief открывает существующий сегмент целиком
+     * @param writable false - отобразить только для чтения
+     * @return nullptr, если сегмента нет
+     */
+    static std::shared_ptr<SharedSegment> Open(const std::string& name, bool writable = false) {
+        int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+        if (fd == -1) return nullptr;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return nullptr;
+        }
+
+        return Map(fd, st.st_size, writable);
+    }
+
+    /**
+     * @brief удаляет имя сегмента, уже отображенные сегменты остаются валидными
+     */
+    static void Unlink(const std::string& name) {
+        shm_unlink(name.c_str());
+    }
+
+    ~SharedSegment() {
+        munmap(_data, _size);
+    }
+
+    char * Data() const {
+        return _data;
+    }
+
+    size_t Size() const {
+        return _size;
+    }
+
+private:
+    SharedSegment(char * data, size_t size)
+        : _data(data)
+        , _size(size)
+    {}
+
+    static std::shared_ptr<SharedSegment> Map(int fd, size_t size, bool writable) {
+        void * data = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED) return nullptr;
+        return std::shared_ptr<SharedSegment>(new SharedSegment((char *) data, size));
+    }
+
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+
+private:
+    char * _data;
+    size_t _size;
+};
+
+/**
+ * @brief управляющий сегмент, по нему рабочие процессы узнают о новом поколении базы данных
+ *
+ *   Поколение N лежит в сегменте с именем "<name>.N", поколение 0 означает, что ничего не опубликовано.
+ */
+struct SharedControl {
+    std::atomic<uint64_t> generation;
+};
+
+/**
+ * @brief заголовок сегмента с опубликованной базой данных, все смещения от начала сегмента
+ */
+struct SharedHeader {
+    static const uint64_t MAGIC = 0x48595045525334ull; // "HYPERS4"
+
+    uint64_t magic;
+    uint64_t generation;
+    uint64_t count;             //!< кол-во слотов паттернов, длина массива DataT
+    uint64_t dataOffset;        //!< массив DataT по номеру слота
+    uint64_t deadOffset;        //!< (count + 63) / 64 слов отозванных айдишников, публикующий процесс дописывает их в Revoke
+    uint64_t shardCount;        //!< кол-во шардов, 0 если паттернов нет
+    uint64_t shardsOffset;      //!< массив SharedShard
+};
+
+/**
+ * @brief описание одного шарда в сегменте, все смещения от начала сегмента
+ */
+struct SharedShard {
+    uint64_t hash;              //!< хеш содержимого шарда
+    uint64_t dbOffset;          //!< база данных, развернутая hs_deserialize_database_at
+    uint64_t count;             //!< кол-во паттернов в шарде
+    uint64_t idsOffset;         //!< count айдишников паттернов (uint32_t)
+    uint64_t patternsOffset;    //!< count + 1 смещений внутри patternsBytes
+    uint64_t patternsBytes;     //!< паттерны подряд
+    uint64_t groupOffset;       //!< имя группы шарда
+    uint64_t groupBytes;        //!< длина имени группы
+};
+
+} // namespace Hyperscan
+
+#endif // SHAREDMEMORY_H
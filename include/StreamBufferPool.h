@@ -0,0 +1,124 @@
+#ifndef STREAMBUFFERPOOL_H
+#define STREAMBUFFERPOOL_H
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <cstddef>
+
+namespace Hyperscan {
+
+/**
+ * @brief пул буферов под сжатое состояние потоков, см. HyperscanWrapper::Stream::Compress
+ *
+ *   Сжатое состояние одного потока - десятки-сотни байт, а сжимаются и разжимаются они постоянно, <br>
+ * поэтому буферы не берутся из malloc по одному, а нарезаются блоками по BLOCK_SIZE из слабов <br>
+ * по SLAB_SIZE. Освобожденный буфер попадает в список свободных своего размера и отдается <br>
+ * следующему потоку с тем же размером. Буферы больше SLAB_SIZE / 4 выделяются отдельно. <br> <br>
+ *
+ *   Память слабов не возвращается системе до удаления пула.
+ *
+ * @remark thread-safe
+ */
+class StreamBufferPool {
+public:
+    /**
+     * @brief гранулярность размера буфера
+     */
+    static const size_t BLOCK_SIZE = 64;
+
+    /**
+     * @brief размер слаба, из которого нарезаются буферы
+     */
+    static const size_t SLAB_SIZE = 1 << 20;
+
+    StreamBufferPool() = default;
+
+    StreamBufferPool(const StreamBufferPool&) = delete;
+    StreamBufferPool& operator=(const StreamBufferPool&) = delete;
+
+    /**
+     * @brief выделяет буфер не меньше \a size байт
+     * @param capacity[out] настоящий размер буфера, его нужно передать в Free
+     * @return nullptr, если память закончилась
+     */
+    char * Allocate(size_t size, size_t * capacity) {
+        size_t rounded = (std::max<size_t>(size, 1) + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        *capacity = rounded;
+
+        if (rounded > SLAB_SIZE / 4) {
+            return new (std::nothrow) char[rounded];
+        }
+
+        std::lock_guard<std::mutex> lock(_m);
+
+        std::vector<char *>& free = _free[rounded];
+        if (!free.empty()) {
+            char * res = free.back();
+            free.pop_back();
+            _freeBytes -= rounded;
+            return res;
+        }
+
+        if (_slabs.empty() || _slabUsed + rounded > SLAB_SIZE) {
+            char * slab = new (std::nothrow) char[SLAB_SIZE];
+            if (!slab) return nullptr;
+
+            // the tail of the previous slab is lost, at most SLAB_SIZE / 4 per slab
+            _slabs.emplace_back(slab);
+            _slabUsed = 0;
+        }
+
+        char * res = _slabs.back().get() + _slabUsed;
+        _slabUsed += rounded;
+        return res;
+    }
+
+    /**
+     * @brief возвращает в пул буфер, полученный из Allocate
+     */
+    void Free(char * buffer, size_t capacity) {
+        if (!buffer) return;
+
+        if (capacity > SLAB_SIZE / 4) {
+            delete[] buffer;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(_m);
+        _free[capacity].push_back(buffer);
+        _freeBytes += capacity;
+    }
+
+    /**
+     * @brief память всех слабов пула, включая свободные буферы
+     */
+    size_t ReservedBytes() const {
+        std::lock_guard<std::mutex> lock(_m);
+        return _slabs.size() * SLAB_SIZE;
+    }
+
+    /**
+     * @brief память свободных буферов в слабах
+     */
+    size_t FreeBytes() const {
+        std::lock_guard<std::mutex> lock(_m);
+        return _freeBytes;
+    }
+
+private:
+    mutable std::mutex _m;
+
+    std::vector<std::unique_ptr<char[]>> _slabs;
+    size_t _slabUsed = 0;        //!< занято в последнем слабе
+
+    std::unordered_map<size_t, std::vector<char *>> _free;   //!< свободные буферы по размеру
+    size_t _freeBytes = 0;
+};
+
+} // namespace Hyperscan
+
+#endif // STREAMBUFFERPOOL_H
@@ -0,0 +1,116 @@
+#ifndef STRINGVIEW_H
+#define STRINGVIEW_H
+
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace Hyperscan {
+
+/**
+ * @brief невладеющая ссылка на байты: указатель и длина, аналог std::string_view для C++11
+ *
+ *   Неявно создается из std::string, std::string_view и строкового литерала, поэтому методы, <br>
+ * принимающие StringView, не копируют паттерн или текст во временный std::string. <br>
+ * Длина всегда явная, нулевые байты внутри - обычные символы, завершающий ноль не нужен.
+ */
+class StringView {
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    StringView() = default;
+
+    StringView(const char * data, size_t size)
+        : _data(data)
+        , _size(size)
+    {}
+
+    /**
+     * @brief строка до завершающего нуля
+     */
+    StringView(const char * str)
+        : _data(str)
+        , _size(str ? strlen(str) : 0)
+    {}
+
+    StringView(const std::string& str)
+        : _data(str.data())
+        , _size(str.size())
+    {}
+
+#if __cplusplus >= 201703L
+    StringView(std::string_view str)
+        : _data(str.data())
+        , _size(str.size())
+    {}
+
+    operator std::string_view() const {
+        return std::string_view(_data, _size);
+    }
+#endif
+
+    const char * data() const { return _data; }
+    size_t size() const { return _size; }
+    size_t length() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    const char * begin() const { return _data; }
+    const char * end() const { return _data + _size; }
+
+    char operator[](size_t i) const { return _data[i]; }
+
+    StringView substr(size_t pos, size_t count = npos) const {
+        pos = std::min(pos, _size);
+        return StringView(_data + pos, std::min(count, _size - pos));
+    }
+
+    /**
+     * @brief первое вхождение \a needle не раньше \a pos или npos
+     */
+    size_t find(StringView needle, size_t pos = 0) const {
+        if (pos > _size || needle._size > _size - pos) return npos;
+
+        const char * it = std::search(_data + pos, end(), needle.begin(), needle.end());
+        return it == end() ? (needle.empty() ? pos : npos) : it - _data;
+    }
+
+    /**
+     * @brief первое вхождение байта \a c не раньше \a pos или npos
+     */
+    size_t find(char c, size_t pos = 0) const {
+        if (pos >= _size) return npos;
+
+        const void * it = memchr(_data + pos, c, _size - pos);
+        return it ? static_cast<const char *>(it) - _data : npos;
+    }
+
+    std::string ToString() const {
+        return std::string(_data, _size);
+    }
+
+    friend bool operator==(StringView a, StringView b) {
+        return a._size == b._size && (a._size == 0 || memcmp(a._data, b._data, a._size) == 0);
+    }
+
+    friend bool operator!=(StringView a, StringView b) {
+        return !(a == b);
+    }
+
+    friend bool operator<(StringView a, StringView b) {
+        int cmp = a._size && b._size ? memcmp(a._data, b._data, std::min(a._size, b._size)) : 0;
+        return cmp < 0 || (cmp == 0 && a._size < b._size);
+    }
+
+private:
+    const char * _data = nullptr;
+    size_t _size = 0;
+};
+
+} // namespace Hyperscan
+
+#endif // STRINGVIEW_H
@@ -0,0 +1,306 @@
+#ifndef SYNCPOLICY_H
+#define SYNCPOLICY_H
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cstdint>
+
+namespace Hyperscan {
+
+/**
+ * @brief политики синхронизации HyperscanWrapper, второй параметр шаблона
+ *
+ *   Политика определяет, как Find получает текущий снэпшот, а Build и Attach его подменяют. <br>
+ * Каждая политика предоставляет шаблон Pointer<T> с методами: <br>
+ * Read() - ReadGuard, через который читатель обращается к снэпшоту, пока guard жив; <br>
+ * Store(std::shared_ptr<T>) - публикует новый снэпшот, старый удаляется, когда его больше никто не читает; <br>
+ * Exchange(std::shared_ptr<T>) - первая половина Store: публикует новый снэпшот и возвращает старый, не дожидаясь читателей; <br>
+ * Reclaim(std::shared_ptr<T>) - вторая половина Store: отпускает старый снэпшот, когда его больше никто не читает; <br>
+ * Get() - std::shared_ptr<T> на текущий снэпшот для писателей.
+ *
+ * @see NoSync
+ * @see MutexSync
+ * @see RcuSync
+ */
+
+/**
+ * @brief без синхронизации: для HyperscanWrapper, который используется из одного потока
+ *
+ *   Find не берет блокировок и не трогает счетчик ссылок снэпшота.
+ */
+struct NoSync {
+    template <typename T>
+    class Pointer {
+    public:
+        class ReadGuard {
+        public:
+            explicit ReadGuard(T * ptr)
+                : _ptr(ptr)
+            {}
+
+            T * Get() const {
+                return _ptr;
+            }
+
+        private:
+            T * _ptr;
+        };
+
+        ReadGuard Read() const {
+            return ReadGuard(_ptr.get());
+        }
+
+        void Store(std::shared_ptr<T> ptr) {
+            _ptr = std::move(ptr);
+        }
+
+        std::shared_ptr<T> Exchange(std::shared_ptr<T> ptr) {
+            _ptr.swap(ptr);
+            return ptr;
+        }
+
+        void Reclaim(std::shared_ptr<T>) {
+        }
+
+        std::shared_ptr<T> Get() const {
+            return _ptr;
+        }
+
+    private:
+        std::shared_ptr<T> _ptr;
+    };
+};
+
+/**
+ * @brief мьютекс: Find копирует std::shared_ptr на снэпшот под мьютексом, по умолчанию
+ */
+struct MutexSync {
+    template <typename T>
+    class Pointer {
+    public:
+        class ReadGuard {
+        public:
+            explicit ReadGuard(std::shared_ptr<T> ptr)
+                : _ptr(std::move(ptr))
+            {}
+
+            T * Get() const {
+                return _ptr.get();
+            }
+
+        private:
+            std::shared_ptr<T> _ptr;
+        };
+
+        ReadGuard Read() const {
+            return ReadGuard(Get());
+        }
+
+        void Store(std::shared_ptr<T> ptr) {
+            Reclaim(Exchange(std::move(ptr)));
+        }
+
+        std::shared_ptr<T> Exchange(std::shared_ptr<T> ptr) {
+            _m.lock();
+            _ptr.swap(ptr);
+            _m.unlock();
+
+            // the old snapshot, if this was the last reference, is destroyed outside the lock
+            return ptr;
+        }
+
+        void Reclaim(std::shared_ptr<T>) {
+            // readers hold their own references, the last one destroys the snapshot
+        }
+
+        std::shared_ptr<T> Get() const {
+            std::lock_guard<std::mutex> lock(_m);
+            return _ptr;
+        }
+
+    private:
+        mutable std::mutex _m;
+        std::shared_ptr<T> _ptr;
+    };
+};
+
+/**
+ * @brief read-copy-update: Find не берет блокировок и ничего не пишет в общую память
+ *
+ *   Читатель объявляет в своей, локальной для потока, ячейке эпоху, в которой начал чтение, <br>
+ * и читает атомарный указатель на снэпшот. Store публикует новый указатель, увеличивает эпоху <br>
+ * и ждет, пока закончат все читатели, начавшие раньше (grace period), только после этого <br>
+ * отпускает старый снэпшот. Поэтому Build ждет окончания уже идущих Find, а Find не ждет никого. <br>
+ * Build ждет в Reclaim, уже отпустив свои блокировки, так что Insert и Revoke не ждут читателей. <br>
+ * Ячейки потоков общие для всех объектов, чтение вложенное в чтение допустимо.
+ *
+ * @remark нельзя вызывать Store из потока, который сейчас держит ReadGuard
+ */
+struct RcuSync {
+    /**
+     * @brief общий для процесса реестр читателей
+     */
+    class Domain {
+    public:
+        static Domain& Instance() {
+            static Domain domain;
+            return domain;
+        }
+
+        /**
+         * @brief ячейка читателя, по одной на поток
+         */
+        struct alignas(64) Reader {
+            std::atomic<uint64_t> epoch{0};  //!< 0 если поток не читает, иначе эпоха начала чтения
+            unsigned depth = 0;              //!< глубина вложенных чтений, трогает только сам поток
+        };
+
+        void Enter() {
+            Reader& reader = CurrentReader();
+            if (reader.depth++ == 0) {
+                reader.epoch.store(_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+            }
+        }
+
+        void Leave() {
+            Reader& reader = CurrentReader();
+            if (--reader.depth == 0) {
+                reader.epoch.store(0, std::memory_order_release);
+            }
+        }
+
+        /**
+         * @brief ждет, пока закончат все чтения, начатые до вызова
+         */
+        void Synchronize() {
+            uint64_t target = _epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+            std::lock_guard<std::mutex> lock(_m);
+            for (Reader& reader: _readers) {
+                for (;;) {
+                    uint64_t epoch = reader.epoch.load(std::memory_order_seq_cst);
+                    if (epoch == 0 || epoch >= target) break;
+
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        Domain() = default;
+
+        /**
+         * @brief регистрирует ячейку потока при первом чтении и удаляет ее при завершении потока
+         */
+        struct Registration {
+            explicit Registration(Domain& domain)
+                : domain(domain)
+            {
+                std::lock_guard<std::mutex> lock(domain._m);
+                it = domain._readers.emplace(domain._readers.end());
+            }
+
+            ~Registration() {
+                std::lock_guard<std::mutex> lock(domain._m);
+                domain._readers.erase(it);
+            }
+
+            Domain& domain;
+            std::list<Reader>::iterator it;
+        };
+
+        Reader& CurrentReader() {
+            static thread_local Registration registration(*this);
+            return *registration.it;
+        }
+
+    private:
+        std::atomic<uint64_t> _epoch{1};
+
+        std::mutex _m;              //!< защищает _readers от регистрации потоков во время Synchronize
+        std::list<Reader> _readers;
+    };
+
+    template <typename T>
+    class Pointer {
+    public:
+        class ReadGuard {
+        public:
+            ReadGuard()
+                : _ptr(nullptr)
+                , _active(true)
+            {
+                Domain::Instance().Enter();
+            }
+
+            ReadGuard(ReadGuard&& other)
+                : _ptr(other._ptr)
+                , _active(other._active)
+            {
+                other._active = false;
+            }
+
+            ~ReadGuard() {
+                if (_active) Domain::Instance().Leave();
+            }
+
+            T * Get() const {
+                return _ptr;
+            }
+
+        private:
+            friend class Pointer;
+
+            ReadGuard(const ReadGuard&) = delete;
+            ReadGuard& operator=(const ReadGuard&) = delete;
+
+            T * _ptr;
+            bool _active;
+        };
+
+        ReadGuard Read() const {
+            ReadGuard guard;
+            guard._ptr = _current.load(std::memory_order_seq_cst);
+            return guard;
+        }
+
+        void Store(std::shared_ptr<T> ptr) {
+            Reclaim(Exchange(std::move(ptr)));
+        }
+
+        std::shared_ptr<T> Exchange(std::shared_ptr<T> ptr) {
+            std::lock_guard<std::mutex> lock(_writeMutex);
+
+            _current.store(ptr.get(), std::memory_order_seq_cst);
+            _owner.swap(ptr);
+
+            return ptr;
+        }
+
+        /**
+         * @brief ждет читателей, которые еще могут видеть \a old, и отпускает его
+         *
+         *   Вызывается без _writeMutex, так что Get и следующий Exchange не ждут grace period.
+         */
+        void Reclaim(std::shared_ptr<T> old) {
+            if (old) Domain::Instance().Synchronize();
+        }
+
+        std::shared_ptr<T> Get() const {
+            std::lock_guard<std::mutex> lock(_writeMutex);
+            return _owner;
+        }
+
+    private:
+        mutable std::mutex _writeMutex;
+        std::shared_ptr<T> _owner;
+        std::atomic<T *> _current{nullptr};
+    };
+};
+
+} // namespace Hyperscan
+
+#endif // SYNCPOLICY_H
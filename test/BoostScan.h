@@ -8,6 +8,8 @@
 #include <vector>
 #include <boost/regex.hpp>
 
+#include <StringView.h>
+
 namespace Hyperscan {
 
 template <typename DataT>
@@ -23,11 +25,11 @@ public:
     }
 
     bool Insert(const char * pattern, size_t len, const DataT& data) {
-        return Insert(std::string(pattern, pattern + len), data);
+        return Insert(StringView(pattern, len), data);
     }
 
-    bool Insert(const std::string &pattern, const DataT& data) {
-        boost::regex r(pattern);
+    bool Insert(StringView pattern, const DataT& data) {
+        boost::regex r(pattern.begin(), pattern.end());
         if (std::find(_regexs.begin(), _regexs.end(), r) != _regexs.end() &&
             std::distance(_regexs.begin(), std::find(_regexs.begin(), _regexs.end(), r)) ==
             std::distance(_data.begin(),   std::find(_data.begin(), _data.end(), data)))
@@ -35,18 +37,18 @@ public:
             return false;
         }
 
-        _regexs.push_back(boost::regex(pattern));
+        _regexs.push_back(std::move(r));
         _data.push_back(data);
 
         return true;
     }
 
     bool Delete(const char * pattern, size_t len, const DataT& data) {
-        return Delete(std::string(pattern, pattern + len), data);
+        return Delete(StringView(pattern, len), data);
     }
 
-    bool Delete(const std::string &pattern, const DataT& data) {
-        boost::regex p_r(pattern);
+    bool Delete(StringView pattern, const DataT& data) {
+        boost::regex p_r(pattern.begin(), pattern.end());
         for (size_t i = 0; i < _regexs.size(); ++i) {
             if (_regexs[i] == p_r && _data[i] == data) {
                 _regexs.erase(_regexs.begin() + i);
@@ -59,14 +61,14 @@ public:
     }
 
     std::vector<DataT> Find(const char *text, size_t len) const {
-        return Find(std::string(text, text + len));
+        return Find(StringView(text, len));
     }
 
-    std::vector<DataT> Find(const std::string &text) const {
+    std::vector<DataT> Find(StringView text) const {
         std::set<DataT> res;
 
         for (size_t i = 0; i < _regexs.size(); ++i)
-            if (boost::regex_match(text, _regexs[i]))
+            if (boost::regex_match(text.begin(), text.end(), _regexs[i]))
                 res.insert(_data[i]);
 
         return std::vector<DataT>(res.begin(), res.end());
@@ -4,9 +4,19 @@
 #include <ctime>
 #include <thread>
 #include <map>
+#include <algorithm>
 #include <atomic>
+#include <random>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <Hyperscan.h>
+#include <HyperscanWithEscapedCharacter.h>
+#include <FlowTable.h>
+#include <AsyncScanner.h>
+#include <Normalizer.h>
 #include <PatternSearchBenchmark.h>
 #include "LinearSearch.h"
 
@@ -465,6 +475,1497 @@ TEST (HyperscanWrapper, FromFile) {
         .BenchmarkFind({0, 1, 2, 13, 14, 15});
 }
 
+TEST (HyperscanWrapper, FindInFile) {
+    HyperscanWrapper<int> hw;
+
+    hw.Insert(".*CHAPTER.*", 0);
+    hw.Insert(".*Pierre.*", 1);
+    hw.Insert(".*8762183476218934.*", 2);
+    hw.Build();
+
+    Error error;
+    ASSERT_TRUE(VectorEquivalent(hw.FindInFile("resources/war_peace", &error), {0, 1}));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::SUCCESS);
+
+    ASSERT_TRUE(hw.FindInFile("resources/no_such_file", &error).empty());
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::FILE_ERROR);
+}
+
+TEST (HyperscanWrapper, HugeBuffer) {
+    const size_t LEN = (size_t(5) << 30) + 123;
+    const size_t FAR = (size_t(9) << 29) + 7; // beyond the 4 Gb limit of hs_scan
+
+    // untouched pages of an anonymous mapping are shared zero pages, the buffer costs almost no memory
+    char * text = (char *) mmap(nullptr, LEN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    ASSERT_NE(text, MAP_FAILED);
+
+    memcpy(text + 10, "Putin", 5);
+    memcpy(text + FAR, "bomba", 5);
+    memcpy(text + LEN - 6, "teract", 6);
+
+    HyperscanWrapper<int> hw;
+    hw.Insert("Putin", 0);
+    hw.Insert("bomba", 1);
+    hw.Insert("teract", 2);
+    hw.Insert("IOI_239", 3);
+    hw.Build();
+
+    Error error;
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text, LEN, &error), {0, 1, 2}));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::SUCCESS);
+
+    auto matches = hw.FindMatches(text, LEN, &error);
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::SUCCESS);
+    ASSERT_EQ(matches.size(), 3);
+    ASSERT_EQ(matches[0].data, 0);
+    ASSERT_EQ(matches[0].to, 15);
+    ASSERT_EQ(matches[1].data, 1);
+    ASSERT_EQ(matches[1].to, FAR + 5);
+    ASSERT_EQ(matches[2].data, 2);
+    ASSERT_EQ(matches[2].to, LEN);
+
+    munmap(text, LEN);
+}
+
+TEST (HyperscanWrapper, HugeBufferBounded) {
+    const size_t LEN = (size_t(5) << 30) + 123;
+    const size_t FAR = (size_t(9) << 29) + 7; // beyond the 4 Gb limit of hs_scan
+
+    char * text = (char *) mmap(nullptr, LEN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    ASSERT_NE(text, MAP_FAILED);
+
+    memcpy(text + 10, "Putin", 5);
+    memcpy(text + FAR, "bomba", 5);
+
+    HyperscanWrapper<int> hw;
+    hw.SetStreaming(false);
+    hw.Insert("Putin", 0);
+    hw.Insert("bomba", 1);
+    ASSERT_TRUE(hw.Build());
+
+    // a deadline-bound search scans block slices and leaves the stream databases alone
+    HyperscanWrapper<int>::FindOptions options;
+    options.deadline = std::chrono::steady_clock::now() + std::chrono::hours(1);
+
+    Error error;
+    HyperscanWrapper<int>::FindResult res = hw.Find(text, LEN, options, &error);
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::SUCCESS);
+    ASSERT_TRUE(res.Complete());
+    ASSERT_TRUE(VectorEquivalent(res.matches, {0, 1}));
+    ASSERT_FALSE(hw.GetStreamStats().streamsReady);
+
+    // a deadline in the past stops it before the first slice
+    options.deadline = std::chrono::steady_clock::now();
+    res = hw.Find(text, LEN, options, &error);
+    ASSERT_TRUE(res.deadlineExceeded);
+    ASSERT_FALSE(hw.GetStreamStats().streamsReady);
+
+    munmap(text, LEN);
+}
+
+TEST (HyperscanWrapper, SharedMemory) {
+    const std::string name = "/hsw_test_" + std::to_string(getpid());
+
+    HyperscanWrapper<int> publisher;
+    publisher.Insert("Putin", 0);
+    publisher.Insert("bomba", 1);
+    publisher.Build();
+
+    Error error;
+    HyperscanWrapper<int> worker;
+    ASSERT_FALSE(worker.Attach(name, &error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::SHARED_MEMORY_ERROR);
+    ASSERT_FALSE(worker.Refresh(&error));
+
+    // a reader does not create the control segment
+    ASSERT_FALSE(SharedSegment::Open(name));
+
+    ASSERT_TRUE(publisher.Publish(name, &error));
+    ASSERT_TRUE(worker.Attach(name, &error));
+    ASSERT_TRUE(VectorEquivalent(worker.Find("Putin bomba teract"), {0, 1}));
+
+    // another process maps the same segment
+    pid_t pid = fork();
+    if (pid == 0) {
+        HyperscanWrapper<int> child;
+        bool ok = child.Attach(name) && VectorEquivalent(child.Find("Putin teract"), {0});
+        _exit(ok ? 0 : 1);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    publisher.Delete("Putin", 0);
+    publisher.Insert("teract", 2);
+    publisher.Build();
+
+    // nothing changes for the worker until it refreshes
+    ASSERT_TRUE(VectorEquivalent(worker.Find("Putin bomba teract"), {0, 1}));
+    ASSERT_TRUE(publisher.Publish(name, &error));
+    ASSERT_TRUE(worker.Refresh(&error));
+    ASSERT_TRUE(VectorEquivalent(worker.Find("Putin bomba teract"), {1, 2}));
+
+    HyperscanWrapper<int>::Unpublish(name);
+}
+
+TEST (HyperscanWrapper, SharedMemoryRevoke) {
+    const std::string name = "/hsw_test_revoke_" + std::to_string(getpid());
+
+    HyperscanWrapper<int> publisher;
+    publisher.Insert("Putin", 0);
+    publisher.Insert("bomba", 1);
+    publisher.Insert("teract", 2);
+    publisher.Build();
+
+    // revoked before publishing: stays revoked in every attached process
+    ASSERT_TRUE(publisher.Revoke("bomba", 1));
+
+    Error error;
+    ASSERT_TRUE(publisher.Publish(name, &error));
+
+    HyperscanWrapper<int> worker;
+    ASSERT_TRUE(worker.Attach(name, &error));
+    ASSERT_TRUE(VectorEquivalent(worker.Find("Putin bomba teract"), {0, 2}));
+
+    // revoked after publishing: attached processes stop matching it without Refresh
+    ASSERT_TRUE(publisher.Revoke("teract", 2));
+    ASSERT_TRUE(VectorEquivalent(worker.Find("Putin bomba teract"), {0}));
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        HyperscanWrapper<int> child;
+        bool ok = child.Attach(name) && VectorEquivalent(child.Find("Putin bomba teract"), {0});
+        _exit(ok ? 0 : 1);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    // a local Revoke of the worker never writes into the read-only segment
+    worker.Insert("Putin", 0);
+    ASSERT_TRUE(worker.Revoke("Putin", 0));
+    ASSERT_TRUE(VectorEquivalent(worker.Find("Putin bomba teract"), {0}));
+
+    // the next generation is compiled without the revoked rules
+    publisher.Build();
+    ASSERT_TRUE(publisher.Publish(name, &error));
+    ASSERT_TRUE(worker.Refresh(&error));
+    ASSERT_TRUE(VectorEquivalent(worker.Find("Putin bomba teract"), {0}));
+
+    HyperscanWrapper<int>::Unpublish(name);
+}
+
+TEST (HyperscanWrapper, NumaReplicas) {
+    HyperscanWrapper<int> hw;
+    hw.SetNumaReplicas(true);
+
+    hw.Insert("Putin|teract", 0);
+    hw.Insert("IOI_239", 1);
+    ASSERT_TRUE(hw.Build());
+
+    // every node, or the only one, must see the same snapshot
+    const NumaTopology& numa = NumaTopology::Instance();
+    for (size_t node = 0; node < numa.NodeCount(); ++node) {
+        if (numa.Cpus(node).empty()) continue;
+
+        std::vector<int> res;
+        numa.RunOnNode(node, [&]() { res = hw.Find("teract IOI_239"); });
+        ASSERT_TRUE(VectorEquivalent(res, {0, 1}));
+    }
+
+    hw.Delete("IOI_239", 1);
+    ASSERT_TRUE(hw.Build());
+    ASSERT_TRUE(VectorEquivalent(hw.Find("teract IOI_239"), {0}));
+}
+
+TEST (HyperscanWrapper, HugePageAllocator) {
+    // allocators are process wide, so they are installed in a child process only
+    pid_t pid = fork();
+    if (pid == 0) {
+        bool ok = HugePageAllocator::Install(HugePageAllocator::TRANSPARENT_HUGE_PAGES, 0);
+
+        HyperscanWrapper<int> hw;
+        hw.Insert("Putin|teract", 0);
+        hw.Insert("IOI_239", 1);
+        ok = ok && hw.Build();
+
+        for (int i = 0; i < 10; ++i) {
+            ok = ok && VectorEquivalent(hw.Find("teract IOI_239"), {0, 1});
+        }
+
+        HugePageAllocator::Stats stats = HugePageAllocator::GetStats();
+        ok = ok && stats.largeDatabases == 1 && stats.scratchReused >= 9;
+
+        _exit(ok ? 0 : 1);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+TEST (HyperscanWrapper, ShardCache) {
+    const int CNT_PATTERNS = 50;
+    const size_t CNT_SHARDS = 8;
+
+    char dir[] = "/tmp/hsw_shards_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(CNT_SHARDS);
+    hw.SetShardCacheDirectory(dir);
+
+    for (int i = 0; i < CNT_PATTERNS; ++i) {
+        hw.Insert("rule" + std::to_string(i) + "x", i);
+    }
+
+    ASSERT_TRUE(hw.Build());
+    size_t compiled = hw.CompiledShardCount();
+    ASSERT_GT(compiled, 1);
+    ASSERT_LE(compiled, CNT_SHARDS);
+    ASSERT_TRUE(VectorEquivalent(hw.Find("rule17x rule3x rule100x"), {3, 17}));
+
+    // matches of different shards are merged by position
+    auto matches = hw.FindMatches("rule17x rule3x rule42x");
+    ASSERT_EQ(matches.size(), 3);
+    ASSERT_EQ(matches[0].data, 17);
+    ASSERT_EQ(matches[1].data, 3);
+    ASSERT_EQ(matches[2].data, 42);
+
+    // nothing changed
+    ASSERT_TRUE(hw.Build());
+    ASSERT_EQ(hw.CompiledShardCount(), 0);
+
+    // only the shard of the deleted pattern is recompiled
+    hw.Delete("rule3x", 3);
+    ASSERT_TRUE(hw.Build());
+    ASSERT_EQ(hw.CompiledShardCount(), 1);
+    ASSERT_TRUE(VectorEquivalent(hw.Find("rule17x rule3x"), {17}));
+
+    hw.Insert("rule100x", 100);
+    ASSERT_TRUE(hw.Build());
+    ASSERT_EQ(hw.CompiledShardCount(), 1);
+    ASSERT_TRUE(VectorEquivalent(hw.Find("rule17x rule3x rule100x"), {17, 100}));
+
+    // a fresh instance with the same patterns takes every shard from disk
+    HyperscanWrapper<int> restarted;
+    restarted.SetShardCount(CNT_SHARDS);
+    restarted.SetShardCacheDirectory(dir);
+
+    for (int i = 0; i < CNT_PATTERNS; ++i) {
+        restarted.Insert("rule" + std::to_string(i) + "x", i);
+    }
+
+    ASSERT_TRUE(restarted.Build());
+    ASSERT_EQ(restarted.CompiledShardCount(), 0);
+    ASSERT_TRUE(VectorEquivalent(restarted.Find("rule17x rule3x rule100x"), {3, 17}));
+
+    ASSERT_EQ(std::system((std::string("rm -rf ") + dir).c_str()), 0);
+}
+
+TEST (HyperscanWrapper, ShardCacheCollision) {
+    char dirA[] = "/tmp/hsw_shards_XXXXXX";
+    char dirB[] = "/tmp/hsw_shards_XXXXXX";
+    ASSERT_NE(mkdtemp(dirA), nullptr);
+    ASSERT_NE(mkdtemp(dirB), nullptr);
+
+    HyperscanWrapper<int> a;
+    a.SetShardCacheDirectory(dirA);
+    a.Insert("alpha", 0);
+    ASSERT_TRUE(a.Build());
+
+    HyperscanWrapper<int> b;
+    b.SetShardCacheDirectory(dirB);
+    b.Insert("beta", 0);
+    ASSERT_TRUE(b.Build());
+
+    // the file of another rule set under this rule set's hash, as a hash collision would leave it
+    std::string cmd = std::string("for f in ") + dirB + "/*.hsdb; do cp " + dirA + "/*.hsdb \"$f\"; done";
+    ASSERT_EQ(std::system(cmd.c_str()), 0);
+
+    HyperscanWrapper<int> restarted;
+    restarted.SetShardCacheDirectory(dirB);
+    restarted.Insert("beta", 0);
+    ASSERT_TRUE(restarted.Build());
+    ASSERT_EQ(restarted.CompiledShardCount(), 1);
+    ASSERT_TRUE(VectorEquivalent(restarted.Find("alpha"), {}));
+    ASSERT_TRUE(VectorEquivalent(restarted.Find("beta"), {0}));
+
+    // the file is replaced with the right shard
+    HyperscanWrapper<int> again;
+    again.SetShardCacheDirectory(dirB);
+    again.Insert("beta", 0);
+    ASSERT_TRUE(again.Build());
+    ASSERT_EQ(again.CompiledShardCount(), 0);
+    ASSERT_TRUE(VectorEquivalent(again.Find("beta"), {0}));
+
+    ASSERT_EQ(std::system((std::string("rm -rf ") + dirA + " " + dirB).c_str()), 0);
+}
+
+TEST (HyperscanWrapper, ParallelBuild) {
+    const int CNT_PATTERNS = 200;
+
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(4);
+    hw.SetBuildThreads(4);
+
+    for (int i = 0; i < CNT_PATTERNS; ++i) {
+        hw.Insert("rule" + std::to_string(i) + "x", i);
+    }
+
+    ASSERT_TRUE(hw.Build());
+    ASSERT_EQ(hw.CompiledShardCount(), 4);
+    ASSERT_TRUE(VectorEquivalent(hw.Find("rule0x rule199x rule200x"), {0, 199}));
+
+    // the error of a shard compiled on another thread reaches the caller, the old snapshot stays
+    Error error;
+    hw.Insert("bomba(", CNT_PATTERNS);
+    ASSERT_FALSE(hw.Build(&error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::BUILD_ERROR);
+    ASSERT_TRUE(VectorEquivalent(hw.Find("rule0x rule199x"), {0, 199}));
+
+    hw.Delete("bomba(", CNT_PATTERNS);
+    ASSERT_TRUE(hw.Build(&error));
+    ASSERT_TRUE(VectorEquivalent(hw.Find("rule0x bomba("), {0}));
+}
+
+TEST (HyperscanWrapper, Revoke) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(2);
+
+    hw.Insert("Putin", 0);
+    hw.Insert("bomba", 1);
+    hw.Insert("teract", 2);
+    ASSERT_TRUE(hw.Build());
+
+    // takes effect without Build
+    Error error;
+    ASSERT_TRUE(hw.Revoke("bomba", 1, &error));
+    ASSERT_TRUE(VectorEquivalent(hw.Find("Putin bomba teract"), {0, 2}));
+
+    auto matches = hw.FindMatches("bomba teract");
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].data, 2);
+
+    ASSERT_FALSE(hw.Revoke("bomba", 1, &error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::PATTERN_AND_DATA_NOT_FOUND);
+
+    // the reused slot of a pattern deleted after Build does not hide the deleted pattern
+    hw.Delete("Putin", 0);
+    hw.Insert("IOI_239", 3);
+    ASSERT_TRUE(hw.Revoke("IOI_239", 3));
+    ASSERT_TRUE(VectorEquivalent(hw.Find("Putin bomba IOI_239"), {0}));
+
+    ASSERT_TRUE(hw.Build());
+    ASSERT_TRUE(VectorEquivalent(hw.Find("Putin bomba teract IOI_239"), {2}));
+
+    hw.Insert("bomba", 1);
+    ASSERT_TRUE(hw.Build());
+    ASSERT_TRUE(VectorEquivalent(hw.Find("Putin bomba teract IOI_239"), {1, 2}));
+}
+
+TEST (HyperscanWrapper, BuildCoalescing) {
+    const int CNT_PATTERNS = 1000;
+
+    HyperscanWrapper<int> hw;
+    hw.SetBuildDelay(std::chrono::milliseconds(50), std::chrono::milliseconds(1000));
+
+    // a burst of updates from several producers
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; ++t) {
+        producers.emplace_back([&hw, t, CNT_PATTERNS]() {
+            for (int i = t; i < CNT_PATTERNS; i += 4) {
+                hw.InsertAndBuild("rule" + std::to_string(i) + "x", i);
+            }
+        });
+    }
+
+    for (std::thread& t: producers) {
+        t.join();
+    }
+
+    uint64_t generation = hw.ScheduleBuild();
+    ASSERT_EQ(generation, CNT_PATTERNS);
+
+    Error error;
+    ASSERT_TRUE(hw.WaitForGeneration(generation, &error));
+    ASSERT_GE(hw.BuiltGeneration(), generation);
+    ASSERT_TRUE(VectorEquivalent(hw.Find("rule0x rule999x"), {0, 999}));
+
+    hw.DeleteAndBuild("rule0x", 0);
+    ASSERT_TRUE(hw.WaitForGeneration(hw.Generation()));
+    ASSERT_TRUE(VectorEquivalent(hw.Find("rule0x rule999x"), {999}));
+
+    // the error of the background build goes to the waiter
+    hw.InsertAndBuild("bomba(", CNT_PATTERNS);
+    ASSERT_FALSE(hw.WaitForGeneration(hw.Generation(), &error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::BUILD_ERROR);
+    ASSERT_TRUE(VectorEquivalent(hw.Find("rule0x rule999x"), {999}));
+
+    hw.DeleteAndBuild("bomba(", CNT_PATTERNS);
+    ASSERT_TRUE(hw.WaitForGeneration(hw.Generation(), &error));
+}
+
+TEST (HyperscanWrapper, BuildAll) {
+    const int CNT_TENANTS = 64;
+
+    std::vector<std::unique_ptr<HyperscanWrapper<int>>> tenants;
+    std::vector<HyperscanWrapper<int> *> wrappers;
+
+    for (int t = 0; t < CNT_TENANTS; ++t) {
+        tenants.emplace_back(new HyperscanWrapper<int>());
+        wrappers.push_back(tenants.back().get());
+
+        // a different number of patterns per tenant, so that compiles of different sizes overlap
+        for (int i = 0; i <= t % 7; ++i) {
+            tenants.back()->Insert("tenant" + std::to_string(t) + "rule" + std::to_string(i) + "x", i);
+        }
+    }
+
+    ASSERT_TRUE(HyperscanWrapper<int>::BuildAll(wrappers, 8));
+
+    for (int t = 0; t < CNT_TENANTS; ++t) {
+        std::string prefix = "tenant" + std::to_string(t) + "rule";
+        ASSERT_TRUE(VectorEquivalent(tenants[t]->Find(prefix + "0x " + prefix + "6x"), t % 7 == 6 ? std::vector<int>{0, 6} : std::vector<int>{0}));
+    }
+
+    std::vector<Error> errors;
+    tenants[5]->Insert("bomba(", 100);
+    ASSERT_FALSE(HyperscanWrapper<int>::BuildAll(wrappers, 8, &errors));
+    ASSERT_EQ(errors.size(), CNT_TENANTS);
+    ASSERT_EQ(errors[5].GetErrorCode(), ErrorCode::BUILD_ERROR);
+    ASSERT_EQ(errors[4].GetErrorCode(), ErrorCode::SUCCESS);
+}
+
+TEST (HyperscanWrapper, Groups) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(2);
+
+    ASSERT_TRUE(hw.Insert("acme", "bomba", 0));
+    ASSERT_TRUE(hw.Insert("acme", "Putin", 1));
+    ASSERT_TRUE(hw.Insert("initech", "bomba", 2));
+    ASSERT_TRUE(hw.Insert("initech", "stapler", 3));
+    ASSERT_TRUE(hw.Insert("bomba", 4));
+
+    // the same pair is allowed in another group, but not twice in one group
+    Error error;
+    ASSERT_FALSE(hw.Insert("acme", "bomba", 0, &error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::PATTERN_AND_DATA_IN_USE);
+    ASSERT_TRUE(hw.Insert("initech", "bomba", 0));
+
+    ASSERT_TRUE(hw.Build());
+
+    const std::string text = "bomba Putin stapler";
+
+    auto res = hw.Find(text, {"acme", "unknown"});
+    ASSERT_EQ(res.size(), 2);
+    ASSERT_TRUE(VectorEquivalent(res["acme"], {0, 1}));
+    ASSERT_TRUE(res["unknown"].empty());
+
+    res = hw.Find(text, {"initech", "", "acme"});
+    ASSERT_EQ(res.size(), 3);
+    ASSERT_TRUE(VectorEquivalent(res["acme"], {0, 1}));
+    ASSERT_TRUE(VectorEquivalent(res["initech"], {0, 2, 3}));
+    ASSERT_TRUE(VectorEquivalent(res[""], {4}));
+
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text), {0, 0, 1, 2, 3, 4}));
+
+    ASSERT_FALSE(hw.Delete("unknown", "bomba", 0, &error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::PATTERN_AND_DATA_NOT_FOUND);
+    ASSERT_TRUE(hw.Delete("initech", "bomba", 0));
+    ASSERT_TRUE(hw.Revoke("acme", "Putin", 1));
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text, {"acme"})["acme"], {0}));
+
+    ASSERT_TRUE(hw.Build());
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text, {"initech"})["initech"], {2, 3}));
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text), {0, 2, 3, 4}));
+
+    HyperscanWithEscapedCharacter<int> escaped;
+    ASSERT_TRUE(escaped.Insert("acme", "*bom?a*", 0));
+    ASSERT_TRUE(escaped.Insert("initech", "#bom$ba", 1));
+    ASSERT_TRUE(escaped.Build());
+
+    res = escaped.Find("xbomba #bom$ba", {"acme", "initech"});
+    ASSERT_TRUE(VectorEquivalent(res["acme"], {0}));
+    ASSERT_TRUE(VectorEquivalent(res["initech"], {1}));
+}
+
+TEST (HyperscanWrapper, PatternMask) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(3);
+
+    const std::vector<std::string> patterns = {"bomba", "Putin", "stapler", "IOI_239"};
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        ASSERT_TRUE(hw.Insert(patterns[i], i));
+    }
+    ASSERT_TRUE(hw.Insert("acme", "bomba", 10));
+    ASSERT_TRUE(hw.Build());
+
+    std::vector<size_t> ids(patterns.size());
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        ASSERT_TRUE(hw.PatternId(patterns[i], i, &ids[i]));
+    }
+
+    size_t acme = 0;
+    ASSERT_TRUE(hw.PatternId("acme", "bomba", 5, 10, &acme));
+
+    Error error;
+    size_t unused = 0;
+    ASSERT_FALSE(hw.PatternId("bomba", 1, &unused, &error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::PATTERN_AND_DATA_NOT_FOUND);
+
+    const std::string text = "bomba bomba Putin stapler";
+
+    PatternMask mask;
+    ASSERT_TRUE(hw.Find(text, mask).empty());
+
+    mask.Set(ids[0]);
+    mask.Set(ids[2]);
+    mask.Set(ids[3]);
+    ASSERT_EQ(mask.Count(), 3);
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text, mask), {0, 2}));
+
+    // every enabled pattern fires, the scan stops early
+    mask.Set(ids[3], false);
+    mask.Set(acme);
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text, mask), {0, 2, 10}));
+
+    // ids past the end of the snapshot are ignored
+    mask.Set(1000);
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text, mask), {0, 2, 10}));
+
+    ASSERT_TRUE(hw.Revoke("stapler", 2));
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text, mask), {0, 10}));
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text), {0, 1, 10}));
+
+    mask.Clear();
+    ASSERT_EQ(mask.Count(), 0);
+    ASSERT_TRUE(hw.Find(text, mask).empty());
+}
+
+TEST (HyperscanWrapper, MatchSet) {
+    HyperscanWrapper<std::string> hw;
+    hw.SetShardCount(2);
+
+    ASSERT_TRUE(hw.Insert("bomba", "rule bomba"));
+    ASSERT_TRUE(hw.Insert("Putin", "rule Putin"));
+    ASSERT_TRUE(hw.Insert("stapler", "rule stapler"));
+    ASSERT_TRUE(hw.Build());
+
+    HyperscanWrapper<std::string>::MatchSet matches;
+    hw.FindIds("bomba Putin bomba", matches);
+    ASSERT_EQ(matches.Count(), 2);
+
+    std::vector<std::string> resolved;
+    matches.ForEach([&](size_t id) { resolved.push_back(matches.Resolve(id)); });
+    std::sort(resolved.begin(), resolved.end());
+    ASSERT_EQ(resolved, std::vector<std::string>({"rule Putin", "rule bomba"}));
+
+    size_t bomba = 0, putin = 0, stapler = 0;
+    ASSERT_TRUE(hw.PatternId("bomba", "rule bomba", &bomba));
+    ASSERT_TRUE(hw.PatternId("Putin", "rule Putin", &putin));
+    ASSERT_TRUE(hw.PatternId("stapler", "rule stapler", &stapler));
+
+    HyperscanWrapper<std::string>::MatchSet other;
+    hw.FindIds("Putin stapler", other);
+
+    PatternMask both = matches;
+    both &= other;
+    ASSERT_EQ(both.Count(), 1);
+    ASSERT_TRUE(both.Test(putin));
+
+    PatternMask any = matches;
+    any |= other;
+    ASSERT_EQ(any.Count(), 3);
+
+    PatternMask onlyFirst = matches;
+    onlyFirst -= other;
+    ASSERT_EQ(onlyFirst.Count(), 1);
+    ASSERT_TRUE(onlyFirst.Test(bomba));
+
+    PatternMask expected;
+    expected.Set(bomba);
+    expected.Set(putin);
+    ASSERT_TRUE(expected == matches);
+
+    // the set is reused, and keeps the snapshot it was filled from across Build
+    hw.FindIds("nothing here", matches);
+    ASSERT_FALSE(matches.Any());
+
+    hw.FindIds("stapler", matches);
+    ASSERT_TRUE(hw.Delete("stapler", "rule stapler"));
+    ASSERT_TRUE(hw.Build());
+    ASSERT_TRUE(matches.Test(stapler));
+    ASSERT_EQ(matches.Resolve(stapler), "rule stapler");
+
+    ASSERT_TRUE(hw.Revoke("bomba", "rule bomba"));
+    hw.FindIds("bomba Putin stapler", matches);
+    ASSERT_EQ(matches.Count(), 1);
+    ASSERT_TRUE(matches.Test(putin));
+}
+
+TEST (HyperscanWrapper, DataSnapshot) {
+    DataStore<std::string> store;
+    const size_t count = DataStore<std::string>::CHUNK_SIZE * 2 + 10;
+
+    for (size_t i = 0; i < count; ++i) {
+        store.PushBack(std::to_string(i));
+    }
+
+    DataStore<std::string> snapshot = store;
+    store.Set(5, "changed");
+    store.PushBack("last");
+
+    ASSERT_EQ(snapshot.Size(), count);
+    ASSERT_EQ(snapshot[5], "5");
+    ASSERT_EQ(store[5], "changed");
+    ASSERT_EQ(store.Size(), count + 1);
+    ASSERT_EQ(store[count], "last");
+    ASSERT_EQ(store[count - 1], snapshot[count - 1]);
+
+    // untouched chunks are shared, the changed ones are not
+    ASSERT_EQ(&store[DataStore<std::string>::CHUNK_SIZE], &snapshot[DataStore<std::string>::CHUNK_SIZE]);
+    ASSERT_NE(&store[0], &snapshot[0]);
+
+    DataStore<std::string> clone = store.Clone();
+    ASSERT_NE(&clone[DataStore<std::string>::CHUNK_SIZE], &store[DataStore<std::string>::CHUNK_SIZE]);
+    ASSERT_EQ(clone[5], "changed");
+
+    HyperscanWrapper<std::string> hw;
+    std::string data = "rule bomba";
+    ASSERT_TRUE(hw.Insert("bomba", std::move(data)));
+    ASSERT_TRUE(hw.Insert("Putin", std::string("rule Putin")));
+    ASSERT_TRUE(hw.Build());
+
+    size_t bomba = 0;
+    ASSERT_TRUE(hw.PatternId("bomba", "rule bomba", &bomba));
+
+    HyperscanWrapper<std::string>::MatchSet matches;
+    hw.FindIds("bomba", matches);
+
+    // the freed slot is reused, the old snapshot keeps the old data
+    ASSERT_TRUE(hw.Delete("bomba", "rule bomba"));
+    ASSERT_TRUE(hw.Insert("stapler", "rule stapler"));
+    ASSERT_TRUE(hw.Build());
+
+    size_t stapler = 0;
+    ASSERT_TRUE(hw.PatternId("stapler", "rule stapler", &stapler));
+    ASSERT_EQ(stapler, bomba);
+    ASSERT_EQ(matches.Resolve(bomba), "rule bomba");
+
+    std::vector<std::string> res = hw.Find("bomba Putin stapler");
+    std::sort(res.begin(), res.end());
+    ASSERT_EQ(res, std::vector<std::string>({"rule Putin", "rule stapler"}));
+}
+
+template <typename SyncPolicy>
+void syncPolicyTest(size_t cntReaders) {
+    HyperscanWrapper<int, SyncPolicy> hw;
+    ASSERT_TRUE(hw.Find("bomba").empty());
+
+    ASSERT_TRUE(hw.Insert("bomba", 0));
+    ASSERT_TRUE(hw.Build());
+    ASSERT_TRUE(VectorEquivalent(hw.Find("bomba Putin"), {0}));
+
+    typename HyperscanWrapper<int, SyncPolicy>::MatchSet matches;
+    hw.FindIds("bomba", matches);
+
+    const int CNT_BUILDS = 50;
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> readers;
+
+    for (size_t r = 0; r < cntReaders; ++r) {
+        readers.emplace_back([&hw, &stop]() {
+            while (!stop.load()) {
+                // every snapshot has bomba, and Putin only together with its build number
+                std::vector<int> res = hw.Find("bomba Putin");
+                ASSERT_FALSE(res.empty());
+                ASSERT_TRUE(std::find(res.begin(), res.end(), 0) != res.end());
+                ASSERT_LE(res.size(), 2);
+            }
+        });
+    }
+
+    for (int i = 1; i <= CNT_BUILDS; ++i) {
+        if (i > 1) {
+            ASSERT_TRUE(hw.Delete("Putin", i - 1));
+        }
+        ASSERT_TRUE(hw.Insert("Putin", i));
+        ASSERT_TRUE(hw.Build());
+    }
+
+    stop = true;
+    for (std::thread& t: readers) {
+        t.join();
+    }
+
+    ASSERT_TRUE(VectorEquivalent(hw.Find("bomba Putin"), {0, CNT_BUILDS}));
+
+    // the match set keeps its snapshot alive through all the builds
+    ASSERT_EQ(matches.Count(), 1);
+    matches.ForEach([&matches](size_t id) { ASSERT_EQ(matches.Resolve(id), 0); });
+}
+
+TEST (HyperscanWrapper, SyncPolicy) {
+    syncPolicyTest<NoSync>(0);
+    syncPolicyTest<MutexSync>(4);
+    syncPolicyTest<RcuSync>(4);
+
+    HyperscanWithEscapedCharacter<int, RcuSync> escaped;
+    ASSERT_TRUE(escaped.Insert("*bom?a*", 0));
+    ASSERT_TRUE(escaped.Build());
+    ASSERT_TRUE(VectorEquivalent(escaped.Find("xbomba"), {0}));
+}
+
+TEST (HyperscanWrapper, RcuBuildDoesNotBlockWriters) {
+    HyperscanWrapper<int, RcuSync> hw;
+    hw.Insert("bomba", 0);
+    ASSERT_TRUE(hw.Build());
+
+    // a reader parked in the middle of a scan keeps the grace period of the next Build open
+    std::atomic<bool> parked(false);
+    std::atomic<bool> release(false);
+    std::thread reader([&]() {
+        RcuSync::Domain::Instance().Enter();
+        parked = true;
+        while (!release) std::this_thread::yield();
+        RcuSync::Domain::Instance().Leave();
+    });
+    while (!parked) std::this_thread::yield();
+
+    hw.Insert("Putin", 1);
+    std::atomic<bool> built(false);
+    std::thread builder([&]() {
+        ASSERT_TRUE(hw.Build());
+        built = true;
+    });
+
+    // the new snapshot is visible before the old one is reclaimed
+    while (!VectorEquivalent(hw.Find("Putin"), {1})) std::this_thread::yield();
+
+    ASSERT_TRUE(hw.Revoke("Putin", 1));
+    ASSERT_TRUE(hw.Find("Putin").empty());
+    ASSERT_TRUE(hw.Insert("teract", 2));
+    ASSERT_EQ(hw.Size(), 2);
+    // Build still holds _buildMutex here
+    ASSERT_TRUE(hw.SkippedPatterns().empty());
+    ASSERT_FALSE(built);
+
+    release = true;
+    reader.join();
+    builder.join();
+    ASSERT_TRUE(built);
+}
+
+TEST (HyperscanWrapper, Stream) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(2);
+
+    hw.Insert("Putin", 0);
+    hw.Insert("bomba", 1);
+    hw.Insert("teract", 2);
+    ASSERT_TRUE(hw.Build());
+
+    Error error;
+    auto stream = hw.OpenStream(&error);
+    ASSERT_TRUE(stream.IsOpen());
+
+    // a match split between chunks is found once per stream
+    std::vector<int> res;
+    ASSERT_TRUE(stream.Scan("Pu", 2, res, &error));
+    ASSERT_TRUE(res.empty());
+    ASSERT_TRUE(stream.Scan("tin bom", 7, res, &error));
+    ASSERT_TRUE(VectorEquivalent(res, {0}));
+
+    res.clear();
+    HyperscanWrapper<int>::Scratch scratch;
+    ASSERT_TRUE(stream.Scan("ba Putin", 8, res, scratch, &error));
+    ASSERT_TRUE(VectorEquivalent(res, {1}));
+
+    auto stats = hw.GetStreamStats();
+    ASSERT_TRUE(stats.streamsReady);
+    ASSERT_EQ(stats.liveStreams, 1);
+    ASSERT_GT(stats.liveBytes, 0);
+    ASSERT_EQ(stats.compressedStreams, 0);
+
+    // idle streams are compressed and expanded back on the next chunk
+    ASSERT_FALSE(stream.CompressIfIdle(HyperscanWrapper<int>::Stream::Clock::now()));
+    hw.SetStreamIdleTimeout(std::chrono::milliseconds(10));
+    ASSERT_FALSE(stream.CompressIfIdle(stream.LastActive()));
+    ASSERT_TRUE(stream.CompressIfIdle(stream.LastActive() + std::chrono::milliseconds(10), &error));
+    ASSERT_TRUE(stream.IsCompressed());
+
+    stats = hw.GetStreamStats();
+    ASSERT_EQ(stats.liveStreams, 0);
+    ASSERT_EQ(stats.liveBytes, 0);
+    ASSERT_EQ(stats.compressedStreams, 1);
+    ASSERT_GT(stats.compressedBytes, 0);
+    ASSERT_GE(stats.poolBytes, stats.compressedBytes);
+
+    // the stream opened before Build keeps its patterns
+    hw.Insert("IOI_239", 3);
+    ASSERT_TRUE(hw.Build());
+
+    res.clear();
+    ASSERT_TRUE(stream.Scan("ter", 3, res, scratch, &error));
+    ASSERT_FALSE(stream.IsCompressed());
+    ASSERT_TRUE(stream.Scan("act IOI_239", 11, res, scratch, &error));
+    ASSERT_TRUE(VectorEquivalent(res, {2}));
+
+    res.clear();
+    ASSERT_TRUE(stream.Close(res, scratch, &error));
+    ASSERT_FALSE(stream.IsOpen());
+    ASSERT_FALSE(stream.Scan("Putin", 5, res, &error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::SCAN_ERROR);
+
+    // many streams, most of them idle
+    std::vector<HyperscanWrapper<int>::Stream> streams;
+    for (int i = 0; i < 1000; ++i) {
+        streams.push_back(hw.OpenStream());
+        std::vector<int> r;
+        ASSERT_TRUE(streams.back().Scan("IOI_", 4, r, scratch));
+    }
+
+    auto later = HyperscanWrapper<int>::Stream::Clock::now() + std::chrono::seconds(1);
+    for (size_t i = 0; i < streams.size(); i += 2) {
+        ASSERT_TRUE(streams[i].CompressIfIdle(later));
+    }
+
+    stats = hw.GetStreamStats();
+    ASSERT_EQ(stats.liveStreams, 500);
+    ASSERT_EQ(stats.compressedStreams, 500);
+
+    for (size_t i = 0; i < streams.size(); ++i) {
+        std::vector<int> r;
+        ASSERT_TRUE(streams[i].Scan("239", 3, r, scratch));
+        ASSERT_TRUE(VectorEquivalent(r, {3}));
+    }
+
+    streams.clear();
+    stats = hw.GetStreamStats();
+    ASSERT_EQ(stats.liveStreams, 0);
+    ASSERT_EQ(stats.liveBytes, 0);
+    ASSERT_EQ(stats.compressedStreams, 0);
+    ASSERT_EQ(stats.compressedBytes, 0);
+}
+
+TEST (HyperscanWrapper, FlowTable) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(2);
+
+    hw.Insert("Putin", 0);
+    hw.Insert("bomba", 1);
+    hw.Insert("teract", 2);
+    ASSERT_TRUE(hw.Build());
+
+    std::vector<uint64_t> flushed;
+    FlowTable<int> table(hw, 3, std::chrono::milliseconds(1000), [&](uint64_t flowId, const std::vector<int>&) {
+        flushed.push_back(flowId);
+    });
+
+    // interleaved flows, every match is split between chunks
+    std::vector<int> res;
+    ASSERT_TRUE(table.ScanFlow(10, "Pu", 2, res));
+    ASSERT_TRUE(table.ScanFlow(20, "bo", 2, res));
+    ASSERT_TRUE(table.ScanFlow(30, "ter", 3, res));
+    ASSERT_TRUE(res.empty());
+
+    ASSERT_TRUE(table.ScanFlow(20, "mba", 3, res));
+    ASSERT_TRUE(VectorEquivalent(res, {1}));
+
+    res.clear();
+    ASSERT_TRUE(table.ScanFlow(10, "tin", 3, res));
+    ASSERT_TRUE(VectorEquivalent(res, {0}));
+    ASSERT_EQ(table.Size(), 3);
+
+    // the table is full, the least recently used flow 30 is flushed and gives its stream to flow 40
+    res.clear();
+    ASSERT_TRUE(table.ScanFlow(40, "act", 3, res));
+    ASSERT_TRUE(res.empty());
+    ASSERT_EQ(flushed, std::vector<uint64_t>({30}));
+    ASSERT_FALSE(table.Contains(30));
+    ASSERT_EQ(table.Size(), 3);
+    ASSERT_EQ(hw.GetStreamStats().liveStreams, 3);
+
+    // a flow that comes back starts from scratch
+    ASSERT_TRUE(table.ScanFlow(30, "act", 3, res));
+    ASSERT_TRUE(res.empty());
+    ASSERT_EQ(flushed, std::vector<uint64_t>({30, 20}));
+
+    // idle flows are compressed first and closed later
+    hw.SetStreamIdleTimeout(std::chrono::milliseconds(100));
+    auto now = HyperscanWrapper<int>::Stream::Clock::now();
+    ASSERT_EQ(table.Expire(now + std::chrono::milliseconds(500)), 0);
+    ASSERT_EQ(hw.GetStreamStats().compressedStreams, 3);
+
+    ASSERT_TRUE(table.ScanFlow(10, "Putin", 5, res));
+    ASSERT_TRUE(res.empty());
+    ASSERT_EQ(hw.GetStreamStats().compressedStreams, 2);
+
+    ASSERT_EQ(table.Expire(now + std::chrono::milliseconds(1500)), 3);
+    ASSERT_EQ(table.Size(), 0);
+    ASSERT_EQ(hw.GetStreamStats().liveStreams + hw.GetStreamStats().compressedStreams, 0);
+
+    ASSERT_TRUE(table.ScanFlow(50, "bomba", 5, res));
+    ASSERT_TRUE(VectorEquivalent(res, {1}));
+    ASSERT_TRUE(table.CloseFlow(50, res));
+    ASSERT_FALSE(table.CloseFlow(50, res));
+
+    // many flows through a small table, including deletes in the middle of probe runs
+    FlowTable<int> small(hw, 64);
+    std::vector<uint64_t> open;
+    for (uint64_t flow = 0; flow < 5000; ++flow) {
+        std::vector<int> r;
+        ASSERT_TRUE(small.ScanFlow(flow * 64, "bomba", 5, r));
+        ASSERT_TRUE(VectorEquivalent(r, {1}));
+
+        if (flow % 3 == 0) {
+            ASSERT_TRUE(small.CloseFlow(flow * 64, r));
+        }
+    }
+
+    ASSERT_EQ(small.Size(), 64);
+    for (uint64_t flow = 5000 - 32; flow < 5000; ++flow) {
+        if (flow % 3) {
+            ASSERT_TRUE(small.Contains(flow * 64));
+        }
+    }
+
+    small.FlushAll();
+    ASSERT_EQ(small.Size(), 0);
+
+    std::vector<size_t> perWorker(4, 0);
+    for (uint64_t flow = 0; flow < 4000; ++flow) {
+        ++perWorker[FlowTable<int>::Worker(flow, 4)];
+    }
+    for (size_t n: perWorker) {
+        ASSERT_GT(n, 800);
+    }
+}
+
+TEST (HyperscanWrapper, AsyncScanner) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(2);
+
+    hw.Insert("Putin", 0);
+    hw.Insert("bomba", 1);
+    hw.Insert("teract", 2);
+    ASSERT_TRUE(hw.Build());
+
+    const std::vector<std::string> texts = {"Putin bomba", "teract", "nothing", "bomba"};
+    const std::vector<std::vector<int>> expected = {{0, 1}, {2}, {}, {1}};
+
+    // completions without callback are polled
+    {
+        AsyncScanner<int> scanner(hw, 3, 64);
+        for (size_t i = 0; i < 40; ++i) {
+            const std::string& text = texts[i % texts.size()];
+            ASSERT_TRUE(scanner.Submit(text.data(), text.size(), i));
+        }
+
+        std::vector<AsyncScanner<int>::Completion> done;
+        while (done.size() < 40) {
+            if (!scanner.Poll(done)) std::this_thread::yield();
+        }
+
+        ASSERT_EQ(scanner.InFlight(), 0);
+        std::vector<bool> seen(40, false);
+        for (auto& c: done) {
+            ASSERT_FALSE(seen[c.tag]);
+            seen[c.tag] = true;
+            ASSERT_EQ(c.error.GetErrorCode(), ErrorCode::SUCCESS);
+            ASSERT_TRUE(VectorEquivalent(c.matches, expected[c.tag % texts.size()]));
+        }
+    }
+
+    // backpressure: unpolled completions hold their place
+    {
+        AsyncScanner<int> scanner(hw, 2, 4);
+        for (size_t i = 0; i < 4; ++i) {
+            ASSERT_TRUE(scanner.Submit(texts[0].data(), texts[0].size(), i));
+        }
+        ASSERT_FALSE(scanner.Submit(texts[0].data(), texts[0].size(), 4));
+
+        std::vector<AsyncScanner<int>::Completion> done;
+        while (done.size() < 4) {
+            if (!scanner.Poll(done, 1)) std::this_thread::yield();
+        }
+        ASSERT_TRUE(scanner.Submit(texts[0].data(), texts[0].size(), 4));
+
+        done.clear();
+        while (!scanner.Poll(done)) std::this_thread::yield();
+        ASSERT_EQ(done[0].tag, 4);
+    }
+
+    // callbacks, batches and many producers
+    std::atomic<size_t> matched(0);
+    std::atomic<size_t> completed(0);
+    {
+        AsyncScanner<int> scanner(hw, 4, 256);
+        auto callback = [&](AsyncScanner<int>::Completion& c) {
+            if (VectorEquivalent(c.matches, expected[c.tag % texts.size()])) ++matched;
+            ++completed;
+        };
+
+        std::vector<std::thread> producers;
+        for (size_t p = 0; p < 4; ++p) {
+            producers.emplace_back([&, p]() {
+                std::vector<AsyncScanner<int>::Request> batch(8);
+                for (size_t i = 0; i < 1000; i += batch.size()) {
+                    for (size_t j = 0; j < batch.size(); ++j) {
+                        const std::string& text = texts[(i + j) % texts.size()];
+                        batch[j].text = text.data();
+                        batch[j].len = text.size();
+                        batch[j].tag = i + j;
+                        batch[j].callback = callback;
+                    }
+
+                    size_t sent = 0;
+                    while (sent < batch.size()) {
+                        size_t accepted = scanner.SubmitBatch(batch.data() + sent, batch.size() - sent);
+                        if (!accepted) std::this_thread::yield();
+                        sent += accepted;
+                    }
+                }
+            });
+        }
+
+        for (std::thread& t: producers) t.join();
+        // the destructor finishes all accepted requests
+    }
+
+    ASSERT_EQ(completed, 4000);
+    ASSERT_EQ(matched, 4000);
+}
+
+TEST (HyperscanWrapper, StringView) {
+    HyperscanWrapper<int> hw;
+
+    // a binary pattern is not cut at the zero byte and differs from its prefix
+    const std::string binary("ab\0cd", 5);
+    ASSERT_TRUE(hw.Insert(binary, 1));
+    ASSERT_TRUE(hw.Insert("ab", 1));
+
+    Error error;
+    ASSERT_FALSE(hw.Insert(binary, 1, &error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::PATTERN_AND_DATA_IN_USE);
+    ASSERT_EQ(error.GetBadPattern(), binary);
+
+    // a view into the middle of a buffer without a terminating zero
+    const char buffer[] = {'b', 'o', 'm', 'b', 'a', 's', 't', 'i', 'c'};
+    ASSERT_TRUE(hw.Insert(StringView(buffer, 5), 2));
+    ASSERT_TRUE(hw.Build());
+
+    const std::string text("xxab\0cdxx bomba", 16);
+    ASSERT_TRUE(VectorEquivalent(hw.Find(StringView(text)), {1, 1, 2}));
+    ASSERT_TRUE(VectorEquivalent(hw.Find(StringView(text).substr(0, 8)), {1, 1}));
+    ASSERT_TRUE(VectorEquivalent(hw.Find("abcd"), {1}));
+    ASSERT_TRUE(VectorEquivalent(hw.Find(StringView(buffer, 4)), {}));
+
+    ASSERT_TRUE(hw.DeleteAndBuild(binary, 1));
+    ASSERT_TRUE(VectorEquivalent(hw.Find(text), {1, 2}));
+
+    HyperscanWithEscapedCharacter<int> escaped;
+    ASSERT_TRUE(escaped.InsertAndBuild(std::string("*a\0?*", 5), 3));
+    ASSERT_TRUE(VectorEquivalent(escaped.Find(std::string("xa\0by", 5)), {3}));
+    ASSERT_TRUE(VectorEquivalent(escaped.Find("xaby"), {}));
+
+    LinearSearch<int> linear;
+    ASSERT_TRUE(linear.Insert(binary, 4));
+    ASSERT_TRUE(VectorEquivalent(linear.Find(text.data(), text.size()), {4}));
+    ASSERT_TRUE(VectorEquivalent(linear.Find("abcd"), {}));
+}
+
+TEST (HyperscanWrapper, MatchHistogram) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(2);
+
+    hw.Insert("Putin", 0);
+    hw.Insert("bomba", 1);
+    hw.Insert("teract", 2);
+    ASSERT_TRUE(hw.Build());
+
+    const std::vector<std::string> texts = {"Putin bomba", "bomba", "nothing", "teract bomba"};
+
+    // every thread counts its own part of the corpus, then the histograms are merged
+    std::vector<HyperscanWrapper<int>::MatchHistogram> histograms(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < histograms.size(); ++t) {
+        threads.emplace_back([&, t]() {
+            HyperscanWrapper<int>::Scratch scratch;
+            for (size_t i = t; i < 400; i += histograms.size()) {
+                hw.Count(texts[i % texts.size()], histograms[t], scratch);
+            }
+        });
+    }
+    for (std::thread& t: threads) t.join();
+
+    HyperscanWrapper<int>::MatchHistogram total;
+    for (auto& h: histograms) {
+        total.Merge(h);
+    }
+
+    ASSERT_EQ(total.Documents(), 400);
+    ASSERT_EQ(total.Bytes(), 100 * (11 + 5 + 7 + 12));
+    ASSERT_EQ(total.Size(), 3);
+
+    size_t id;
+    ASSERT_TRUE(hw.PatternId("bomba", 1, &id));
+    ASSERT_EQ(total.Resolve(id), 1);
+    ASSERT_EQ(total.Get(id).documents, 300);
+    ASSERT_EQ(total.Get(id).matches, 300);
+    ASSERT_EQ(total.Get(id).bytes, 100 * (11 + 5 + 12));
+
+    ASSERT_TRUE(hw.PatternId("teract", 2, &id));
+    ASSERT_EQ(total.Get(id).documents, 100);
+    ASSERT_EQ(total.Get(id).bytes, 100 * 12);
+
+    // counting goes on across Build, revoked patterns stop counting at once
+    HyperscanWrapper<int>::Scratch scratch;
+    HyperscanWrapper<int>::MatchHistogram h;
+    ASSERT_TRUE(hw.Revoke("Putin", 0));
+    hw.Count("Putin bomba", h, scratch);
+    ASSERT_TRUE(hw.InsertAndBuild("nothing", 3));
+    hw.Count("nothing bomba", h, scratch);
+
+    ASSERT_EQ(h.Documents(), 2);
+    ASSERT_TRUE(hw.PatternId("bomba", 1, &id));
+    ASSERT_EQ(h.Get(id).documents, 2);
+    ASSERT_TRUE(hw.PatternId("nothing", 3, &id));
+    ASSERT_EQ(h.Resolve(id), 3);
+    ASSERT_EQ(h.Get(id).documents, 1);
+
+    size_t hits = 0;
+    for (size_t i = 0; i < h.Size(); ++i) {
+        hits += h.Get(i).documents;
+    }
+    ASSERT_EQ(hits, 3);
+
+    h.Clear();
+    ASSERT_EQ(h.Documents(), 0);
+    ASSERT_EQ(h.Get(id).matches, 0);
+}
+
+TEST (HyperscanWrapper, FindOptions) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(4);
+
+    for (int i = 0; i < 200; ++i) {
+        hw.Insert("a" + std::to_string(i % 10), i);
+    }
+    hw.Insert("bomba", 1000);
+    ASSERT_TRUE(hw.Build());
+
+    const std::string text = "a0 a1 a2 a3 a4 a5 a6 a7 a8 a9 bomba";
+
+    // without limits the answer is the same as Find
+    HyperscanWrapper<int>::FindOptions options;
+    HyperscanWrapper<int>::FindResult res = hw.Find(text, options);
+    ASSERT_TRUE(res.Complete());
+    ASSERT_TRUE(VectorEquivalent(res.matches, hw.Find(text)));
+    ASSERT_EQ(res.matches.size(), 201);
+
+    options.maxMatches = 7;
+    res = hw.Find(text, options);
+    ASSERT_FALSE(res.Complete());
+    ASSERT_FALSE(res.deadlineExceeded);
+    ASSERT_EQ(res.matches.size(), 7);
+
+    // the budget filled by the very last match is not a truncation
+    options.maxMatches = 201;
+    res = hw.Find(text, options);
+    ASSERT_TRUE(res.Complete());
+    ASSERT_EQ(res.matches.size(), 201);
+
+    options.maxMatches = 200;
+    res = hw.Find(text, options);
+    ASSERT_FALSE(res.Complete());
+    ASSERT_FALSE(res.deadlineExceeded);
+    ASSERT_EQ(res.matches.size(), 200);
+
+    // a deadline in the past stops the scan before the first shard
+    options.maxMatches = 0;
+    options.deadline = std::chrono::steady_clock::now();
+    res = hw.Find(text, options);
+    ASSERT_TRUE(res.truncated);
+    ASSERT_TRUE(res.deadlineExceeded);
+    ASSERT_TRUE(res.matches.empty());
+
+    // sliced scanning still finds matches that cross the slices
+    options.deadline = std::chrono::steady_clock::now() + std::chrono::hours(1);
+    options.sliceLength = 3;
+    res = hw.Find(text, options);
+    ASSERT_TRUE(res.Complete());
+    ASSERT_TRUE(VectorEquivalent(res.matches, hw.Find(text)));
+
+    // until the stream databases are ready a long text is scanned whole, the deadline is checked between shards
+    std::string longText(8 << 20, 'x');
+    longText += "bomba";
+    options.sliceLength = 64 << 10;
+    options.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+    res = hw.Find(longText, options);
+    ASSERT_TRUE(res.Complete() || res.deadlineExceeded);
+    ASSERT_LE(res.matches.size(), 1);
+
+    // with the stream databases built by Build a long text without matches is cut between slices
+    hw.SetStreaming(true);
+    ASSERT_TRUE(hw.Build());
+
+    options.deadline = std::chrono::steady_clock::now() + std::chrono::hours(1);
+    options.sliceLength = 3;
+    res = hw.Find(text, options);
+    ASSERT_TRUE(res.Complete());
+    ASSERT_TRUE(VectorEquivalent(res.matches, hw.Find(text)));
+
+    options.sliceLength = 64 << 10;
+    options.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+    res = hw.Find(longText, options);
+    if (res.Complete()) {
+        ASSERT_TRUE(VectorEquivalent(res.matches, {1000}));
+    } else {
+        ASSERT_TRUE(res.deadlineExceeded);
+        ASSERT_TRUE(res.matches.empty());
+    }
+}
+
+TEST (HyperscanWrapper, Normalizer) {
+    // byte by byte reference: the normalized text and where every normalized byte starts in the original
+    auto reference = [](const std::string& text, unsigned steps, std::vector<size_t>& starts) {
+        auto hex = [](char c) { return isxdigit((unsigned char) c) != 0; };
+        std::string res;
+        starts.clear();
+        bool lastSpace = false;
+
+        for (size_t i = 0; i < text.size();) {
+            size_t start = i;
+            unsigned char c = text[i++];
+
+            if ((steps & Normalizer::PERCENT_DECODE) && c == '%' && i + 2 <= text.size()
+                && hex(text[i]) && hex(text[i + 1])) {
+                c = std::stoi(text.substr(i, 2), nullptr, 16);
+                i += 2;
+            }
+            if ((steps & Normalizer::LOWERCASE) && c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+
+            if ((steps & Normalizer::FOLD_WHITESPACE) && (c == ' ' || (c >= '\t' && c <= '\r'))) {
+                if (lastSpace) continue;
+                c = ' ';
+                lastSpace = true;
+            } else {
+                lastSpace = false;
+            }
+
+            res.push_back(c);
+            starts.push_back(start);
+        }
+
+        return res;
+    };
+
+    Normalizer normalizer;
+    std::mt19937 rnd(7);
+    const std::string alphabet = "aBzZ%%4f1G  \t\n\r\xc3\x80";
+
+    for (int iter = 0; iter < 3000; ++iter) {
+        std::string text(rnd() % 150, ' ');
+        for (char& c: text) c = alphabet[rnd() % alphabet.size()];
+
+        unsigned steps = iter % 8;
+        std::vector<size_t> starts;
+        std::string expected = reference(text, steps, starts);
+
+        StringView normalized = normalizer.Normalize(text.data(), text.size(), steps);
+        ASSERT_EQ(normalized.ToString(), expected) << "steps " << steps << " text '" << text << "'";
+
+        for (size_t i = 0; i < starts.size(); ++i) {
+            ASSERT_EQ(normalizer.OriginalOffset(i), starts[i]) << "steps " << steps << " text '" << text << "'";
+        }
+        ASSERT_EQ(normalizer.OriginalOffset(expected.size()), text.size());
+    }
+
+    // a huge text does not keep its buffer after Shrink, a small one does
+    std::string huge(8 << 20, 'A');
+    ASSERT_EQ(normalizer.Normalize(huge.data(), huge.size(), Normalizer::LOWERCASE).size(), huge.size());
+    ASSERT_GT(normalizer.Capacity(), huge.size());
+    normalizer.Shrink(1 << 20);
+    ASSERT_LT(normalizer.Capacity(), 1 << 20);
+
+    ASSERT_EQ(normalizer.Normalize("ABC", 3, Normalizer::LOWERCASE).ToString(), "abc");
+    size_t small = normalizer.Capacity();
+    normalizer.Shrink(1 << 20);
+    ASSERT_EQ(normalizer.Capacity(), small);
+
+    HyperscanWrapper<int> hw;
+    hw.Insert("select from", 0);
+    hw.Insert("<script>", 1);
+    ASSERT_TRUE(hw.Build());
+
+    const std::string request = "q=SELECT%20%20\t FROM&x=%3CScript%3e";
+    ASSERT_TRUE(hw.Find(request).empty());
+
+    hw.SetNormalization(Normalizer::LOWERCASE | Normalizer::PERCENT_DECODE | Normalizer::FOLD_WHITESPACE);
+    ASSERT_TRUE(VectorEquivalent(hw.Find(request), {0, 1}));
+
+    // positions point into the original text
+    std::vector<HyperscanWrapper<int>::Match> matches = hw.FindMatches(request);
+    ASSERT_EQ(matches.size(), 2);
+    ASSERT_EQ(matches[0].data, 0);
+    ASSERT_EQ(matches[0].to, request.find("FROM") + 4);
+    ASSERT_EQ(matches[1].data, 1);
+    ASSERT_EQ(matches[1].to, request.size());
+
+    // the thread's buffer is released after a huge text, the next search still normalizes
+    huge += " SELECT  FROM";
+    ASSERT_TRUE(VectorEquivalent(hw.Find(huge), {0}));
+    ASSERT_TRUE(VectorEquivalent(hw.Find(request), {0, 1}));
+
+    // without a snapshot there is nothing to normalize for
+    HyperscanWrapper<int> empty;
+    empty.SetNormalization(Normalizer::LOWERCASE);
+    ASSERT_TRUE(empty.Find(request).empty());
+    ASSERT_TRUE(empty.FindMatches(request).empty());
+
+    hw.SetNormalization(0);
+    ASSERT_TRUE(hw.Find(request).empty());
+}
+
+TEST (HyperscanWrapper, StreamPreparedInBuild) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(2);
+    hw.SetStreaming(true);
+
+    hw.Insert("Putin", 0);
+    hw.Insert("bomba", 1);
+    ASSERT_TRUE(hw.Build());
+
+    Error error;
+    auto stream = hw.OpenStream(&error);
+    ASSERT_TRUE(stream.IsOpen());
+
+    std::vector<int> res;
+    ASSERT_TRUE(stream.Scan("Pu", 2, res, &error));
+    ASSERT_TRUE(stream.Scan("tin", 3, res, &error));
+    ASSERT_TRUE(VectorEquivalent(res, {0}));
+
+    // the new snapshot is prepared too, the old stream keeps its own
+    hw.Insert("teract", 2);
+    ASSERT_TRUE(hw.Build());
+
+    auto next = hw.OpenStream(&error);
+    ASSERT_TRUE(next.IsOpen());
+
+    res.clear();
+    ASSERT_TRUE(next.Scan("inter", 5, res, &error));
+    ASSERT_TRUE(next.Scan("act bomba", 9, res, &error));
+    ASSERT_TRUE(VectorEquivalent(res, {2, 1}));
+
+    res.clear();
+    ASSERT_TRUE(stream.Scan(" bomba", 6, res, &error));
+    ASSERT_TRUE(VectorEquivalent(res, {1}));
+}
+
+TEST (HyperscanWrapper, Validate) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(2);
+
+    ASSERT_TRUE(hw.Insert("Putin", 0));
+    ASSERT_TRUE(hw.Insert("bomba(", 1));
+    ASSERT_TRUE(hw.Insert("teract", 2));
+    ASSERT_TRUE(hw.Insert("acme", "[IOI_239", 3));
+    ASSERT_TRUE(hw.Insert("acme", "rule0x", 4));
+
+    // every bad pattern is reported, not only the first one
+    auto invalid = hw.Validate(2);
+    ASSERT_EQ(invalid.size(), 2);
+    ASSERT_EQ(invalid[0].id, 1);
+    ASSERT_EQ(invalid[0].pattern, "bomba(");
+    ASSERT_EQ(invalid[0].data, 1);
+    ASSERT_FALSE(invalid[0].message.empty());
+    ASSERT_EQ(invalid[1].id, 3);
+    ASSERT_EQ(invalid[1].group, "acme");
+
+    Error error;
+    ASSERT_FALSE(hw.Build(&error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::BUILD_ERROR);
+    ASSERT_TRUE(error.GetBadPattern() == "bomba(" || error.GetBadPattern() == "[IOI_239");
+
+    // the rest of the rules are deployed
+    hw.SetSkipInvalidPatterns(true);
+    ASSERT_TRUE(hw.Build(&error));
+    ASSERT_TRUE(VectorEquivalent(hw.Find("Putin bomba( teract [IOI_239 rule0x"), {0, 2, 4}));
+
+    auto skipped = hw.SkippedPatterns();
+    ASSERT_EQ(skipped.size(), 2);
+    ASSERT_EQ(skipped[0].id, 1);
+    ASSERT_EQ(skipped[1].id, 3);
+
+    // skipped patterns are remembered until deleted
+    ASSERT_TRUE(hw.Build());
+    ASSERT_EQ(hw.CompiledShardCount(), 0);
+    ASSERT_EQ(hw.SkippedPatterns().size(), 2);
+
+    ASSERT_TRUE(hw.Delete("bomba(", 1));
+    ASSERT_TRUE(hw.Delete("acme", "[IOI_239", 3));
+    ASSERT_TRUE(hw.Build());
+    ASSERT_TRUE(hw.SkippedPatterns().empty());
+    ASSERT_TRUE(hw.Validate().empty());
+}
+
+#ifdef HYPERSCAN_CHIMERA
+TEST (HyperscanWrapper, ChimeraFallback) {
+    HyperscanWrapper<int> hw;
+    hw.SetShardCount(2);
+
+    // a backreference and a lookahead are not supported by hyperscan
+    ASSERT_TRUE(hw.Insert("Putin", 0));
+    ASSERT_TRUE(hw.Insert("(bo)mba\\1", 1));
+    ASSERT_TRUE(hw.Insert("teract", 2));
+    ASSERT_TRUE(hw.Insert("acme", "rule(?=0x)", 3));
+    ASSERT_TRUE(hw.Insert("acme", "IOI_239", 4));
+
+    Error error;
+    ASSERT_TRUE(hw.Build(&error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::SUCCESS);
+
+    ASSERT_TRUE(VectorEquivalent(hw.Find("Putin bombabo teract rule0x IOI_239"), {0, 1, 2, 3, 4}));
+    ASSERT_TRUE(VectorEquivalent(hw.Find("Putin bomba rule1x"), {0}));
+
+    auto groups = hw.Find("bombabo rule0x IOI_239", {"acme"});
+    ASSERT_TRUE(VectorEquivalent(groups["acme"], {3, 4}));
+
+    auto matches = hw.FindMatches("rule0x bombabo Putin");
+    ASSERT_EQ(matches.size(), 3);
+    ASSERT_EQ(matches[0].data, 3);
+    ASSERT_EQ(matches[1].data, 1);
+    ASSERT_EQ(matches[2].data, 0);
+
+    ASSERT_TRUE(hw.Revoke("(bo)mba\\1", 1));
+    ASSERT_TRUE(VectorEquivalent(hw.Find("Putin bombabo"), {0}));
+
+    // the fallback is remembered, the next Build does not compile the shards of hyperscan again
+    ASSERT_TRUE(hw.Insert("(bo)mba\\1", 1));
+    ASSERT_TRUE(hw.Build(&error));
+    ASSERT_EQ(hw.CompiledShardCount(), 0);
+    ASSERT_TRUE(VectorEquivalent(hw.Find("Putin bombabo"), {0, 1}));
+
+    // only chimera patterns
+    HyperscanWrapper<int> only;
+    ASSERT_TRUE(only.Insert("(a)\\1", 0));
+    ASSERT_TRUE(only.Build());
+    ASSERT_TRUE(VectorEquivalent(only.Find("xaax"), {0}));
+
+    // a syntax error is still an error
+    ASSERT_TRUE(hw.Insert("bomba(", 5));
+    ASSERT_FALSE(hw.Build(&error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::BUILD_ERROR);
+}
+#endif
+
 TEST (HyperscanWrapper, Or) {
     HyperscanWrapper<int> hw;
 
@@ -47,4 +47,40 @@ TEST (HyperscanWithEscapedCharacter, ManualRegex) {
     }
 }
 
+TEST (HyperscanWithEscapedCharacter, Revoke) {
+    HyperscanWithEscapedCharacter<int> ps;
+
+    ASSERT_TRUE(ps.Insert("*bomba*", 0));
+    ASSERT_TRUE(ps.Insert("acme", "*Put?n*", 1));
+    ASSERT_TRUE(ps.Build());
+
+    // the pattern is escaped the same way as in Insert
+    Error error;
+    ASSERT_TRUE(ps.Revoke("*bomba*", 0, &error));
+    ASSERT_TRUE(ps.Revoke("acme", "*Put?n*", 1, &error));
+    ASSERT_TRUE(VectorEquivalent(ps.Find("xbombax Putin"), {}));
+
+    ASSERT_FALSE(ps.Revoke("*bomba*", 0, &error));
+    ASSERT_EQ(error.GetErrorCode(), ErrorCode::PATTERN_AND_DATA_NOT_FOUND);
+}
+
+TEST (HyperscanWithEscapedCharacter, PatternId) {
+    HyperscanWithEscapedCharacter<int> ps;
+
+    ASSERT_TRUE(ps.Insert("*bomba*", 0));
+    ASSERT_TRUE(ps.Insert("acme", "*Put?n*", 1));
+    ASSERT_TRUE(ps.Build());
+
+    size_t bomba = 0;
+    size_t putin = 0;
+    ASSERT_TRUE(ps.PatternId("*bomba*", 0, &bomba));
+    ASSERT_TRUE(ps.PatternId("acme", "*Put?n*", 7, 1, &putin));
+
+    PatternMask mask;
+    mask.Set(putin);
+    ASSERT_TRUE(VectorEquivalent(ps.Find("xbombax Putin", mask), {1}));
+    mask.Set(bomba);
+    ASSERT_TRUE(VectorEquivalent(ps.Find("xbombax Putin", mask), {0, 1}));
+}
+
 #endif
@@ -5,6 +5,9 @@
 #include <cassert>
 #include <mutex>
 #include <vector>
+#include <string>
+
+#include <StringView.h>
 
 namespace Hyperscan {
 
@@ -21,34 +24,32 @@ public:
     }
 
     bool Insert(const char * pattern, size_t len, const DataT& data) {
-        return Insert(std::string(pattern, pattern + len), data);
+        return Insert(StringView(pattern, len), data);
     }
 
-    bool Insert(const std::string &pattern, const DataT& data) {
-        auto r = _patterns.insert(std::make_pair(pattern, data));
+    bool Insert(StringView pattern, const DataT& data) {
+        auto r = _patterns.insert(std::make_pair(pattern.ToString(), data));
         return r.second;
     }
 
     bool Delete(const char * pattern, size_t len, const DataT& data) {
-        return Delete(std::string(pattern, pattern + len), data);
+        return Delete(StringView(pattern, len), data);
     }
 
-    bool Delete(const std::string &pattern, const DataT& data) {
-        auto r = _patterns.erase(std::make_pair(pattern, data));
+    bool Delete(StringView pattern, const DataT& data) {
+        auto r = _patterns.erase(std::make_pair(pattern.ToString(), data));
         return r;
     }
 
     std::vector<DataT> Find(const char *text, size_t len) const {
-        return Find(std::string(text, text + len));
+        return Find(StringView(text, len));
     }
 
-    std::vector<DataT> Find(const std::string &text) const {
+    std::vector<DataT> Find(StringView text) const {
         std::set<DataT> res;
 
         for (auto& pp: _patterns) {
-            const std::string& pattern = pp.first;
-
-            if (text.find(pattern) != std::string::npos) {
+            if (text.find(StringView(pp.first)) != StringView::npos) {
                 res.insert(pp.second);
             }
         }
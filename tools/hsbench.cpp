@@ -0,0 +1,554 @@
+/*
+ * hsbench - прогон HyperscanWrapper на реальном наборе правил и корпусе
+ *
+ *   hsbench -p rules.txt -c corpus/ -m block -t 4 -n 3
+ *
+ * Файл правил: строка "id:/regex/flags", пустые строки и строки с '#' пропускаются.
+ * Корпус: файл (один документ или по строке на документ с --lines), директория (файл - документ)
+ * или файл записей с --records (4 байта длины little-endian + байты записи).
+ * */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <Hyperscan.h>
+#include <AsyncScanner.h>
+#include <LinearSearch.h>
+#include <BoostScan.h>
+
+namespace {
+
+using namespace Hyperscan;
+using namespace std;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    string patterns;
+    string corpus;
+    bool records = false;
+    bool lines = false;
+    string mode = "block";
+    string engine = "hyperscan";
+    size_t threads = 1;
+    size_t repeats = 1;
+    size_t chunk = 4096;
+    size_t inflight = 1024;
+    size_t shards = 0;
+};
+
+struct Rule {
+    unsigned id;
+    string pattern;     // with the inline flags in front
+    string literal;     // the expression as written, for LinearSearch
+};
+
+/**
+ * @brief корпус: все документы лежат подряд в одном буфере
+ */
+struct Corpus {
+    string buffer;
+    vector<size_t> ends;
+    vector<StringView> docs;
+
+    void Add(const char * data, size_t len) {
+        buffer.append(data, len);
+        ends.push_back(buffer.size());
+    }
+
+    void Seal() {
+        size_t begin = 0;
+        for (size_t end: ends) {
+            docs.push_back(StringView(buffer.data() + begin, end - begin));
+            begin = end;
+        }
+    }
+};
+
+/**
+ * @brief результат прогона: время, байты, совпадения и задержка каждого сканирования в микросекундах
+ */
+struct Run {
+    double seconds = 0;
+    size_t bytes = 0;
+    size_t matches = 0;
+    vector<double> latency;
+};
+
+void Usage() {
+    cerr << "usage: hsbench -p PATTERNS -c CORPUS [options]\n"
+            "  -p, --patterns FILE   rules, one \"id:/regex/flags\" per line\n"
+            "  -c, --corpus PATH     file, directory (a file per document) or records file\n"
+            "      --records         corpus is 4-byte little-endian length + bytes records\n"
+            "      --lines           each line of the corpus file is a document\n"
+            "  -m, --mode MODE       block (default), batch (AsyncScanner) or stream\n"
+            "  -e, --engine ENGINE   hyperscan (default), linear or boost, baselines run in block mode\n"
+            "  -t, --threads N       scanning threads, 1 by default\n"
+            "  -n, --repeats N       passes over the corpus, 1 by default\n"
+            "      --chunk N         bytes per Stream::Scan in stream mode, 4096 by default\n"
+            "      --inflight N      AsyncScanner maxInFlight in batch mode, 1024 by default\n"
+            "      --shards N        HyperscanWrapper::SetShardCount\n";
+}
+
+bool ParseSize(const char * s, size_t& out) {
+    char * end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (!*s || *end || v == 0) return false;
+
+    out = v;
+    return true;
+}
+
+bool ParseArgs(int argc, char ** argv, Options& opt) {
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        const char * value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        auto need = [&]() {
+            if (!value) cerr << "hsbench: " << a << " needs a value" << endl;
+            ++i;
+            return value != nullptr;
+        };
+
+        bool ok = true;
+
+        if (a == "-p" || a == "--patterns") {
+            ok = need() && (opt.patterns = value, true);
+        } else if (a == "-c" || a == "--corpus") {
+            ok = need() && (opt.corpus = value, true);
+        } else if (a == "--records") {
+            opt.records = true;
+        } else if (a == "--lines") {
+            opt.lines = true;
+        } else if (a == "-m" || a == "--mode") {
+            ok = need() && (opt.mode = value, true);
+        } else if (a == "-e" || a == "--engine") {
+            ok = need() && (opt.engine = value, true);
+        } else if (a == "-t" || a == "--threads") {
+            ok = need() && ParseSize(value, opt.threads);
+        } else if (a == "-n" || a == "--repeats") {
+            ok = need() && ParseSize(value, opt.repeats);
+        } else if (a == "--chunk") {
+            ok = need() && ParseSize(value, opt.chunk);
+        } else if (a == "--inflight") {
+            ok = need() && ParseSize(value, opt.inflight);
+        } else if (a == "--shards") {
+            ok = need() && ParseSize(value, opt.shards);
+        } else if (a == "-h" || a == "--help") {
+            return false;
+        } else {
+            cerr << "hsbench: unknown option " << a << endl;
+            return false;
+        }
+
+        if (!ok) {
+            if (value) cerr << "hsbench: bad value for " << a << ": " << value << endl;
+            return false;
+        }
+    }
+
+    if (opt.patterns.empty() || opt.corpus.empty()) {
+        cerr << "hsbench: -p and -c are required" << endl;
+        return false;
+    }
+
+    if (opt.mode != "block" && opt.mode != "batch" && opt.mode != "stream") {
+        cerr << "hsbench: unknown mode " << opt.mode << endl;
+        return false;
+    }
+
+    if (opt.engine != "hyperscan" && opt.engine != "linear" && opt.engine != "boost") {
+        cerr << "hsbench: unknown engine " << opt.engine << endl;
+        return false;
+    }
+
+#ifndef BENCHMARK
+    if (opt.engine == "boost") {
+        cerr << "hsbench: boost baseline needs a BENCHMARK=y build" << endl;
+        return false;
+    }
+#endif
+
+    if (opt.engine != "hyperscan" && opt.mode != "block") {
+        cerr << "hsbench: baselines run in block mode only" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief читает правила "id:/regex/flags"
+ *
+ *   HyperscanWrapper компилирует все паттерны с HS_FLAG_SINGLEMATCH, поэтому флаги i, m, s, x <br>
+ * переводятся во встроенные модификаторы (?imsx) перед выражением, H пропускается, остальные <br>
+ * игнорируются с предупреждением.
+ */
+bool LoadRules(const string& path, vector<Rule>& rules) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "hsbench: can not open " << path << endl;
+        return false;
+    }
+
+    string line;
+    for (size_t n = 1; getline(in, line); ++n) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        size_t colon = line.find(':');
+        size_t close = line.rfind('/');
+        char * end = nullptr;
+        unsigned long id = colon == string::npos ? 0 : strtoul(line.c_str(), &end, 10);
+
+        if (colon == string::npos || end != line.c_str() + colon || colon == 0 ||
+            line.size() < colon + 3 || line[colon + 1] != '/' || close <= colon + 1)
+        {
+            cerr << "hsbench: " << path << ":" << n << ": expected id:/regex/flags" << endl;
+            return false;
+        }
+
+        Rule rule;
+        rule.id = id;
+        rule.literal = line.substr(colon + 2, close - colon - 2);
+
+        string inlineFlags;
+        for (char f: line.substr(close + 1)) {
+            if (f == 'i' || f == 'm' || f == 's' || f == 'x') {
+                inlineFlags.push_back(f);
+            } else if (f != 'H') {
+                cerr << "hsbench: " << path << ":" << n << ": flag " << f << " ignored" << endl;
+            }
+        }
+
+        rule.pattern = (inlineFlags.empty() ? "" : "(?" + inlineFlags + ")") + rule.literal;
+        rules.push_back(std::move(rule));
+    }
+
+    return true;
+}
+
+bool ReadFile(const string& path, string& out) {
+    ifstream in(path, ios::binary);
+    if (!in) {
+        cerr << "hsbench: can not open " << path << endl;
+        return false;
+    }
+
+    ostringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+bool LoadCorpus(const Options& opt, Corpus& corpus) {
+    struct stat st;
+    if (stat(opt.corpus.c_str(), &st) != 0) {
+        cerr << "hsbench: can not stat " << opt.corpus << endl;
+        return false;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR * dir = opendir(opt.corpus.c_str());
+        if (!dir) {
+            cerr << "hsbench: can not open " << opt.corpus << endl;
+            return false;
+        }
+
+        vector<string> names;
+        while (dirent * e = readdir(dir)) {
+            string path = opt.corpus + "/" + e->d_name;
+            if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) names.push_back(path);
+        }
+        closedir(dir);
+
+        // a stable order, so runs over the same directory are comparable
+        sort(names.begin(), names.end());
+
+        string data;
+        for (auto& name: names) {
+            if (!ReadFile(name, data)) return false;
+            corpus.Add(data.data(), data.size());
+        }
+    } else {
+        string data;
+        if (!ReadFile(opt.corpus, data)) return false;
+
+        if (opt.records) {
+            size_t pos = 0;
+            while (pos < data.size()) {
+                if (data.size() - pos < 4) {
+                    cerr << "hsbench: truncated record header at " << pos << endl;
+                    return false;
+                }
+
+                const unsigned char * h = reinterpret_cast<const unsigned char *>(data.data() + pos);
+                size_t len = size_t(h[0]) | size_t(h[1]) << 8 | size_t(h[2]) << 16 | size_t(h[3]) << 24;
+                pos += 4;
+
+                if (data.size() - pos < len) {
+                    cerr << "hsbench: truncated record at " << pos - 4 << endl;
+                    return false;
+                }
+
+                corpus.Add(data.data() + pos, len);
+                pos += len;
+            }
+        } else if (opt.lines) {
+            size_t begin = 0;
+            while (begin < data.size()) {
+                size_t end = data.find('\n', begin);
+                if (end == string::npos) end = data.size();
+
+                corpus.Add(data.data() + begin, end - begin);
+                begin = end + 1;
+            }
+        } else {
+            corpus.Add(data.data(), data.size());
+        }
+    }
+
+    corpus.Seal();
+    return true;
+}
+
+/**
+ * @brief сканирует корпус \a repeats раз в \a threads потоках, поток t берет документы t, t + threads, ...
+ * @param scan(thread, doc) возвращает кол-во совпадений
+ */
+Run RunThreads(const Corpus& corpus, size_t threads, size_t repeats, function<size_t(size_t, StringView)> scan) {
+    Run run;
+    vector<vector<double>> latency(threads);
+    vector<size_t> matches(threads, 0);
+    vector<thread> workers;
+
+    auto start = Clock::now();
+
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for (size_t r = 0; r < repeats; ++r) {
+                for (size_t i = t; i < corpus.docs.size(); i += threads) {
+                    auto s = Clock::now();
+                    matches[t] += scan(t, corpus.docs[i]);
+                    latency[t].push_back(std::chrono::duration<double, std::micro>(Clock::now() - s).count());
+                }
+            }
+        });
+    }
+
+    for (auto& w: workers) {
+        w.join();
+    }
+
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (size_t t = 0; t < threads; ++t) {
+        run.matches += matches[t];
+        run.latency.insert(run.latency.end(), latency[t].begin(), latency[t].end());
+    }
+
+    return run;
+}
+
+/**
+ * @brief batch: все документы отдаются AsyncScanner, задержка - от Submit до callback
+ */
+Run RunBatch(const HyperscanWrapper<unsigned>& hw, const Corpus& corpus, const Options& opt) {
+    const size_t total = corpus.docs.size() * opt.repeats;
+
+    Run run;
+    run.latency.resize(total);
+
+    vector<Clock::time_point> submitted(total);
+    atomic<size_t> done(0);
+    atomic<size_t> matches(0);
+    atomic<size_t> errors(0);
+
+    auto start = Clock::now();
+    {
+        AsyncScanner<unsigned> scanner(hw, opt.threads, opt.inflight);
+
+        for (size_t tag = 0; tag < total; ++tag) {
+            StringView doc = corpus.docs[tag % corpus.docs.size()];
+            submitted[tag] = Clock::now();
+
+            auto callback = [&](AsyncScanner<unsigned>::Completion& c) {
+                run.latency[c.tag] = std::chrono::duration<double, std::micro>(Clock::now() - submitted[c.tag]).count();
+                matches.fetch_add(c.matches.size(), std::memory_order_relaxed);
+                if (c.error.GetErrorCode() != ErrorCode::SUCCESS) errors.fetch_add(1, std::memory_order_relaxed);
+                done.fetch_add(1, std::memory_order_release);
+            };
+
+            // backpressure: wait for the workers instead of dropping the document
+            while (!scanner.Submit(doc.data(), doc.size(), tag, callback)) {
+                std::this_thread::yield();
+            }
+        }
+
+        while (done.load(std::memory_order_acquire) < total) {
+            std::this_thread::yield();
+        }
+    }
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    run.matches = matches;
+
+    if (errors) cerr << "hsbench: " << errors << " scans failed" << endl;
+    return run;
+}
+
+double Percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+
+    size_t rank = size_t(p / 100 * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+void Report(const Options& opt, Run& run, size_t scans) {
+    sort(run.latency.begin(), run.latency.end());
+
+    cout << fixed << setprecision(3);
+    cout << "mode: " << opt.mode << "; engine: " << opt.engine << "; threads: " << opt.threads
+         << "; repeats: " << opt.repeats << endl;
+    cout << "scan sec: " << run.seconds << "; GB/s: " << run.bytes / run.seconds / 1e9
+         << "; scans/s: " << scans / run.seconds << "; matches: " << run.matches << endl;
+    cout << "latency us: p50 " << Percentile(run.latency, 50) << "; p90 " << Percentile(run.latency, 90)
+         << "; p99 " << Percentile(run.latency, 99) << "; p99.9 " << Percentile(run.latency, 99.9)
+         << "; max " << (run.latency.empty() ? 0 : run.latency.back()) << endl;
+}
+
+int RunHyperscan(const Options& opt, const vector<Rule>& rules, const Corpus& corpus) {
+    HyperscanWrapper<unsigned> hw;
+    hw.SetSkipInvalidPatterns(true);
+    if (opt.shards) hw.SetShardCount(opt.shards);
+
+    Error error;
+    size_t rejected = 0;
+    for (auto& rule: rules) {
+        if (!hw.Insert(rule.pattern, rule.id, &error)) {
+            cerr << "hsbench: rule " << rule.id << ": " << error.GetErrorMessage() << endl;
+            ++rejected;
+        }
+    }
+
+    auto start = Clock::now();
+    if (!hw.Build(&error)) {
+        cerr << "hsbench: build failed: " << error.GetErrorMessage() << " " << error.GetBadPattern() << endl;
+        return 1;
+    }
+    double compile = std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto skipped = hw.SkippedPatterns();
+    for (auto& invalid: skipped) {
+        cerr << "hsbench: rule " << invalid.data << " skipped: " << invalid.message << endl;
+    }
+
+    cout << fixed << setprecision(3);
+    cout << "patterns: " << hw.Size() - skipped.size() << "; rejected: " << rejected + skipped.size() << endl;
+    cout << "compile sec: " << compile << "; database bytes: " << hw.DatabaseSize() << endl;
+
+    Run run;
+    if (opt.mode == "block") {
+        vector<unique_ptr<HyperscanWrapper<unsigned>::Scratch>> scratches;
+        vector<vector<unsigned>> results(opt.threads);
+        for (size_t t = 0; t < opt.threads; ++t) {
+            scratches.emplace_back(new HyperscanWrapper<unsigned>::Scratch());
+        }
+
+        run = RunThreads(corpus, opt.threads, opt.repeats, [&](size_t t, StringView doc) {
+            results[t].clear();
+            hw.Find(doc.data(), doc.size(), results[t], *scratches[t]);
+            return results[t].size();
+        });
+    } else if (opt.mode == "batch") {
+        run = RunBatch(hw, corpus, opt);
+    } else {
+        vector<unique_ptr<HyperscanWrapper<unsigned>::Scratch>> scratches;
+        vector<vector<unsigned>> results(opt.threads);
+        for (size_t t = 0; t < opt.threads; ++t) {
+            scratches.emplace_back(new HyperscanWrapper<unsigned>::Scratch());
+        }
+
+        run = RunThreads(corpus, opt.threads, opt.repeats, [&](size_t t, StringView doc) {
+            results[t].clear();
+
+            auto stream = hw.OpenStream();
+            for (size_t pos = 0; pos < doc.size(); pos += opt.chunk) {
+                stream.Scan(doc.data() + pos, std::min(opt.chunk, doc.size() - pos), results[t], *scratches[t]);
+            }
+            stream.Close(results[t], *scratches[t]);
+
+            return results[t].size();
+        });
+    }
+
+    run.bytes = corpus.buffer.size() * opt.repeats;
+    Report(opt, run, corpus.docs.size() * opt.repeats);
+    return 0;
+}
+
+template <class PatternSearchT>
+int RunBaseline(const Options& opt, const vector<Rule>& rules, const Corpus& corpus) {
+    PatternSearchT ps;
+
+    auto start = Clock::now();
+    for (auto& rule: rules) {
+        ps.Insert(opt.engine == "linear" ? rule.literal : rule.pattern, rule.id);
+    }
+    ps.Build();
+    double compile = std::chrono::duration<double>(Clock::now() - start).count();
+
+    cout << fixed << setprecision(3);
+    cout << "patterns: " << ps.Size() << "; compile sec: " << compile << endl;
+
+    Run run = RunThreads(corpus, opt.threads, opt.repeats, [&](size_t, StringView doc) {
+        return ps.Find(doc).size();
+    });
+
+    run.bytes = corpus.buffer.size() * opt.repeats;
+    Report(opt, run, corpus.docs.size() * opt.repeats);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    Options opt;
+    if (!ParseArgs(argc, argv, opt)) {
+        Usage();
+        return 2;
+    }
+
+    vector<Rule> rules;
+    Corpus corpus;
+    if (!LoadRules(opt.patterns, rules) || !LoadCorpus(opt, corpus)) return 1;
+
+    cout << "rules: " << rules.size() << "; documents: " << corpus.docs.size()
+         << "; corpus MB: " << fixed << setprecision(3) << corpus.buffer.size() / 1e6 << endl;
+
+    if (corpus.docs.empty()) {
+        cerr << "hsbench: empty corpus" << endl;
+        return 1;
+    }
+
+    if (opt.engine == "linear") return RunBaseline<LinearSearch<unsigned>>(opt, rules, corpus);
+#ifdef BENCHMARK
+    if (opt.engine == "boost") return RunBaseline<BoostScan<unsigned>>(opt, rules, corpus);
+#endif
+
+    return RunHyperscan(opt, rules, corpus);
+}